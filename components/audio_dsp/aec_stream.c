@@ -0,0 +1,109 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "audio_element.h"
+#include "audio_mem.h"
+
+#include "echo_canceller.h"
+#include "aec_stream.h"
+
+static const char *TAG = "AEC";
+
+typedef struct {
+	echo_canceller_t ec;
+	int64_t cpu_us;
+} aec_stream_t;
+
+static esp_err_t _aec_open(audio_element_handle_t self)
+{
+	aec_stream_t *as = (aec_stream_t *)audio_element_getdata(self);
+	echo_canceller_start(&as->ec);
+	as->cpu_us = 0;
+	return ESP_OK;
+}
+
+static esp_err_t _aec_close(audio_element_handle_t self)
+{
+	return ESP_OK;
+}
+
+static audio_element_err_t _aec_process(audio_element_handle_t self, char *buf, int len)
+{
+	aec_stream_t *as = (aec_stream_t *)audio_element_getdata(self);
+
+	int r = audio_element_input(self, buf, len & ~1);
+	if (r <= 0) return r;
+
+	int64_t start = esp_timer_get_time();
+	echo_canceller_process(&as->ec, (int16_t *)buf, r / sizeof(int16_t));
+	as->cpu_us += esp_timer_get_time() - start;
+
+	int w = audio_element_output(self, buf, r & ~1);
+	return w > 0 ? r : w;
+}
+
+static esp_err_t _aec_destroy(audio_element_handle_t self)
+{
+	aec_stream_t *as = (aec_stream_t *)audio_element_getdata(self);
+	audio_free(as);
+	return ESP_OK;
+}
+
+void aec_stream_reference(audio_element_handle_t self, const int16_t *x, int count)
+{
+	aec_stream_t *as = (aec_stream_t *)audio_element_getdata(self);
+	echo_canceller_reference(&as->ec, x, count);
+}
+
+void aec_stream_set_delay(audio_element_handle_t self, int delay)
+{
+	aec_stream_t *as = (aec_stream_t *)audio_element_getdata(self);
+	echo_canceller_set_delay(&as->ec, delay);
+}
+
+int64_t aec_stream_get_cpu_us(audio_element_handle_t self)
+{
+	aec_stream_t *as = (aec_stream_t *)audio_element_getdata(self);
+	return as->cpu_us;
+}
+
+int aec_stream_suppression_db(audio_element_handle_t self)
+{
+	aec_stream_t *as = (aec_stream_t *)audio_element_getdata(self);
+	return echo_canceller_suppression_db(&as->ec);
+}
+
+void aec_stream_stats(audio_element_handle_t self, echo_canceller_stats_t *stats)
+{
+	aec_stream_t *as = (aec_stream_t *)audio_element_getdata(self);
+	echo_canceller_stats(&as->ec, stats);
+}
+
+audio_element_handle_t aec_stream_init(aec_stream_cfg_t *config)
+{
+	aec_stream_t *as = audio_calloc(1, sizeof(aec_stream_t));
+	AUDIO_MEM_CHECK(TAG, as, return NULL);
+	echo_canceller_init(&as->ec, config->taps, config->delay);
+
+	audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+	cfg.open = _aec_open;
+	cfg.close = _aec_close;
+	cfg.process = _aec_process;
+	cfg.destroy = _aec_destroy;
+	cfg.task_stack = config->task_stack;
+	cfg.task_core = config->task_core;
+	cfg.task_prio = config->task_prio;
+	cfg.out_rb_size = config->out_rb_size;
+	cfg.tag = "aec";
+
+	audio_element_handle_t el = audio_element_init(&cfg);
+	AUDIO_MEM_CHECK(TAG, el, {
+		audio_free(as);
+		return NULL;
+	});
+	audio_element_setdata(el, as);
+	return el;
+}
@@ -0,0 +1,60 @@
+#ifndef AEC_STREAM_H
+#define AEC_STREAM_H
+
+#include <stdint.h>
+
+#include "audio_element.h"
+#include "echo_canceller.h"
+
+typedef struct {
+	int taps;               // Echo path covered, at most EC_MAX_TAPS
+	int delay;              // Speaker reference to microphone, samples
+	int out_rb_size;
+	int task_stack;
+	int task_core;
+	int task_prio;
+} aec_stream_cfg_t;
+
+#define AEC_STREAM_TASK_STACK   (3 * 1024)
+#define AEC_STREAM_RB_SIZE      (2 * 1024)
+
+#define DEFAULT_AEC_STREAM_CONFIG() { \
+	.taps = 256, \
+	.delay = 960, \
+	.out_rb_size = AEC_STREAM_RB_SIZE, \
+	.task_stack = AEC_STREAM_TASK_STACK, \
+	.task_core = 0, \
+	.task_prio = 5, \
+}
+
+/**
+ * @brief Echo canceller on 16 bit mono microphone audio, see echo_canceller.h
+ *
+ * The filter is learned again on every open, the reference is kept.
+ */
+audio_element_handle_t aec_stream_init(aec_stream_cfg_t *config);
+
+/**
+ * @brief Feed what goes to the speaker, mono at the microphone rate
+ *
+ * From the speaker task only, for example as a mixer tap.
+ */
+void aec_stream_reference(audio_element_handle_t self, const int16_t *x, int count);
+
+/**
+ * @brief Set the speaker reference to microphone delay, samples
+ *
+ * While the element is stopped, between calls.
+ */
+void aec_stream_set_delay(audio_element_handle_t self, int delay);
+
+/**
+ * @brief Microseconds spent cancelling since the element was opened
+ */
+int64_t aec_stream_get_cpu_us(audio_element_handle_t self);
+
+int aec_stream_suppression_db(audio_element_handle_t self);
+
+void aec_stream_stats(audio_element_handle_t self, echo_canceller_stats_t *stats);
+
+#endif
@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "filter_resample.h"
+#include "freertos/FreeRTOS.h"
+#include "ringbuf.h"
+
+#include "audio_chain.h"
+#include "channel_dup.h"
+#include "decimator.h"
+#include "decimator_stream.h"
+
+static const char *TAG = "AUDIO_CHAIN";
+
+#define AUDIO_CHAIN_LIST    4       // Chains sampled
+
+/* One timer samples every chain, it skips those not running */
+static esp_timer_handle_t sample_timer;
+static audio_chain_t *chains[AUDIO_CHAIN_LIST];
+static portMUX_TYPE fill_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void sample_chains(void *arg)
+{
+	for (int c = 0; c < AUDIO_CHAIN_LIST && chains[c] != NULL; c++) {
+		audio_chain_t *chain = chains[c];
+		if (!chain->running) continue;
+		for (int i = 0; i < chain->count; i++) {
+			ringbuf_handle_t rb = audio_element_get_output_ringbuf(chain->el[i]);
+			if (rb == NULL) continue;
+			int filled = rb_bytes_filled(rb);
+			int size = rb_get_size(rb);
+			if (filled < 0) continue;
+
+			audio_chain_fill_t *f = &chain->fill[i];
+			portENTER_CRITICAL(&fill_mux);
+			f->samples++;
+			f->sum += filled;
+			if (filled > f->max) f->max = filled;
+			if (filled == 0) f->empty++;
+			if (filled >= size) f->full++;
+			portEXIT_CRITICAL(&fill_mux);
+		}
+	}
+}
+
+void audio_chain_init(audio_chain_t *chain, audio_pipeline_handle_t pipeline, const char *name)
+{
+	memset(chain, 0, sizeof(*chain));
+	chain->pipeline = pipeline;
+	chain->name = name;
+
+	int c = 0;
+	while (c < AUDIO_CHAIN_LIST && chains[c] != NULL && chains[c] != chain) c++;
+	if (c == AUDIO_CHAIN_LIST) {
+		ESP_LOGW(TAG, "%s: fill not sampled, more than %d chains", name, AUDIO_CHAIN_LIST);
+		return;
+	}
+	chains[c] = chain;
+
+	if (sample_timer != NULL) return;
+	const esp_timer_create_args_t timer_args = {
+		.callback = sample_chains,
+		.name = "chain_fill",
+	};
+	if (esp_timer_create(&timer_args, &sample_timer) == ESP_OK) {
+		esp_timer_start_periodic(sample_timer, AUDIO_CHAIN_SAMPLE_MS * 1000);
+	}
+}
+
+void audio_chain_format(audio_chain_t *chain, int rate, int channels, int bits)
+{
+	chain->format_bytes_per_ms = rate * channels * bits / 8 / 1000;
+}
+
+esp_err_t audio_chain_add(audio_chain_t *chain, audio_element_handle_t el, const char *tag)
+{
+	if (el == NULL || chain->count >= AUDIO_CHAIN_MAX) return ESP_FAIL;
+	chain->el[chain->count] = el;
+	chain->bytes_per_ms[chain->count] = chain->format_bytes_per_ms;
+	chain->tag[chain->count++] = tag;
+	return audio_pipeline_register(chain->pipeline, el, tag);
+}
+
+esp_err_t audio_chain_convert(audio_chain_t *chain, int src_rate, int src_ch,
+	int dst_rate, int dst_ch, int complexity)
+{
+	audio_chain_format(chain, dst_rate, dst_ch, 16);
+	if (src_rate == dst_rate * DECIMATOR_FACTOR && src_ch == 1 && dst_ch == 1) {
+		decimator_stream_cfg_t decim_cfg = DEFAULT_DECIMATOR_STREAM_CONFIG();
+		chain->stage = decimator_stream_init(&decim_cfg);
+		chain->stage_name = "6:1 decimator";
+		chain->stage_cpu_us = decimator_stream_get_cpu_us;
+		return audio_chain_add(chain, chain->stage, "decim");
+	}
+
+	if (src_rate != dst_rate) {
+		rsp_filter_cfg_t rsp_cfg = DEFAULT_RESAMPLE_FILTER_CONFIG();
+		rsp_cfg.src_rate = src_rate;
+		rsp_cfg.src_ch = src_ch;
+		rsp_cfg.dest_rate = dst_rate;
+		rsp_cfg.dest_ch = dst_ch;
+		rsp_cfg.complexity = complexity;
+		chain->resample = true;
+		return audio_chain_add(chain, rsp_filter_init(&rsp_cfg), "filter");
+	}
+
+	if (src_ch == dst_ch) return ESP_OK;
+
+	channel_dup_cfg_t dup_cfg = DEFAULT_CHANNEL_DUP_CONFIG();
+	dup_cfg.src_ch = src_ch;
+	dup_cfg.dst_ch = dst_ch;
+	chain->stage = channel_dup_init(&dup_cfg);
+	chain->stage_name = "channel copy";
+	chain->stage_cpu_us = channel_dup_get_cpu_us;
+	return audio_chain_add(chain, chain->stage, "ch_dup");
+}
+
+void audio_chain_dma(audio_chain_t *chain, const i2s_stream_cfg_t *cfg)
+{
+	const i2s_config_t *i2s = &cfg->i2s_config;
+	if (cfg->type == AUDIO_STREAM_WRITER) {
+		chain->dma_out_ms = i2s->dma_buf_count * i2s->dma_buf_len * 1000 / i2s->sample_rate;
+	} else {
+		chain->dma_in_ms = i2s->dma_buf_len * 1000 / i2s->sample_rate;
+	}
+}
+
+esp_err_t audio_chain_link(audio_chain_t *chain)
+{
+	return audio_pipeline_link(chain->pipeline, &chain->tag[0], chain->count);
+}
+
+esp_err_t audio_chain_run(audio_chain_t *chain)
+{
+	if (chain->running) return ESP_OK;
+	audio_chain_clear(chain);
+	chain->running = true;
+	chain->start_us = esp_timer_get_time();
+	return audio_pipeline_run(chain->pipeline);
+}
+
+esp_err_t audio_chain_stop(audio_chain_t *chain)
+{
+	if (!chain->running) return ESP_OK;
+	chain->running = false;
+	audio_pipeline_stop(chain->pipeline);
+	audio_pipeline_wait_for_stop(chain->pipeline);
+	audio_pipeline_reset_ringbuffer(chain->pipeline);
+	audio_pipeline_reset_elements(chain->pipeline);
+	return audio_pipeline_change_state(chain->pipeline, AEL_STATE_INIT);
+}
+
+void audio_chain_clear(audio_chain_t *chain)
+{
+	portENTER_CRITICAL(&fill_mux);
+	memset(chain->fill, 0, sizeof(chain->fill));
+	portEXIT_CRITICAL(&fill_mux);
+}
+
+/* Average and peak fill of one stage in ms, false if nothing to tell */
+static bool stage_fill(audio_chain_t *chain, int i, audio_chain_fill_t *f, int *avg_ms, int *max_ms)
+{
+	portENTER_CRITICAL(&fill_mux);
+	*f = chain->fill[i];
+	portEXIT_CRITICAL(&fill_mux);
+	int bytes_per_ms = chain->bytes_per_ms[i];
+	if (f->samples == 0 || bytes_per_ms == 0) return false;
+	*avg_ms = f->sum / f->samples / bytes_per_ms;
+	*max_ms = f->max / bytes_per_ms;
+	return true;
+}
+
+void audio_chain_sink_fill(audio_chain_t *chain, audio_chain_fill_t *fill)
+{
+	memset(fill, 0, sizeof(*fill));
+	if (chain->count < 2) return;
+	portENTER_CRITICAL(&fill_mux);
+	*fill = chain->fill[chain->count - 2];
+	portEXIT_CRITICAL(&fill_mux);
+}
+
+int audio_chain_delay_ms(audio_chain_t *chain)
+{
+	int ms = chain->dma_in_ms + chain->dma_out_ms;
+	for (int i = 0; i < chain->count; i++) {
+		audio_chain_fill_t f;
+		int avg_ms, max_ms;
+		if (stage_fill(chain, i, &f, &avg_ms, &max_ms)) ms += avg_ms;
+	}
+	return ms;
+}
+
+size_t audio_chain_stats_json(audio_chain_t *chain, char *buf, size_t size)
+{
+	int len = snprintf(buf, size, "{\"delay_ms\":%d,\"dma_ms\":%d,\"stages\":{",
+		audio_chain_delay_ms(chain), chain->dma_in_ms + chain->dma_out_ms);
+	const char *sep = "";
+	uint32_t samples = 0;
+	for (int i = 0; i < chain->count && len > 0 && len < size; i++) {
+		audio_chain_fill_t f;
+		int avg_ms, max_ms;
+		if (!stage_fill(chain, i, &f, &avg_ms, &max_ms)) continue;
+		len += snprintf(buf + len, size - len, "%s\"%s\":{\"avg_ms\":%d,\"max_ms\":%d,\"empty\":%u,\"full\":%u}",
+			sep, chain->tag[i], avg_ms, max_ms, f.empty, f.full);
+		if (f.samples > samples) samples = f.samples;
+		sep = ",";
+	}
+	if (len > 0 && len < size) len += snprintf(buf + len, size - len, "},\"samples\":%u}", samples);
+	return len > 0 && len < size ? len : 0;
+}
+
+void audio_chain_report(audio_chain_t *chain)
+{
+	if (!chain->running) return;
+
+	for (int i = 0; i < chain->count; i++) {
+		audio_chain_fill_t f;
+		int avg_ms, max_ms;
+		if (!stage_fill(chain, i, &f, &avg_ms, &max_ms)) continue;
+		ESP_LOGI(TAG, "%s: after %s %d ms, peak %d ms, empty %u and full %u of %u",
+			chain->name, chain->tag[i], avg_ms, max_ms, f.empty, f.full, f.samples);
+	}
+	ESP_LOGI(TAG, "%s: %d ms buffered with %d ms of DMA", chain->name, audio_chain_delay_ms(chain),
+		chain->dma_in_ms + chain->dma_out_ms);
+	if (chain->resample) return;
+
+	int ms = (esp_timer_get_time() - chain->start_us) / 1000;
+	if (chain->stage == NULL) {
+		ESP_LOGI(TAG, "%s: no conversion stage over %d ms", chain->name, ms);
+		return;
+	}
+	/* In place of rsp_filter, which runs the same audio through its generic
+	* filter code */
+	int64_t us = chain->stage_cpu_us(chain->stage);
+	int milli = ms ? us * 100 / ms : 0;   // Thousandths of a percent
+	ESP_LOGI(TAG, "%s: %s took %d us over %d ms (%d.%03d%% CPU)",
+		chain->name, chain->stage_name, (int)us, ms, milli / 1000, milli % 1000);
+}
@@ -0,0 +1,131 @@
+#ifndef AUDIO_CHAIN_H
+#define AUDIO_CHAIN_H
+
+#include <stdbool.h>
+
+#include "audio_element.h"
+#include "audio_pipeline.h"
+#include "i2s_stream.h"
+
+#define AUDIO_CHAIN_MAX     8
+#define AUDIO_CHAIN_SAMPLE_MS   20  // Ring buffer fill is sampled this often while running
+
+/* Fill of the ring buffer after one element while the chain runs. Empty
+* means the next element had nothing to take, an underrun if it feeds the
+* DAC. Full means the element was held back, an overrun if it is the ADC. */
+typedef struct {
+	uint32_t samples;
+	uint32_t empty;
+	uint32_t full;
+	uint64_t sum;                   // Bytes over all the samples
+	int max;                        // Bytes
+} audio_chain_fill_t;
+
+/* Builds a pipeline front to back, see audio_chain_convert(). The pipeline
+* is meant to be built once and run and stopped for every session, nothing
+* is allocated and no driver is installed at call time. */
+typedef struct {
+	audio_pipeline_handle_t pipeline;
+	const char *name;
+	const char *tag[AUDIO_CHAIN_MAX];
+	audio_element_handle_t el[AUDIO_CHAIN_MAX];
+	int bytes_per_ms[AUDIO_CHAIN_MAX];  // Of the output of each element, 0 if unknown
+	audio_chain_fill_t fill[AUDIO_CHAIN_MAX];
+	int count;
+	int format_bytes_per_ms;        // For the elements added next
+	int dma_in_ms, dma_out_ms;      // I2S DMA at either end
+	audio_element_handle_t stage;   // Own conversion element, NULL if none
+	const char *stage_name;
+	int64_t (*stage_cpu_us)(audio_element_handle_t stage);
+	bool resample;                  // A generic resampler was inserted
+	bool running;
+	int64_t start_us;
+} audio_chain_t;
+
+void audio_chain_init(audio_chain_t *chain, audio_pipeline_handle_t pipeline, const char *name);
+
+/**
+ * @brief Set the format the elements added from now on output
+ *
+ * Only used to turn ring buffer fill into time, audio_chain_convert() sets
+ * its destination format by itself.
+ */
+void audio_chain_format(audio_chain_t *chain, int rate, int channels, int bits);
+
+/**
+ * @brief Register an element and append it to the chain
+ */
+esp_err_t audio_chain_add(audio_chain_t *chain, audio_element_handle_t el, const char *tag);
+
+/**
+ * @brief Append only the stages that take 16 bit audio from src to dst
+ *
+ * Nothing when the formats match, a channel duplicator when only the
+ * channels differ, the 6:1 decimator for mono 48 kHz to 8 kHz and a
+ * resampler (with the given complexity) for any other rate change.
+ */
+esp_err_t audio_chain_convert(audio_chain_t *chain, int src_rate, int src_ch,
+	int dst_rate, int dst_ch, int complexity);
+
+/**
+ * @brief Count the I2S DMA of an i2s_stream at either end in the delay
+ *
+ * The driver does not expose its queue. A writer that keeps up has all
+ * the buffers queued, a reader waits for one to fill. Call it again when
+ * the DMA of that end changes.
+ */
+void audio_chain_dma(audio_chain_t *chain, const i2s_stream_cfg_t *cfg);
+
+/**
+ * @brief Link the elements in the order they were added
+ */
+esp_err_t audio_chain_link(audio_chain_t *chain);
+
+/**
+ * @brief Start a session, does nothing if it is already running
+ */
+esp_err_t audio_chain_run(audio_chain_t *chain);
+
+/**
+ * @brief End a session and reset the buffers and elements for the next one
+ *
+ * Does nothing if it is not running. The element tasks, ring buffers and
+ * drivers are kept.
+ */
+esp_err_t audio_chain_stop(audio_chain_t *chain);
+
+/**
+ * @brief Start the fill figures over, audio_chain_run() does it for every session
+ */
+void audio_chain_clear(audio_chain_t *chain);
+
+/**
+ * @brief Fill of the buffer into the last element, the I2S writer of a
+ *        playback chain, where empty means the DMA was about to run dry
+ */
+void audio_chain_sink_fill(audio_chain_t *chain, audio_chain_fill_t *fill);
+
+/**
+ * @brief Average time the audio spends in the ring buffers and the DMA, ms
+ *
+ * Of the current or last session. Stages of unknown format count as 0.
+ */
+int audio_chain_delay_ms(audio_chain_t *chain);
+
+/**
+ * @brief The fill figures as a JSON object, for /metrics
+ *
+ * {"delay_ms":..,"dma_ms":..,"stages":{"<tag>":{"avg_ms":..,"max_ms":..,
+ * "empty":..,"full":..},..}} with the counts out of "samples".
+ *
+ * @return length written without the terminator, 0 if it does not fit
+ */
+size_t audio_chain_stats_json(audio_chain_t *chain, char *buf, size_t size);
+
+/**
+ * @brief Log what the conversion stage cost and the buffer fill during the
+ *        session, before the stop
+ */
+void audio_chain_report(audio_chain_t *chain);
+
+#endif
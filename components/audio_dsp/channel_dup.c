@@ -0,0 +1,103 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "audio_element.h"
+#include "audio_mem.h"
+
+#include "channel_dup.h"
+
+static const char *TAG = "CHANNEL_DUP";
+
+typedef struct {
+	int src_ch;
+	int dst_ch;
+	int64_t cpu_us;
+} channel_dup_t;
+
+static esp_err_t _dup_open(audio_element_handle_t self)
+{
+	channel_dup_t *dup = (channel_dup_t *)audio_element_getdata(self);
+	dup->cpu_us = 0;
+	return ESP_OK;
+}
+
+static esp_err_t _dup_close(audio_element_handle_t self)
+{
+	return ESP_OK;
+}
+
+static audio_element_err_t _dup_process(audio_element_handle_t self, char *buf, int len)
+{
+	channel_dup_t *dup = (channel_dup_t *)audio_element_getdata(self);
+	int16_t *s = (int16_t *)buf;
+
+	/* Mono input only fills half the buffer, it doubles in place */
+	int want = dup->src_ch < dup->dst_ch ? len / 2 : len;
+	int r = audio_element_input(self, buf, want & ~3);
+	if (r <= 0) return r;
+
+	int64_t start = esp_timer_get_time();
+	int out;
+	if (dup->src_ch < dup->dst_ch) {
+		int frames = r / sizeof(int16_t);
+		for (int i = frames - 1; i >= 0; i--) {
+			s[2 * i + 1] = s[i];
+			s[2 * i] = s[i];
+		}
+		out = frames * 2 * sizeof(int16_t);
+	} else if (dup->src_ch > dup->dst_ch) {
+		int frames = r / (2 * sizeof(int16_t));
+		for (int i = 0; i < frames; i++) {
+			s[i] = (s[2 * i] + s[2 * i + 1]) >> 1;
+		}
+		out = frames * sizeof(int16_t);
+	} else {
+		out = r;
+	}
+	dup->cpu_us += esp_timer_get_time() - start;
+
+	return audio_element_output(self, buf, out);
+}
+
+static esp_err_t _dup_destroy(audio_element_handle_t self)
+{
+	channel_dup_t *dup = (channel_dup_t *)audio_element_getdata(self);
+	audio_free(dup);
+	return ESP_OK;
+}
+
+int64_t channel_dup_get_cpu_us(audio_element_handle_t self)
+{
+	channel_dup_t *dup = (channel_dup_t *)audio_element_getdata(self);
+	return dup->cpu_us;
+}
+
+audio_element_handle_t channel_dup_init(channel_dup_cfg_t *config)
+{
+	channel_dup_t *dup = audio_calloc(1, sizeof(channel_dup_t));
+	AUDIO_MEM_CHECK(TAG, dup, return NULL);
+	dup->src_ch = config->src_ch;
+	dup->dst_ch = config->dst_ch;
+
+	audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+	cfg.open = _dup_open;
+	cfg.close = _dup_close;
+	cfg.process = _dup_process;
+	cfg.destroy = _dup_destroy;
+	cfg.task_stack = config->task_stack;
+	cfg.task_core = config->task_core;
+	cfg.task_prio = config->task_prio;
+	cfg.out_rb_size = config->out_rb_size;
+	cfg.tag = "ch_dup";
+
+	audio_element_handle_t el = audio_element_init(&cfg);
+	AUDIO_MEM_CHECK(TAG, el, {
+		audio_free(dup);
+		return NULL;
+	});
+	audio_element_setdata(el, dup);
+	return el;
+}
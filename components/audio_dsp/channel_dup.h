@@ -0,0 +1,42 @@
+#ifndef CHANNEL_DUP_H
+#define CHANNEL_DUP_H
+
+#include <stdint.h>
+
+#include "audio_element.h"
+
+typedef struct {
+	int src_ch;             // 1 or 2, 16 bit samples
+	int dst_ch;             // 1 or 2
+	int out_rb_size;
+	int task_stack;
+	int task_core;
+	int task_prio;
+} channel_dup_cfg_t;
+
+#define CHANNEL_DUP_TASK_STACK  (2 * 1024)
+#define CHANNEL_DUP_RB_SIZE     (2 * 1024)
+
+#define DEFAULT_CHANNEL_DUP_CONFIG() { \
+	.src_ch = 1, \
+	.dst_ch = 2, \
+	.out_rb_size = CHANNEL_DUP_RB_SIZE, \
+	.task_stack = CHANNEL_DUP_TASK_STACK, \
+	.task_core = 0, \
+	.task_prio = 5, \
+}
+
+/**
+ * @brief Mono to stereo by copying each sample, stereo to mono by averaging
+ *
+ * Works in place on the element buffer, a fraction of the cost of a
+ * resampler asked for the same rate.
+ */
+audio_element_handle_t channel_dup_init(channel_dup_cfg_t *config);
+
+/**
+ * @brief Microseconds spent converting since the element was opened
+ */
+int64_t channel_dup_get_cpu_us(audio_element_handle_t self);
+
+#endif
@@ -0,0 +1,80 @@
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#else
+#define IRAM_ATTR
+#endif
+
+#include "decimator.h"
+
+#define DC_SHIFT    10      // Time constant of 1024 input samples
+
+/* First half of the symmetric low pass, Kaiser window (beta 4.53) with the
+* cutoff at 4 kHz for 48 kHz. Each half sums to 16384, unity gain in Q15,
+* and the sum of |h| is 1.83 so the 32 bit accumulator can not overflow. */
+static const int16_t coef[DECIMATOR_TAPS / 2] = {
+	    -3,     -8,    -13,    -16,    -13,     -6,      6,     20,     30,     34,
+	    28,     11,    -12,    -38,    -56,    -62,    -50,    -20,     22,     64,
+	    96,    104,     82,     32,    -35,   -103,   -152,   -164,   -129,    -51,
+	    54,    160,    234,    251,    198,     78,    -83,   -244,   -359,   -386,
+	  -304,   -120,    129,    383,    567,    617,    493,    198,   -218,   -660,
+	 -1009,  -1139,   -954,   -406,    483,   1622,   2862,   4020,   4915,   5404,
+};
+
+void decimator_init(decimator_t *dec)
+{
+	memset(dec, 0, sizeof(*dec));
+	dec->fill = DECIMATOR_TAPS - 1;
+}
+
+static inline int16_t IRAM_ATTR fir(const int16_t *x)
+{
+	const int16_t *a = x, *b = x + DECIMATOR_TAPS - 1;
+	int32_t acc = 1 << 14;
+	for (int k = 0; k < DECIMATOR_TAPS / 2; k += 4) {
+		acc += coef[k] * (a[0] + b[0]);
+		acc += coef[k + 1] * (a[1] + b[-1]);
+		acc += coef[k + 2] * (a[2] + b[-2]);
+		acc += coef[k + 3] * (a[3] + b[-3]);
+		a += 4;
+		b -= 4;
+	}
+	acc >>= 15;
+	if (acc > INT16_MAX) return INT16_MAX;
+	if (acc < INT16_MIN) return INT16_MIN;
+	return acc;
+}
+
+int IRAM_ATTR decimator_process(decimator_t *dec, const int16_t *in, int count, int16_t *out)
+{
+	int written = 0;
+
+	while (count > 0) {
+		int n = DECIMATOR_TAPS - 1 + DECIMATOR_BLOCK - dec->fill;
+		if (n > count) n = count;
+
+		int16_t *x = dec->x + dec->fill;
+		int32_t dc = dec->dc;
+		for (int i = 0; i < n; i++) {
+			int32_t s = in[i];
+			dc += ((s << 12) - dc) >> DC_SHIFT;
+			s -= dc >> 12;
+			x[i] = s > INT16_MAX ? INT16_MAX : s < INT16_MIN ? INT16_MIN : s;
+		}
+		dec->dc = dc;
+		dec->fill += n;
+		in += n;
+		count -= n;
+
+		/* Every window that ends on a kept sample */
+		int pos = 0;
+		while (pos + DECIMATOR_TAPS <= dec->fill) {
+			out[written++] = fir(dec->x + pos);
+			pos += DECIMATOR_FACTOR;
+		}
+		dec->fill -= pos;
+		memmove(dec->x, dec->x + pos, dec->fill * sizeof(int16_t));
+	}
+	return written;
+}
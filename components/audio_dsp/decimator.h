@@ -0,0 +1,38 @@
+#ifndef DECIMATOR_H
+#define DECIMATOR_H
+
+#include <stdint.h>
+
+#define DECIMATOR_FACTOR    6       // 48 kHz to 8 kHz
+#define DECIMATOR_TAPS      120
+#define DECIMATOR_BLOCK     240     // Input samples filtered per pass
+
+typedef struct {
+	int16_t x[DECIMATOR_TAPS - 1 + DECIMATOR_BLOCK];
+	int fill;               // Samples in x, the first TAPS - 1 are history
+	int32_t dc;             // Input mean, 12 fractional bits
+} decimator_t;
+
+/**
+ * @brief Clear the history and the DC estimate
+ */
+void decimator_init(decimator_t *dec);
+
+/**
+ * @brief Remove DC, low pass and keep one sample in DECIMATOR_FACTOR
+ *
+ * 120 tap linear phase FIR: flat to 3.4 kHz within 0.03 dB, at least
+ * 49 dB down from 4.6 kHz, Q15 coefficients. Only the kept outputs are
+ * computed and the symmetric taps are folded, 60 multiplies per output.
+ * The DC blocker is a first order tracker with a ~8 Hz corner, ahead of
+ * the FIR so the accumulator keeps its headroom.
+ *
+ * Input that does not complete an output is kept for the next call. Does
+ * not depend on ESP-IDF, it builds on the host as well.
+ *
+ * @param out may be the same buffer as in
+ * @return samples written to out
+ */
+int decimator_process(decimator_t *dec, const int16_t *in, int count, int16_t *out);
+
+#endif
@@ -0,0 +1,86 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "audio_element.h"
+#include "audio_mem.h"
+
+#include "decimator.h"
+#include "decimator_stream.h"
+
+static const char *TAG = "DECIMATOR";
+
+typedef struct {
+	decimator_t dec;
+	int64_t cpu_us;
+} decimator_stream_t;
+
+static esp_err_t _decim_open(audio_element_handle_t self)
+{
+	decimator_stream_t *ds = (decimator_stream_t *)audio_element_getdata(self);
+	decimator_init(&ds->dec);
+	ds->cpu_us = 0;
+	return ESP_OK;
+}
+
+static esp_err_t _decim_close(audio_element_handle_t self)
+{
+	return ESP_OK;
+}
+
+static audio_element_err_t _decim_process(audio_element_handle_t self, char *buf, int len)
+{
+	decimator_stream_t *ds = (decimator_stream_t *)audio_element_getdata(self);
+
+	int r = audio_element_input(self, buf, len & ~1);
+	if (r <= 0) return r;
+
+	int64_t start = esp_timer_get_time();
+	int n = decimator_process(&ds->dec, (int16_t *)buf, r / sizeof(int16_t), (int16_t *)buf);
+	ds->cpu_us += esp_timer_get_time() - start;
+
+	/* Too little input for an output yet, it stays in the history */
+	if (n == 0) return r;
+	int w = audio_element_output(self, buf, n * sizeof(int16_t));
+	return w > 0 ? r : w;
+}
+
+static esp_err_t _decim_destroy(audio_element_handle_t self)
+{
+	decimator_stream_t *ds = (decimator_stream_t *)audio_element_getdata(self);
+	audio_free(ds);
+	return ESP_OK;
+}
+
+int64_t decimator_stream_get_cpu_us(audio_element_handle_t self)
+{
+	decimator_stream_t *ds = (decimator_stream_t *)audio_element_getdata(self);
+	return ds->cpu_us;
+}
+
+audio_element_handle_t decimator_stream_init(decimator_stream_cfg_t *config)
+{
+	decimator_stream_t *ds = audio_calloc(1, sizeof(decimator_stream_t));
+	AUDIO_MEM_CHECK(TAG, ds, return NULL);
+
+	audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+	cfg.open = _decim_open;
+	cfg.close = _decim_close;
+	cfg.process = _decim_process;
+	cfg.destroy = _decim_destroy;
+	cfg.task_stack = config->task_stack;
+	cfg.task_core = config->task_core;
+	cfg.task_prio = config->task_prio;
+	cfg.out_rb_size = config->out_rb_size;
+	cfg.tag = "decimator";
+
+	audio_element_handle_t el = audio_element_init(&cfg);
+	AUDIO_MEM_CHECK(TAG, el, {
+		audio_free(ds);
+		return NULL;
+	});
+	audio_element_setdata(el, ds);
+	return el;
+}
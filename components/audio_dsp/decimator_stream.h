@@ -0,0 +1,35 @@
+#ifndef DECIMATOR_STREAM_H
+#define DECIMATOR_STREAM_H
+
+#include <stdint.h>
+
+#include "audio_element.h"
+
+typedef struct {
+	int out_rb_size;
+	int task_stack;
+	int task_core;
+	int task_prio;
+} decimator_stream_cfg_t;
+
+#define DECIMATOR_STREAM_TASK_STACK (3 * 1024)
+#define DECIMATOR_STREAM_RB_SIZE    (2 * 1024)
+
+#define DEFAULT_DECIMATOR_STREAM_CONFIG() { \
+	.out_rb_size = DECIMATOR_STREAM_RB_SIZE, \
+	.task_stack = DECIMATOR_STREAM_TASK_STACK, \
+	.task_core = 0, \
+	.task_prio = 5, \
+}
+
+/**
+ * @brief 48 kHz to 8 kHz mono, 16 bit, with DC removal, see decimator.h
+ */
+audio_element_handle_t decimator_stream_init(decimator_stream_cfg_t *config);
+
+/**
+ * @brief Microseconds spent filtering since the element was opened
+ */
+int64_t decimator_stream_get_cpu_us(audio_element_handle_t self);
+
+#endif
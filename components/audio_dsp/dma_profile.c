@@ -0,0 +1,82 @@
+#include <stdio.h>
+
+#include "driver/i2s.h"
+#include "esp_log.h"
+
+#include "dma_profile.h"
+
+static const char *TAG = "DMA_PROFILE";
+
+#define DMA_BUF_LEN_MAX     1024    // Frames, driver limit
+#define DMA_BUF_COUNT_MAX   128
+
+void dma_profile_apply(const dma_profile_t *profile, int extra, i2s_stream_cfg_t *cfg)
+{
+	i2s_config_t *i2s = &cfg->i2s_config;
+	int len = profile->buf_ms * i2s->sample_rate / 1000;
+	int count = profile->buf_count + extra;
+	i2s->dma_buf_len = len < 8 ? 8 : len > DMA_BUF_LEN_MAX ? DMA_BUF_LEN_MAX : len;
+	i2s->dma_buf_count = count < 2 ? 2 : count > DMA_BUF_COUNT_MAX ? DMA_BUF_COUNT_MAX : count;
+}
+
+void dma_profile_init(dma_profile_ctl_t *ctl, const dma_profile_t *profile, i2s_stream_cfg_t *cfg)
+{
+	dma_profile_apply(profile, 0, cfg);
+	*ctl = (dma_profile_ctl_t) {
+		.cfg = *cfg,
+		.profile = profile,
+	};
+}
+
+bool dma_profile_update(dma_profile_ctl_t *ctl, uint32_t empty, uint32_t samples)
+{
+	if (samples < DMA_PROFILE_MIN_SAMPLES) return false;
+
+	int extra = ctl->extra;
+	if (empty * 100 > samples * DMA_PROFILE_UNDERRUN_PCT) {
+		ctl->stable = 0;
+		if (extra < DMA_PROFILE_MAX_EXTRA) extra++;
+	} else if (empty > 0) {
+		ctl->stable = 0;
+	} else if (++ctl->stable >= DMA_PROFILE_STABLE_SESSIONS) {
+		ctl->stable = 0;
+		if (extra > 0) extra--;
+	}
+	if (extra == ctl->extra) return false;
+
+	if (extra > ctl->extra) ctl->ups++;
+	else ctl->downs++;
+	ESP_LOGW(TAG, "I2S %d %s: %d buffers to %d, %u of %u samples empty", ctl->cfg.i2s_port,
+		ctl->profile->name, ctl->cfg.i2s_config.dma_buf_count, ctl->profile->buf_count + extra, empty, samples);
+	ctl->extra = extra;
+	dma_profile_apply(ctl->profile, extra, &ctl->cfg);
+	ctl->pending = true;
+	return true;
+}
+
+esp_err_t dma_profile_install(dma_profile_ctl_t *ctl)
+{
+	i2s_port_t port = ctl->cfg.i2s_port;
+	i2s_driver_uninstall(port);
+	esp_err_t err = i2s_driver_install(port, &ctl->cfg.i2s_config, 0, NULL);
+	if (err != ESP_OK && ctl->extra > 0) {
+		ESP_LOGE(TAG, "I2S %d: no room for %d buffers, back to %s", port,
+			ctl->cfg.i2s_config.dma_buf_count, ctl->profile->name);
+		ctl->extra = 0;
+		dma_profile_apply(ctl->profile, 0, &ctl->cfg);
+		err = i2s_driver_install(port, &ctl->cfg.i2s_config, 0, NULL);
+	}
+	if (err != ESP_OK) ESP_LOGE(TAG, "I2S %d: install failed (%s)", port, esp_err_to_name(err));
+	ctl->pending = false;
+	return err;
+}
+
+size_t dma_profile_json(dma_profile_ctl_t *ctl, char *buf, size_t size)
+{
+	const i2s_config_t *i2s = &ctl->cfg.i2s_config;
+	int len = snprintf(buf, size, "{\"profile\":\"%s\",\"buffers\":%d,\"buf_len\":%d,\"depth_ms\":%d,"
+		"\"extra\":%d,\"ups\":%u,\"downs\":%u}",
+		ctl->profile->name, i2s->dma_buf_count, i2s->dma_buf_len,
+		i2s->dma_buf_count * i2s->dma_buf_len * 1000 / i2s->sample_rate, ctl->extra, ctl->ups, ctl->downs);
+	return len > 0 && len < size ? len : 0;
+}
@@ -0,0 +1,71 @@
+#ifndef DMA_PROFILE_H
+#define DMA_PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "i2s_stream.h"
+
+/* A named I2S DMA depth, the buffers in ms so one profile fits any rate.
+* The boards offer theirs in board_def.h. Deeper rides out longer stalls
+* of the task that feeds the DMA, at the cost of delay. */
+typedef struct {
+	const char *name;
+	int buf_count;
+	int buf_ms;
+} dma_profile_t;
+
+#define DMA_PROFILE_MAX_EXTRA       4   // Buffers the controller may add
+#define DMA_PROFILE_UNDERRUN_PCT    2   // Of the fill samples found empty, steps up
+#define DMA_PROFILE_STABLE_SESSIONS 5   // Clean sessions in a row, steps down
+#define DMA_PROFILE_MIN_SAMPLES     50  // Shorter sessions are not judged
+
+/* Steps the buffer count of one I2S port up after sessions with underruns
+* and back down after a run of clean ones. Changes only take effect when
+* the driver is installed again, between sessions. */
+typedef struct {
+	i2s_stream_cfg_t cfg;           // Of the stream, with the depth in use
+	const dma_profile_t *profile;
+	int extra;                      // Buffers above the profile
+	int stable;
+	bool pending;                   // Changed and not installed yet
+	uint32_t ups, downs;
+} dma_profile_ctl_t;
+
+/**
+ * @brief Set the DMA buffers of cfg from a profile plus extra buffers, at
+ *        the sample rate already in cfg
+ */
+void dma_profile_apply(const dma_profile_t *profile, int extra, i2s_stream_cfg_t *cfg);
+
+/**
+ * @brief Apply the profile to cfg and keep a copy to install again later
+ */
+void dma_profile_init(dma_profile_ctl_t *ctl, const dma_profile_t *profile, i2s_stream_cfg_t *cfg);
+
+/**
+ * @brief Judge a finished session by the fill samples that found the
+ *        buffer into the I2S writer empty, see audio_chain_sink_fill()
+ *
+ * @return true if the depth changed, install it with dma_profile_install()
+ */
+bool dma_profile_update(dma_profile_ctl_t *ctl, uint32_t empty, uint32_t samples);
+
+/**
+ * @brief Install the driver again with the depth in use
+ *
+ * The stream must be stopped. Falls back to the plain profile if the new
+ * buffers cannot be allocated. The caller sets the pins again, as
+ * i2s_stream_init() did.
+ */
+esp_err_t dma_profile_install(dma_profile_ctl_t *ctl);
+
+/**
+ * @brief The depth in use as a JSON object, for /metrics
+ *
+ * @return length written, 0 if it does not fit
+ */
+size_t dma_profile_json(dma_profile_ctl_t *ctl, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,192 @@
+#include <math.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#else
+#define IRAM_ATTR
+#endif
+
+#include "echo_canceller.h"
+
+#define P_SHIFT     7               // Power smoothing, 128 samples
+#define PXM_SHIFT   8               // Decay of the reference peak
+#define ERL_SHIFT   10              // Return loss average, 128 ms
+#define DT_MARGIN   4               // Microphone 6 dB over the expected echo
+#define FAR_FLOOR   (100 * 100)     // Reference power below which the far end is silent
+#define MU          8192            // NLMS step, Q15
+#define ERL_MAX     (64 << 8)       // +18 dB, also the start, the detector is off until learned
+#define ERL_MIN     (1 << 4)        // -12 dB
+#define NLP_MIN     4125            // -18 dB, Q15
+#define NLP_ATTACK  6               // Towards NLP_MIN, ~8 ms
+#define NLP_RELEASE 3               // Back to unity, ~1 ms, the near end onset is kept
+
+void echo_canceller_init(echo_canceller_t *ec, int taps, int delay)
+{
+	memset(ec, 0, sizeof(*ec));
+	if (taps > EC_MAX_TAPS) taps = EC_MAX_TAPS;
+	ec->taps = taps & ~3;
+	echo_canceller_set_delay(ec, delay);
+	echo_canceller_start(ec);
+}
+
+void echo_canceller_set_delay(echo_canceller_t *ec, int delay)
+{
+	ec->delay = delay - ec->taps / 4;
+	if (ec->delay < 0) ec->delay = 0;
+	ec->anchored = false;
+}
+
+void echo_canceller_reference(echo_canceller_t *ec, const int16_t *x, int count)
+{
+	uint32_t w = ec->ref_w;
+	for (int i = 0; i < count; i++) {
+		ec->ref[w++ & (EC_HISTORY - 1)] = x[i];
+	}
+	ec->ref_w = w;
+}
+
+void echo_canceller_start(echo_canceller_t *ec)
+{
+	ec->anchored = false;
+	ec->resyncs = 0;
+	ec->pos = 0;
+	memset(ec->x, 0, sizeof(ec->x));
+	memset(ec->w, 0, sizeof(ec->w));
+	ec->energy = 0;
+	ec->px = ec->pd = ec->pe = 0;
+	ec->pxm = 0;
+	ec->erl = ERL_MAX;
+	ec->dt_hold = 0;
+	ec->nlp = 1 << 15;
+	ec->samples = ec->far_samples = ec->dt_samples = 0;
+	ec->far_pd = ec->far_pe = 0;
+}
+
+/* Keep the reference delay samples behind the newest speaker sample. The
+* two streams run off the same clock, so after this the reference advances
+* one sample per microphone sample and only drifts or a stall move it. */
+static void align(echo_canceller_t *ec, int count)
+{
+	uint32_t w = ec->ref_w;
+	uint32_t lag = w - ec->ref_r;
+	if (ec->anchored && lag >= (uint32_t)count && lag <= (uint32_t)(EC_HISTORY - count)) return;
+
+	if (ec->anchored) ec->resyncs++;
+	ec->ref_r = w - ec->delay - count;
+	ec->anchored = true;
+}
+
+static inline int32_t power(int32_t p, int32_t s)
+{
+	return p + ((s * s - p) >> P_SHIFT);
+}
+
+static int32_t IRAM_ATTR estimate(const echo_canceller_t *ec)
+{
+	const int32_t *w = ec->w;
+	const int16_t *x = ec->x + ec->pos;
+	int64_t acc = 1 << 27;
+	for (int k = 0; k < ec->taps; k += 4) {
+		acc += (int64_t)w[k] * x[k];
+		acc += (int64_t)w[k + 1] * x[k + 1];
+		acc += (int64_t)w[k + 2] * x[k + 2];
+		acc += (int64_t)w[k + 3] * x[k + 3];
+	}
+	return acc >> 28;
+}
+
+static void IRAM_ATTR adapt(echo_canceller_t *ec, int32_t e)
+{
+	/* w += mu e x / |x|^2 with w in Q28, g stays within 16 bits so g x fits */
+	int64_t g = ((int64_t)MU * e << 13) / (ec->energy + ec->taps * 32 * 32);
+	if (g > 65535) g = 65535;
+	if (g < -65535) g = -65535;
+
+	int32_t *w = ec->w;
+	const int16_t *x = ec->x + ec->pos;
+	int32_t gi = g;
+	for (int k = 0; k < ec->taps; k += 4) {
+		w[k] += gi * x[k];
+		w[k + 1] += gi * x[k + 1];
+		w[k + 2] += gi * x[k + 2];
+		w[k + 3] += gi * x[k + 3];
+	}
+}
+
+void IRAM_ATTR echo_canceller_process(echo_canceller_t *ec, int16_t *mic, int count)
+{
+	if (ec->taps == 0) return;
+	align(ec, count);
+
+	for (int i = 0; i < count; i++) {
+		int32_t xn = ec->ref[ec->ref_r++ & (EC_HISTORY - 1)];
+
+		/* Slide the window, the oldest sample is mirrored at pos + taps */
+		ec->pos = ec->pos ? ec->pos - 1 : ec->taps - 1;
+		int32_t old = ec->x[ec->pos + ec->taps];
+		ec->energy += xn * xn - old * old;
+		ec->x[ec->pos] = ec->x[ec->pos + ec->taps] = xn;
+
+		int32_t d = mic[i];
+		int32_t e = d - estimate(ec);
+		if (e > INT16_MAX) e = INT16_MAX;
+		if (e < INT16_MIN) e = INT16_MIN;
+
+		ec->px = power(ec->px, xn);
+		ec->pd = power(ec->pd, d);
+		ec->pe = power(ec->pe, e);
+
+		/* The echo of a reference peak lasts the whole path, hold it as long */
+		ec->pxm -= ec->pxm >> PXM_SHIFT;
+		if (ec->px > ec->pxm) ec->pxm = ec->px;
+
+		bool far = ec->pxm > FAR_FLOOR;
+		if (far && ((int64_t)ec->pd << 8) > DT_MARGIN * (int64_t)ec->pxm * ec->erl) {
+			ec->dt_hold = EC_DT_HOLD;
+		} else if (ec->dt_hold > 0) {
+			ec->dt_hold--;
+		}
+		bool dt = ec->dt_hold > 0;
+
+		if (far && !dt) {
+			adapt(ec, e);
+
+			/* Learned on steady far end speech only, in its tail the
+			* echo outlasts the reference peak. Averaged slowly, a near
+			* end that slipped past the detector barely moves it. */
+			if (ec->px > ec->pxm / 2) {
+				int32_t erl = ((int64_t)ec->pd << 8) / ec->pxm;
+				ec->erl += (erl - ec->erl) >> ERL_SHIFT;
+				if (ec->erl > ERL_MAX) ec->erl = ERL_MAX;
+				if (ec->erl < ERL_MIN) ec->erl = ERL_MIN;
+			}
+
+			ec->far_pd += ec->pd;
+			ec->far_pe += ec->pe;
+		}
+
+		int32_t target = far && !dt ? NLP_MIN : 1 << 15;
+		ec->nlp += (target - ec->nlp) >> (target < ec->nlp ? NLP_ATTACK : NLP_RELEASE);
+		mic[i] = (e * ec->nlp) >> 15;
+
+		ec->samples++;
+		if (far) ec->far_samples++;
+		if (far && dt) ec->dt_samples++;
+	}
+}
+
+int echo_canceller_suppression_db(const echo_canceller_t *ec)
+{
+	return lrintf(20.0f * log10f(ec->nlp / 32768.0f));
+}
+
+void echo_canceller_stats(const echo_canceller_t *ec, echo_canceller_stats_t *stats)
+{
+	stats->erle_db = -1;
+	if (ec->far_pe > 0 && ec->far_pd > 0) {
+		stats->erle_db = lrintf(10.0f * log10f((float)ec->far_pd / ec->far_pe));
+	}
+	stats->double_talk_pct = ec->far_samples ? (int)(100ULL * ec->dt_samples / ec->far_samples) : 0;
+	stats->resyncs = ec->resyncs;
+}
@@ -0,0 +1,96 @@
+#ifndef ECHO_CANCELLER_H
+#define ECHO_CANCELLER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define EC_MAX_TAPS     512         // 64 ms at 8 kHz
+#define EC_HISTORY      4096        // Reference kept, 512 ms at 8 kHz, power of two
+#define EC_DT_HOLD      240         // Samples double talk is held after it is last seen
+
+typedef struct {
+	/* Speaker samples, written by the speaker task and read here */
+	int16_t ref[EC_HISTORY];
+	volatile uint32_t ref_w;
+	uint32_t ref_r;             // Next reference sample for the microphone
+	bool anchored;
+	int delay;                  // Speaker to microphone, samples
+	int resyncs;
+
+	int taps;
+	int pos;                    // Newest sample of the window in x
+	int16_t x[2 * EC_MAX_TAPS]; // Window, written twice so it is always contiguous
+	int64_t energy;             // Of the window
+	int32_t w[EC_MAX_TAPS];     // Echo path, Q28
+
+	/* Short term powers, 7 bit one pole (16 ms) */
+	int32_t px, pd, pe;
+	int32_t pxm;                // Reference power peak over the echo path
+	int32_t erl;                // Echo to reference power, Q8
+	int dt_hold;
+	int32_t nlp;                // Residual suppressor gain, Q15
+
+	/* Session statistics */
+	uint32_t samples, far_samples, dt_samples;
+	int64_t far_pd, far_pe;
+} echo_canceller_t;
+
+typedef struct {
+	int erle_db;                // Echo removed while only the far end talked, -1 if it did not
+	int double_talk_pct;        // Of the time the far end talked
+	int resyncs;                // Reference realignments
+} echo_canceller_stats_t;
+
+/**
+ * @brief Clear everything, reference included
+ *
+ * @param taps length of the echo path covered, at most EC_MAX_TAPS
+ * @param delay samples from the speaker reference to the microphone,
+ *        through the output and input buffers. The window starts a
+ *        quarter of the taps earlier to absorb the jitter.
+ */
+void echo_canceller_init(echo_canceller_t *ec, int taps, int delay);
+
+/**
+ * @brief Change the delay given to echo_canceller_init(), for example when
+ *        the speaker buffers change
+ *
+ * Between sessions, the reference is realigned on the next process call.
+ */
+void echo_canceller_set_delay(echo_canceller_t *ec, int delay);
+
+/**
+ * @brief Append what was sent to the speaker, mono at the microphone rate
+ *
+ * Called from the speaker task, single writer. Fed all the time, the
+ * canceller takes from it only while it processes.
+ */
+void echo_canceller_reference(echo_canceller_t *ec, const int16_t *x, int count);
+
+/**
+ * @brief Start a session, the echo path is learned again and the reference
+ *        is realigned on the next process call
+ */
+void echo_canceller_start(echo_canceller_t *ec);
+
+/**
+ * @brief Remove the speaker echo from microphone samples, in place
+ *
+ * Fixed point NLMS over the taps, adapting only while the far end talks
+ * and the near end does not. Double talk is flagged when the microphone
+ * is 6 dB above the echo expected from the learned return loss, so the
+ * near end is never suppressed. The residual suppressor attenuates by
+ * up to 18 dB only while the far end talks alone.
+ *
+ * Does not depend on ESP-IDF, it builds on the host as well.
+ */
+void echo_canceller_process(echo_canceller_t *ec, int16_t *mic, int count);
+
+/**
+ * @brief Current attenuation of the residual suppressor, 0 or negative
+ */
+int echo_canceller_suppression_db(const echo_canceller_t *ec);
+
+void echo_canceller_stats(const echo_canceller_t *ec, echo_canceller_stats_t *stats);
+
+#endif
@@ -0,0 +1,215 @@
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#else
+#define IRAM_ATTR
+#define DRAM_ATTR
+#endif
+
+#include "g711.h"
+
+#define ULAW_CLIP   8158    // Largest magnitude below the top code, 8159 codes the same
+
+/* Decoded value of every code */
+static const int16_t DRAM_ATTR alaw_table[256] = {
+	  -5504,  -5248,  -6016,  -5760,  -4480,  -4224,  -4992,  -4736,
+	  -7552,  -7296,  -8064,  -7808,  -6528,  -6272,  -7040,  -6784,
+	  -2752,  -2624,  -3008,  -2880,  -2240,  -2112,  -2496,  -2368,
+	  -3776,  -3648,  -4032,  -3904,  -3264,  -3136,  -3520,  -3392,
+	 -22016, -20992, -24064, -23040, -17920, -16896, -19968, -18944,
+	 -30208, -29184, -32256, -31232, -26112, -25088, -28160, -27136,
+	 -11008, -10496, -12032, -11520,  -8960,  -8448,  -9984,  -9472,
+	 -15104, -14592, -16128, -15616, -13056, -12544, -14080, -13568,
+	   -344,   -328,   -376,   -360,   -280,   -264,   -312,   -296,
+	   -472,   -456,   -504,   -488,   -408,   -392,   -440,   -424,
+	    -88,    -72,   -120,   -104,    -24,     -8,    -56,    -40,
+	   -216,   -200,   -248,   -232,   -152,   -136,   -184,   -168,
+	  -1376,  -1312,  -1504,  -1440,  -1120,  -1056,  -1248,  -1184,
+	  -1888,  -1824,  -2016,  -1952,  -1632,  -1568,  -1760,  -1696,
+	   -688,   -656,   -752,   -720,   -560,   -528,   -624,   -592,
+	   -944,   -912,  -1008,   -976,   -816,   -784,   -880,   -848,
+	   5504,   5248,   6016,   5760,   4480,   4224,   4992,   4736,
+	   7552,   7296,   8064,   7808,   6528,   6272,   7040,   6784,
+	   2752,   2624,   3008,   2880,   2240,   2112,   2496,   2368,
+	   3776,   3648,   4032,   3904,   3264,   3136,   3520,   3392,
+	  22016,  20992,  24064,  23040,  17920,  16896,  19968,  18944,
+	  30208,  29184,  32256,  31232,  26112,  25088,  28160,  27136,
+	  11008,  10496,  12032,  11520,   8960,   8448,   9984,   9472,
+	  15104,  14592,  16128,  15616,  13056,  12544,  14080,  13568,
+	    344,    328,    376,    360,    280,    264,    312,    296,
+	    472,    456,    504,    488,    408,    392,    440,    424,
+	     88,     72,    120,    104,     24,      8,     56,     40,
+	    216,    200,    248,    232,    152,    136,    184,    168,
+	   1376,   1312,   1504,   1440,   1120,   1056,   1248,   1184,
+	   1888,   1824,   2016,   1952,   1632,   1568,   1760,   1696,
+	    688,    656,    752,    720,    560,    528,    624,    592,
+	    944,    912,   1008,    976,    816,    784,    880,    848,
+};
+
+static const int16_t DRAM_ATTR ulaw_table[256] = {
+	 -32124, -31100, -30076, -29052, -28028, -27004, -25980, -24956,
+	 -23932, -22908, -21884, -20860, -19836, -18812, -17788, -16764,
+	 -15996, -15484, -14972, -14460, -13948, -13436, -12924, -12412,
+	 -11900, -11388, -10876, -10364,  -9852,  -9340,  -8828,  -8316,
+	  -7932,  -7676,  -7420,  -7164,  -6908,  -6652,  -6396,  -6140,
+	  -5884,  -5628,  -5372,  -5116,  -4860,  -4604,  -4348,  -4092,
+	  -3900,  -3772,  -3644,  -3516,  -3388,  -3260,  -3132,  -3004,
+	  -2876,  -2748,  -2620,  -2492,  -2364,  -2236,  -2108,  -1980,
+	  -1884,  -1820,  -1756,  -1692,  -1628,  -1564,  -1500,  -1436,
+	  -1372,  -1308,  -1244,  -1180,  -1116,  -1052,   -988,   -924,
+	   -876,   -844,   -812,   -780,   -748,   -716,   -684,   -652,
+	   -620,   -588,   -556,   -524,   -492,   -460,   -428,   -396,
+	   -372,   -356,   -340,   -324,   -308,   -292,   -276,   -260,
+	   -244,   -228,   -212,   -196,   -180,   -164,   -148,   -132,
+	   -120,   -112,   -104,    -96,    -88,    -80,    -72,    -64,
+	    -56,    -48,    -40,    -32,    -24,    -16,     -8,      0,
+	  32124,  31100,  30076,  29052,  28028,  27004,  25980,  24956,
+	  23932,  22908,  21884,  20860,  19836,  18812,  17788,  16764,
+	  15996,  15484,  14972,  14460,  13948,  13436,  12924,  12412,
+	  11900,  11388,  10876,  10364,   9852,   9340,   8828,   8316,
+	   7932,   7676,   7420,   7164,   6908,   6652,   6396,   6140,
+	   5884,   5628,   5372,   5116,   4860,   4604,   4348,   4092,
+	   3900,   3772,   3644,   3516,   3388,   3260,   3132,   3004,
+	   2876,   2748,   2620,   2492,   2364,   2236,   2108,   1980,
+	   1884,   1820,   1756,   1692,   1628,   1564,   1500,   1436,
+	   1372,   1308,   1244,   1180,   1116,   1052,    988,    924,
+	    876,    844,    812,    780,    748,    716,    684,    652,
+	    620,    588,    556,    524,    492,    460,    428,    396,
+	    372,    356,    340,    324,    308,    292,    276,    260,
+	    244,    228,    212,    196,    180,    164,    148,    132,
+	    120,    112,    104,     96,     88,     80,     72,     64,
+	     56,     48,     40,     32,     24,     16,      8,      0,
+};
+
+/* Segment of a magnitude from its top 7 bits, A-law takes bits 5 to 11 of
+* the 12 bit magnitude and µ-law bits 6 to 12 of the biased 13 bit one */
+static const uint8_t DRAM_ATTR seg_table[128] = {
+	 0, 1, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4,
+	 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+	 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+	 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+	 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+};
+
+int g711_law_from_name(const char *name, g711_law_t *law)
+{
+	if (strcmp(name, "PCMA") == 0) {
+		*law = G711_ALAW;
+		return 0;
+	}
+	if (strcmp(name, "PCMU") == 0) {
+		*law = G711_ULAW;
+		return 0;
+	}
+	return -1;
+}
+
+const char *g711_law_name(g711_law_t law)
+{
+	return law == G711_ALAW ? "PCMA" : "PCMU";
+}
+
+/* Segment of a magnitude, the position of its top bit above bit 'base' */
+static int segment(int mag, int base, int max)
+{
+	int seg = 0;
+	mag >>= base;
+	while (mag > 0 && seg < max) {
+		mag >>= 1;
+		seg++;
+	}
+	return seg;
+}
+
+uint8_t g711_alaw_encode(int16_t pcm)
+{
+	int mag = pcm >> 3;     // 13 bit
+	uint8_t mask = 0xD5;
+	if (mag < 0) {
+		mag = ~mag;
+		mask = 0x55;
+	}
+
+	int seg = segment(mag, 5, 7);
+	if (mag >= (0x20 << 7)) return 0x7F ^ mask;
+	int q = seg < 2 ? (mag >> 1) & 0x0F : (mag >> seg) & 0x0F;
+	return ((seg << 4) | q) ^ mask;
+}
+
+uint8_t g711_ulaw_encode(int16_t pcm)
+{
+	int mag = pcm >> 2;     // 14 bit
+	uint8_t mask = 0xFF;
+	if (mag < 0) {
+		mag = -mag;
+		mask = 0x7F;
+	}
+	if (mag > 8159) mag = 8159;
+	mag += 33;
+
+	int seg = segment(mag, 6, 7);
+	if (mag >= (0x40 << 7)) return 0x7F ^ mask;
+	return ((seg << 4) | ((mag >> (seg + 1)) & 0x0F)) ^ mask;
+}
+
+int16_t g711_alaw_decode(uint8_t code)
+{
+	code ^= 0x55;
+	int seg = (code & 0x70) >> 4;
+	int t = ((code & 0x0F) << 4) + 8;
+	if (seg > 0) t = (t + 0x100) << (seg - 1);
+	return (code & 0x80) ? t : -t;
+}
+
+int16_t g711_ulaw_decode(uint8_t code)
+{
+	code = ~code;
+	int t = (((code & 0x0F) << 3) + 0x84) << ((code & 0x70) >> 4);
+	return (code & 0x80) ? 0x84 - t : t - 0x84;
+}
+
+/* Branch free apart from the clip, which compiles to a min. The sign
+* flips the magnitude and picks the mask. */
+static inline uint8_t alaw_encode_fast(int16_t pcm)
+{
+	int sign = pcm >> 15;
+	int mag = (pcm >> 3) ^ sign;
+	int seg = seg_table[mag >> 5];
+	int shift = seg | (seg == 0);
+	return ((seg << 4) | ((mag >> shift) & 0x0F)) ^ (0xD5 ^ (sign & 0x80));
+}
+
+static inline uint8_t ulaw_encode_fast(int16_t pcm)
+{
+	int sign = pcm >> 15;
+	int mag = ((pcm >> 2) ^ sign) - sign;
+	mag = (mag < ULAW_CLIP ? mag : ULAW_CLIP) + 33;
+	int seg = seg_table[mag >> 6];
+	return ((seg << 4) | ((mag >> (seg + 1)) & 0x0F)) ^ (0xFF ^ (sign & 0x80));
+}
+
+void IRAM_ATTR g711_encode(g711_law_t law, const int16_t *pcm, uint8_t *code, int count)
+{
+	if (law == G711_ALAW) {
+		for (int i = 0; i < count; i++) code[i] = alaw_encode_fast(pcm[i]);
+	} else {
+		for (int i = 0; i < count; i++) code[i] = ulaw_encode_fast(pcm[i]);
+	}
+}
+
+void IRAM_ATTR g711_decode(g711_law_t law, const uint8_t *code, int16_t *pcm, int count)
+{
+	const int16_t *table = law == G711_ALAW ? alaw_table : ulaw_table;
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		pcm[i] = table[code[i]];
+		pcm[i + 1] = table[code[i + 1]];
+		pcm[i + 2] = table[code[i + 2]];
+		pcm[i + 3] = table[code[i + 3]];
+	}
+	for (; i < count; i++) pcm[i] = table[code[i]];
+}
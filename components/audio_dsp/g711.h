@@ -0,0 +1,44 @@
+#ifndef G711_H
+#define G711_H
+
+#include <stdint.h>
+
+typedef enum {
+	G711_ALAW,              // PCMA
+	G711_ULAW,              // PCMU
+} g711_law_t;
+
+/**
+ * @brief Law from an SDP encoding name, "PCMA" or "PCMU"
+ *
+ * @return 0 if known, -1 otherwise
+ */
+int g711_law_from_name(const char *name, g711_law_t *law);
+
+const char *g711_law_name(g711_law_t law);
+
+/* Per sample conversions written as in the ITU-T G.191 reference, kept as
+* the reference for the block functions. None of this depends on ESP-IDF. */
+uint8_t g711_alaw_encode(int16_t pcm);
+uint8_t g711_ulaw_encode(int16_t pcm);
+int16_t g711_alaw_decode(uint8_t code);
+int16_t g711_ulaw_decode(uint8_t code);
+
+/**
+ * @brief Encode a block, bit exact with the per sample functions
+ *
+ * Table driven and in IRAM, the law is chosen once per block.
+ *
+ * @param code may be the pcm buffer, the conversion runs forward
+ */
+void g711_encode(g711_law_t law, const int16_t *pcm, uint8_t *code, int count);
+
+/**
+ * @brief Decode a block with a 256 entry table per law
+ *
+ * @param code may sit in the upper half of the pcm buffer, the
+ *             conversion runs forward, but may not overlap it otherwise
+ */
+void g711_decode(g711_law_t law, const uint8_t *code, int16_t *pcm, int count);
+
+#endif
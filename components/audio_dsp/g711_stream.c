@@ -0,0 +1,107 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "audio_element.h"
+#include "audio_mem.h"
+
+#include "g711_stream.h"
+
+static const char *TAG = "G711_STREAM";
+
+typedef struct {
+	g711_stream_mode_t mode;
+	volatile g711_law_t next_law;
+	g711_law_t law;
+	int64_t cpu_us;
+} g711_stream_t;
+
+static esp_err_t _g711_open(audio_element_handle_t self)
+{
+	g711_stream_t *gs = (g711_stream_t *)audio_element_getdata(self);
+	gs->law = gs->next_law;
+	gs->cpu_us = 0;
+	ESP_LOGD(TAG, "%s %s", gs->mode == G711_STREAM_ENCODE ? "Encoding" : "Decoding", g711_law_name(gs->law));
+	return ESP_OK;
+}
+
+static esp_err_t _g711_close(audio_element_handle_t self)
+{
+	return ESP_OK;
+}
+
+static audio_element_err_t _g711_process(audio_element_handle_t self, char *buf, int len)
+{
+	g711_stream_t *gs = (g711_stream_t *)audio_element_getdata(self);
+	int half = len / 2;
+	int r, n;
+
+	if (gs->mode == G711_STREAM_ENCODE) {
+		/* Bytes overwrite samples already read, in place is fine */
+		r = audio_element_input(self, buf, len & ~1);
+		if (r <= 0) return r;
+		n = r / sizeof(int16_t);
+		int64_t start = esp_timer_get_time();
+		g711_encode(gs->law, (int16_t *)buf, (uint8_t *)buf, n);
+		gs->cpu_us += esp_timer_get_time() - start;
+	} else {
+		/* Codes go in the upper half so the samples can grow into the buffer */
+		r = audio_element_input(self, buf + half, half);
+		if (r <= 0) return r;
+		int64_t start = esp_timer_get_time();
+		g711_decode(gs->law, (uint8_t *)buf + half, (int16_t *)buf, r);
+		gs->cpu_us += esp_timer_get_time() - start;
+		n = r * sizeof(int16_t);
+	}
+
+	int w = audio_element_output(self, buf, n);
+	return w > 0 ? r : w;
+}
+
+static esp_err_t _g711_destroy(audio_element_handle_t self)
+{
+	g711_stream_t *gs = (g711_stream_t *)audio_element_getdata(self);
+	audio_free(gs);
+	return ESP_OK;
+}
+
+void g711_stream_set_law(audio_element_handle_t self, g711_law_t law)
+{
+	g711_stream_t *gs = (g711_stream_t *)audio_element_getdata(self);
+	gs->next_law = law;
+}
+
+int64_t g711_stream_get_cpu_us(audio_element_handle_t self)
+{
+	g711_stream_t *gs = (g711_stream_t *)audio_element_getdata(self);
+	return gs->cpu_us;
+}
+
+audio_element_handle_t g711_stream_init(g711_stream_cfg_t *config)
+{
+	g711_stream_t *gs = audio_calloc(1, sizeof(g711_stream_t));
+	AUDIO_MEM_CHECK(TAG, gs, return NULL);
+	gs->mode = config->mode;
+	gs->next_law = config->law;
+
+	audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+	cfg.open = _g711_open;
+	cfg.close = _g711_close;
+	cfg.process = _g711_process;
+	cfg.destroy = _g711_destroy;
+	cfg.task_stack = config->task_stack;
+	cfg.task_core = config->task_core;
+	cfg.task_prio = config->task_prio;
+	cfg.out_rb_size = config->out_rb_size;
+	cfg.tag = config->mode == G711_STREAM_ENCODE ? "g711_enc" : "g711_dec";
+
+	audio_element_handle_t el = audio_element_init(&cfg);
+	AUDIO_MEM_CHECK(TAG, el, {
+		audio_free(gs);
+		return NULL;
+	});
+	audio_element_setdata(el, gs);
+	return el;
+}
@@ -0,0 +1,53 @@
+#ifndef G711_STREAM_H
+#define G711_STREAM_H
+
+#include <stdint.h>
+
+#include "audio_element.h"
+#include "g711.h"
+
+typedef enum {
+	G711_STREAM_ENCODE,     // 16 bit PCM in, G.711 bytes out
+	G711_STREAM_DECODE,     // G.711 bytes in, 16 bit PCM out
+} g711_stream_mode_t;
+
+typedef struct {
+	g711_stream_mode_t mode;
+	g711_law_t law;
+	int out_rb_size;
+	int task_stack;
+	int task_core;
+	int task_prio;
+} g711_stream_cfg_t;
+
+#define G711_STREAM_TASK_STACK  (3 * 1024)
+#define G711_STREAM_RB_SIZE     (2 * 1024)
+
+#define DEFAULT_G711_STREAM_CONFIG() { \
+	.mode = G711_STREAM_DECODE, \
+	.law = G711_ALAW, \
+	.out_rb_size = G711_STREAM_RB_SIZE, \
+	.task_stack = G711_STREAM_TASK_STACK, \
+	.task_core = 0, \
+	.task_prio = 5, \
+}
+
+/**
+ * @brief G.711 encoder or decoder, 8 kHz mono
+ *
+ * Unlike the ADF g711 elements the law is not fixed when the element is
+ * built, so one pipeline serves calls with either codec.
+ */
+audio_element_handle_t g711_stream_init(g711_stream_cfg_t *config);
+
+/**
+ * @brief Law for the next time the element is opened
+ */
+void g711_stream_set_law(audio_element_handle_t self, g711_law_t law);
+
+/**
+ * @brief Microseconds spent converting since the element was opened
+ */
+int64_t g711_stream_get_cpu_us(audio_element_handle_t self);
+
+#endif
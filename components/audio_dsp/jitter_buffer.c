@@ -0,0 +1,156 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "jitter_buffer.h"
+
+#define MS(ms)          ((ms) * JB_RATE / 1000)
+#define QUIET_ENERGY    (300 * 300 * JB_FRAME)  // Frame that can be skipped
+#define JITTER_SHIFT    4
+#define WINDOW_US       1000000     // Of the arrival offset floor
+#define US(samples)     ((int64_t)(samples) * 1000000 / JB_RATE)
+
+void jitter_buffer_init(jitter_buffer_t *jb, int min_ms, int max_ms)
+{
+	memset(jb, 0, sizeof(*jb));
+	jb->min_target = MS(min_ms);
+	jb->max_target = MS(max_ms);
+	if (jb->max_target > JB_SIZE - JB_FRAME) jb->max_target = JB_SIZE - JB_FRAME;
+	jb->target = jb->min_target;
+	plc_init(&jb->plc);
+}
+
+static void update_target(jitter_buffer_t *jb)
+{
+	int t = jb->min_target + 2 * (int)((int64_t)jb->jitter_us * JB_RATE / 1000000);
+	if (t > jb->max_target) t = jb->max_target;
+	jb->target = t;
+}
+
+/* Returns the arrival offset of the packet */
+static int64_t track_loss(jitter_buffer_t *jb, int count, int64_t now_us)
+{
+	if (jb->received == 0) {
+		jb->first_us = jb->window_us = now_us;
+		jb->offset_min = jb->offset_floor = 0;
+	}
+	int64_t offset = now_us - jb->first_us - US(jb->received);
+	jb->received += count;
+	if (offset < jb->offset_min) jb->offset_min = offset;
+	jb->recent[jb->recent_count++ % JB_RECENT] = offset;
+
+	if (now_us - jb->window_us < WINDOW_US) return offset;
+	int64_t step = jb->offset_min - jb->offset_floor;
+	if (step >= US(JB_FRAME)) jb->stats.lost += step / US(JB_FRAME);
+	/* Also follows a floor that drops, the first packets may have queued */
+	jb->offset_floor = jb->offset_min;
+	jb->offset_min = INT64_MAX;
+	jb->window_us = now_us;
+	return offset;
+}
+
+void jitter_buffer_put(jitter_buffer_t *jb, const int16_t *pcm, int count, int64_t now_us)
+{
+	if (count <= 0) return;
+
+	if (jb->last_count > 0) {
+		int32_t d = abs((int32_t)(now_us - jb->last_arrival_us - US(jb->last_count)));
+		jb->jitter_us += (d - jb->jitter_us) >> JITTER_SHIFT;
+		update_target(jb);
+	}
+	jb->last_arrival_us = now_us;
+	jb->last_count = count;
+	int64_t offset = track_loss(jb, count, now_us);
+
+	/* The packet before filled concealed slots. Late if this one is back
+	* near the floor, after a loss the offsets stay up by the lost audio. */
+	if (jb->late_pending > 0) {
+		if (offset < jb->late_offset - US(JB_FRAME) / 2) jb->stats.late += jb->late_pending;
+		jb->late_pending = 0;
+	}
+
+	/* Audio for slots already made up, what remained of it plays */
+	if (jb->unmatched > 0) {
+		int frames = (count + JB_FRAME - 1) / JB_FRAME;
+		if (frames > jb->unmatched) frames = jb->unmatched;
+		jb->unmatched -= frames;
+		jb->late_pending = frames;
+		jb->late_offset = offset;
+	}
+
+	/* Full, the oldest goes */
+	int over = jb->fill + count - JB_SIZE;
+	if (over > 0) {
+		jb->head = (jb->head + over) % JB_SIZE;
+		jb->fill -= over;
+		jb->stats.dropped += (over + JB_FRAME - 1) / JB_FRAME;
+	}
+
+	int tail = (jb->head + jb->fill) % JB_SIZE;
+	for (int i = 0; i < count; i++) {
+		jb->fifo[tail] = pcm[i];
+		if (++tail == JB_SIZE) tail = 0;
+	}
+	jb->fill += count;
+}
+
+static int64_t pop(jitter_buffer_t *jb, int16_t *frame)
+{
+	int64_t energy = 0;
+	for (int i = 0; i < JB_FRAME; i++) {
+		int16_t s = jb->fifo[jb->head];
+		if (++jb->head == JB_SIZE) jb->head = 0;
+		frame[i] = s;
+		energy += s * s;
+	}
+	jb->fill -= JB_FRAME;
+	return energy;
+}
+
+void jitter_buffer_get(jitter_buffer_t *jb, int16_t *frame)
+{
+	if (!jb->playing) {
+		if (jb->fill < jb->target || jb->fill < JB_FRAME) {
+			memset(frame, 0, JB_FRAME * sizeof(int16_t));
+			return;
+		}
+		jb->playing = true;
+	}
+
+	if (jb->fill < JB_FRAME) {
+		plc_conceal(&jb->plc, frame);
+		jb->stats.concealed++;
+		jb->unmatched++;
+		if (jb->plc.erased >= PLC_MAX_FRAMES) {
+			jb->playing = false;
+			jb->stats.underruns++;
+		}
+		return;
+	}
+
+	int64_t energy = pop(jb, frame);
+	while (jb->fill >= JB_FRAME && jb->fill > jb->target + MS(20) && energy < QUIET_ENERGY) {
+		jb->stats.dropped++;
+		energy = pop(jb, frame);
+	}
+	plc_good(&jb->plc, frame);
+	jb->stats.frames++;
+	jb->unmatched = 0;
+}
+
+void jitter_buffer_stats(const jitter_buffer_t *jb, jitter_buffer_stats_t *stats)
+{
+	*stats = jb->stats;
+
+	/* The step of the window still open, from the last few packets */
+	int n = jb->recent_count < JB_RECENT ? jb->recent_count : JB_RECENT;
+	if (n > 0) {
+		int64_t recent = INT64_MAX;
+		for (int i = 0; i < n; i++) {
+			if (jb->recent[i] < recent) recent = jb->recent[i];
+		}
+		int64_t step = recent - jb->offset_floor;
+		if (step >= US(JB_FRAME)) stats->lost += step / US(JB_FRAME);
+	}
+	stats->target_ms = jb->target * 1000 / JB_RATE;
+	stats->jitter_ms = jb->jitter_us / 1000;
+}
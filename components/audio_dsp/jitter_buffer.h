@@ -0,0 +1,86 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "plc.h"
+
+#define JB_FRAME        PLC_FRAME   // Played per call, 10 ms at 8 kHz
+#define JB_SIZE         4000        // 500 ms at 8 kHz
+#define JB_RATE         8000
+#define JB_RECENT       4           // Arrival offsets kept for the loss not yet counted
+
+/* All the counts are of JB_FRAME frames, 10 ms, whatever the packet size */
+typedef struct {
+	uint32_t frames;            // Played from the network
+	uint32_t late;              // Arrived after their slot was concealed
+	uint32_t lost;              // Never arrived, from steps in the arrival clock
+	uint32_t concealed;
+	uint32_t dropped;           // Discarded to bring the delay down or on overflow
+	uint32_t underruns;         // Concealment ran out and the buffer refilled
+	int target_ms;
+	int jitter_ms;
+} jitter_buffer_stats_t;
+
+typedef struct {
+	int16_t fifo[JB_SIZE];
+	int head, fill;
+	bool playing;
+	int target;                 // Samples buffered before playing
+	int min_target, max_target;
+
+	/* RFC 3550 style interarrival jitter, microseconds */
+	int64_t last_arrival_us;
+	int last_count;
+	int32_t jitter_us;
+
+	/* Arrival time less the audio received so far. A lost packet raises
+	* its floor for good, a late one only for a while. */
+	int64_t first_us, received;
+	int64_t window_us, offset_min, offset_floor;
+	int64_t recent[JB_RECENT];  // Offsets of the last packets
+	int recent_count;
+	int unmatched;              // Concealed frames not yet matched by audio
+	int late_pending;           // Matched by the last packet, late or after a loss
+	int64_t late_offset;        // Of that packet
+
+	plc_t plc;
+	jitter_buffer_stats_t stats;
+} jitter_buffer_t;
+
+/**
+ * @brief Start empty, for a new call
+ *
+ * @param min_ms, max_ms bounds of the delay the buffer adapts within
+ */
+void jitter_buffer_init(jitter_buffer_t *jb, int min_ms, int max_ms);
+
+/**
+ * @brief Add decoded audio as it arrives, mono 16 bit at JB_RATE
+ *
+ * In arrival order, the payloads carry no sequence numbers to reorder by.
+ * The spread of the arrival times against the audio they carry sets the
+ * target delay, twice the mean jitter over the minimum. A lost packet is
+ * not concealed, the audio after it plays that much earlier, and it is
+ * counted once the floor of the arrival offset over a second steps up.
+ *
+ * Audio that fills concealed slots is late, or the first after a loss:
+ * both arrive with a raised offset. It is counted late once the next
+ * packet shows the offset back down, a loss keeps it raised.
+ */
+void jitter_buffer_put(jitter_buffer_t *jb, const int16_t *pcm, int count, int64_t now_us);
+
+/**
+ * @brief Take the next JB_FRAME samples to play
+ *
+ * Silence until the target delay is buffered, then the audio, concealing
+ * frames that are missing when they are due. After PLC_MAX_FRAMES of
+ * concealment it goes back to buffering. While the delay exceeds the
+ * target by 20 ms, quiet frames are skipped to bring it down.
+ */
+void jitter_buffer_get(jitter_buffer_t *jb, int16_t *frame);
+
+void jitter_buffer_stats(const jitter_buffer_t *jb, jitter_buffer_stats_t *stats);
+
+#endif
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "audio_element.h"
+#include "audio_mem.h"
+
+#include "jitter_buffer.h"
+#include "jitter_stream.h"
+
+static const char *TAG = "JITTER";
+
+#define READ_MAX    (4 * JB_FRAME)  // Samples taken per pass
+
+typedef struct {
+	jitter_buffer_t jb;
+	int min_ms, max_ms;
+	int16_t in[READ_MAX];
+	SemaphoreHandle_t lock;         // The stats are read from other tasks
+} jitter_stream_t;
+
+static esp_err_t _jitter_open(audio_element_handle_t self)
+{
+	jitter_stream_t *js = (jitter_stream_t *)audio_element_getdata(self);
+	xSemaphoreTake(js->lock, portMAX_DELAY);
+	jitter_buffer_init(&js->jb, js->min_ms, js->max_ms);
+	xSemaphoreGive(js->lock);
+	audio_element_set_input_timeout(self, 0);
+	return ESP_OK;
+}
+
+static esp_err_t _jitter_close(audio_element_handle_t self)
+{
+	return ESP_OK;
+}
+
+static audio_element_err_t _jitter_process(audio_element_handle_t self, char *buf, int len)
+{
+	jitter_stream_t *js = (jitter_stream_t *)audio_element_getdata(self);
+
+	/* Everything that arrived since the last pass, as one arrival */
+	int got = 0;
+	while (got < sizeof(js->in)) {
+		int r = audio_element_input(self, (char *)js->in + got, sizeof(js->in) - got);
+		if (r == AEL_IO_DONE || r == AEL_IO_ABORT) return r;
+		if (r <= 0) break;
+		got += r;
+	}
+
+	xSemaphoreTake(js->lock, portMAX_DELAY);
+	jitter_buffer_put(&js->jb, js->in, got / sizeof(int16_t), esp_timer_get_time());
+	jitter_buffer_get(&js->jb, (int16_t *)buf);
+	xSemaphoreGive(js->lock);
+
+	return audio_element_output(self, buf, JB_FRAME * sizeof(int16_t));
+}
+
+static esp_err_t _jitter_destroy(audio_element_handle_t self)
+{
+	jitter_stream_t *js = (jitter_stream_t *)audio_element_getdata(self);
+	vSemaphoreDelete(js->lock);
+	audio_free(js);
+	return ESP_OK;
+}
+
+void jitter_stream_stats(audio_element_handle_t self, jitter_buffer_stats_t *stats)
+{
+	jitter_stream_t *js = (jitter_stream_t *)audio_element_getdata(self);
+	xSemaphoreTake(js->lock, portMAX_DELAY);
+	jitter_buffer_stats(&js->jb, stats);
+	xSemaphoreGive(js->lock);
+}
+
+size_t jitter_stream_stats_json(audio_element_handle_t self, char *buf, size_t size)
+{
+	jitter_buffer_stats_t st;
+	jitter_stream_stats(self, &st);
+	int len = snprintf(buf, size, "{\"frames\":%u,\"late\":%u,\"lost\":%u,\"concealed\":%u,"
+		"\"dropped\":%u,\"underruns\":%u,\"target_ms\":%d,\"jitter_ms\":%d}",
+		st.frames, st.late, st.lost, st.concealed, st.dropped, st.underruns, st.target_ms, st.jitter_ms);
+	return len > 0 && len < size ? len : 0;
+}
+
+audio_element_handle_t jitter_stream_init(jitter_stream_cfg_t *config)
+{
+	jitter_stream_t *js = audio_calloc(1, sizeof(jitter_stream_t));
+	AUDIO_MEM_CHECK(TAG, js, return NULL);
+	js->min_ms = config->min_ms;
+	js->max_ms = config->max_ms;
+	jitter_buffer_init(&js->jb, js->min_ms, js->max_ms);
+	js->lock = xSemaphoreCreateMutex();
+
+	audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+	cfg.open = _jitter_open;
+	cfg.close = _jitter_close;
+	cfg.process = _jitter_process;
+	cfg.destroy = _jitter_destroy;
+	cfg.task_stack = config->task_stack;
+	cfg.task_core = config->task_core;
+	cfg.task_prio = config->task_prio;
+	cfg.out_rb_size = config->out_rb_size;
+	cfg.tag = "jitter";
+
+	audio_element_handle_t el = audio_element_init(&cfg);
+	AUDIO_MEM_CHECK(TAG, el, {
+		vSemaphoreDelete(js->lock);
+		audio_free(js);
+		return NULL;
+	});
+	audio_element_setdata(el, js);
+	return el;
+}
@@ -0,0 +1,54 @@
+#ifndef JITTER_STREAM_H
+#define JITTER_STREAM_H
+
+#include <stddef.h>
+
+#include "audio_element.h"
+#include "jitter_buffer.h"
+
+typedef struct {
+	int min_ms;             // Delay the buffer adapts within
+	int max_ms;
+	int out_rb_size;        // Kept small, it adds to the delay
+	int task_stack;
+	int task_core;
+	int task_prio;
+} jitter_stream_cfg_t;
+
+#define JITTER_STREAM_TASK_STACK    (3 * 1024)
+#define JITTER_STREAM_RB_SIZE       (2 * JB_FRAME * sizeof(int16_t))
+
+#define DEFAULT_JITTER_STREAM_CONFIG() { \
+	.min_ms = 20, \
+	.max_ms = 200, \
+	.out_rb_size = JITTER_STREAM_RB_SIZE, \
+	.task_stack = JITTER_STREAM_TASK_STACK, \
+	.task_core = 0, \
+	.task_prio = 5, \
+}
+
+/**
+ * @brief Jitter buffer with loss concealment for decoded call audio, 16 bit
+ *        mono at 8 kHz, see jitter_buffer.h
+ *
+ * Put it right after the decoder. It takes whatever has arrived without
+ * waiting and writes one 10 ms frame per pass, so its output runs at the
+ * pace of the consumer and never underruns. Starts empty on every open.
+ */
+audio_element_handle_t jitter_stream_init(jitter_stream_cfg_t *config);
+
+/**
+ * @brief Counters of the current or last session
+ */
+void jitter_stream_stats(audio_element_handle_t self, jitter_buffer_stats_t *stats);
+
+/**
+ * @brief The counters as a JSON object, for /metrics
+ *
+ * The counts are of 10 ms frames, see jitter_buffer_stats_t.
+ *
+ * @return length written, 0 if it does not fit
+ */
+size_t jitter_stream_stats_json(audio_element_handle_t self, char *buf, size_t size);
+
+#endif
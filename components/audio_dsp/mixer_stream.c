@@ -0,0 +1,248 @@
+#include <math.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "esp_log.h"
+#include "audio_element.h"
+#include "audio_mem.h"
+
+#include "mixer_stream.h"
+
+static const char *TAG = "MIXER";
+
+#define UNITY   (1 << 16)       // Gains and levels are Q16
+
+typedef struct {
+	const char *name;
+	mixer_read_cb_t read;
+	void *ctx;
+	int32_t gain, gain_target, gain_step;
+	int32_t level, level_target, level_step;
+	/* Set by other tasks, taken at the start of a block */
+	bool pending;
+	int32_t req_gain;
+	bool req_on;
+	int req_fade;
+} mixer_source_t;
+
+typedef struct {
+	int rate;
+	int channels;
+	int count;
+	mixer_source_t src[MIXER_MAX_SOURCES];
+	int16_t in[MIXER_BLOCK];
+	int32_t acc[MIXER_BLOCK];
+	mixer_tap_cb_t tap;
+	void *tap_ctx;
+	portMUX_TYPE lock;
+} mixer_t;
+
+static int32_t db_to_gain(int db)
+{
+	if (db <= MIXER_GAIN_MIN) return 0;
+	if (db > MIXER_GAIN_MAX) db = MIXER_GAIN_MAX;
+	return lrintf(UNITY * powf(10.0f, db / 20.0f));
+}
+
+/* Step that reaches target in n samples, never 0 while they differ */
+static int32_t ramp_step(int32_t cur, int32_t target, int n)
+{
+	if (n < 1) n = 1;
+	int32_t step = (target - cur) / n;
+	if (step == 0 && target != cur) step = target > cur ? 1 : -1;
+	return step;
+}
+
+static inline int32_t ramp(int32_t *cur, int32_t target, int32_t step)
+{
+	if (*cur != target) {
+		*cur += step;
+		if ((step > 0 && *cur > target) || (step < 0 && *cur < target)) *cur = target;
+	}
+	return *cur;
+}
+
+static void take_requests(mixer_t *mx)
+{
+	portENTER_CRITICAL(&mx->lock);
+	for (int i = 0; i < mx->count; i++) {
+		mixer_source_t *s = &mx->src[i];
+		if (!s->pending) continue;
+		s->pending = false;
+
+		s->gain_target = s->req_gain;
+		s->gain_step = ramp_step(s->gain, s->gain_target, MIXER_GAIN_RAMP_MS * mx->rate / 1000);
+
+		s->level_target = s->req_on ? UNITY : 0;
+		int n = s->req_fade * mx->rate / 1000;
+		if (n <= 0) s->level = s->level_target;
+		s->level_step = ramp_step(s->level, s->level_target, n);
+	}
+	portEXIT_CRITICAL(&mx->lock);
+}
+
+static void mix_source(mixer_t *mx, mixer_source_t *s, int frames)
+{
+	int n = s->read(mx->in, frames, s->ctx);
+	if (n < 0) n = 0;
+
+	/* Off and staying off, the read above only drained it */
+	if (s->level == 0 && s->level_target == 0) return;
+
+	for (int i = 0; i < frames; i++) {
+		int32_t gain = ramp(&s->gain, s->gain_target, s->gain_step);
+		int32_t level = ramp(&s->level, s->level_target, s->level_step);
+		if (i >= n) continue;
+		int64_t g = ((int64_t)gain * level) >> 16;
+		mx->acc[i] += (mx->in[i] * g) >> 16;
+	}
+}
+
+static esp_err_t _mixer_open(audio_element_handle_t self)
+{
+	return ESP_OK;
+}
+
+static esp_err_t _mixer_close(audio_element_handle_t self)
+{
+	return ESP_OK;
+}
+
+static audio_element_err_t _mixer_process(audio_element_handle_t self, char *buf, int len)
+{
+	mixer_t *mx = (mixer_t *)audio_element_getdata(self);
+
+	int frames = len / (mx->channels * sizeof(int16_t));
+	if (frames > MIXER_BLOCK) frames = MIXER_BLOCK;
+
+	take_requests(mx);
+	memset(mx->acc, 0, frames * sizeof(int32_t));
+	for (int i = 0; i < mx->count; i++) {
+		mix_source(mx, &mx->src[i], frames);
+	}
+
+	int16_t *mix = mx->in;
+	for (int i = 0; i < frames; i++) {
+		int32_t s = mx->acc[i];
+		if (s > INT16_MAX) s = INT16_MAX;
+		if (s < INT16_MIN) s = INT16_MIN;
+		mix[i] = s;
+	}
+	if (mx->tap) mx->tap(mix, frames, mx->tap_ctx);
+
+	int16_t *out = (int16_t *)buf;
+	for (int i = 0; i < frames; i++) {
+		for (int c = 0; c < mx->channels; c++) *out++ = mix[i];
+	}
+	return audio_element_output(self, buf, frames * mx->channels * sizeof(int16_t));
+}
+
+static esp_err_t _mixer_destroy(audio_element_handle_t self)
+{
+	mixer_t *mx = (mixer_t *)audio_element_getdata(self);
+	audio_free(mx);
+	return ESP_OK;
+}
+
+int mixer_stream_add_source(audio_element_handle_t self, const char *name, mixer_read_cb_t read, void *ctx)
+{
+	mixer_t *mx = (mixer_t *)audio_element_getdata(self);
+	if (mx->count >= MIXER_MAX_SOURCES) return -1;
+
+	mixer_source_t *s = &mx->src[mx->count];
+	memset(s, 0, sizeof(*s));
+	s->name = name;
+	s->read = read;
+	s->ctx = ctx;
+	s->gain = s->gain_target = s->req_gain = UNITY;
+	return mx->count++;
+}
+
+void mixer_stream_set_tap(audio_element_handle_t self, mixer_tap_cb_t tap, void *ctx)
+{
+	mixer_t *mx = (mixer_t *)audio_element_getdata(self);
+	mx->tap_ctx = ctx;
+	mx->tap = tap;
+}
+
+esp_err_t mixer_stream_set_gain(audio_element_handle_t self, int id, int gain_db)
+{
+	mixer_t *mx = (mixer_t *)audio_element_getdata(self);
+	if (id < 0 || id >= mx->count) return ESP_ERR_INVALID_ARG;
+
+	portENTER_CRITICAL(&mx->lock);
+	mx->src[id].req_gain = db_to_gain(gain_db);
+	mx->src[id].pending = true;
+	portEXIT_CRITICAL(&mx->lock);
+	return ESP_OK;
+}
+
+static void request_enable(mixer_t *mx, int id, bool on, int fade_ms)
+{
+	mx->src[id].req_on = on;
+	mx->src[id].req_fade = fade_ms;
+	mx->src[id].pending = true;
+}
+
+esp_err_t mixer_stream_enable(audio_element_handle_t self, int id, bool on, int fade_ms)
+{
+	mixer_t *mx = (mixer_t *)audio_element_getdata(self);
+	if (id < 0 || id >= mx->count) return ESP_ERR_INVALID_ARG;
+
+	portENTER_CRITICAL(&mx->lock);
+	request_enable(mx, id, on, fade_ms);
+	portEXIT_CRITICAL(&mx->lock);
+	ESP_LOGD(TAG, "%s %s", mx->src[id].name, on ? "on" : "off");
+	return ESP_OK;
+}
+
+esp_err_t mixer_stream_crossfade(audio_element_handle_t self, int from, int to, int fade_ms)
+{
+	mixer_t *mx = (mixer_t *)audio_element_getdata(self);
+	if (from < 0 || from >= mx->count || to < 0 || to >= mx->count) return ESP_ERR_INVALID_ARG;
+
+	/* One critical section, both are taken by the same block */
+	portENTER_CRITICAL(&mx->lock);
+	request_enable(mx, from, false, fade_ms);
+	request_enable(mx, to, true, fade_ms);
+	portEXIT_CRITICAL(&mx->lock);
+	ESP_LOGD(TAG, "%s to %s", mx->src[from].name, mx->src[to].name);
+	return ESP_OK;
+}
+
+audio_element_handle_t mixer_stream_init(mixer_stream_cfg_t *config)
+{
+	mixer_t *mx = audio_calloc(1, sizeof(mixer_t));
+	AUDIO_MEM_CHECK(TAG, mx, return NULL);
+	mx->rate = config->sample_rate;
+	mx->channels = config->channels;
+	portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+	mx->lock = lock;
+
+	audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+	cfg.open = _mixer_open;
+	cfg.close = _mixer_close;
+	cfg.process = _mixer_process;
+	cfg.destroy = _mixer_destroy;
+	cfg.task_stack = config->task_stack;
+	cfg.task_core = config->task_core;
+	cfg.task_prio = config->task_prio;
+	cfg.out_rb_size = config->out_rb_size;
+	cfg.tag = "mixer";
+
+	audio_element_handle_t el = audio_element_init(&cfg);
+	AUDIO_MEM_CHECK(TAG, el, {
+		audio_free(mx);
+		return NULL;
+	});
+	audio_element_setdata(el, mx);
+
+	audio_element_info_t info = {0};
+	audio_element_getinfo(el, &info);
+	info.sample_rates = config->sample_rate;
+	info.channels = config->channels;
+	info.bits = 16;
+	audio_element_setinfo(el, &info);
+	return el;
+}
@@ -0,0 +1,88 @@
+#ifndef MIXER_STREAM_H
+#define MIXER_STREAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "audio_element.h"
+
+#define MIXER_MAX_SOURCES   4
+#define MIXER_BLOCK         80      // Frames mixed per pass, 10 ms at 8 kHz
+#define MIXER_GAIN_MIN      -60     // dB, at or below is silence
+#define MIXER_GAIN_MAX      30
+#define MIXER_GAIN_RAMP_MS  10      // Volume changes are smoothed over this
+
+/**
+ * Fill buf with up to frames mono 16 bit samples at the mixer rate and
+ * return how many, the rest of the block is silence. Called from the mixer
+ * task on every block whether the source is on or not, so a producer that
+ * blocks when full keeps draining. Must not block.
+ */
+typedef int (*mixer_read_cb_t)(int16_t *buf, int frames, void *ctx);
+
+/**
+ * Receives every mixed block, mono and before it reaches the speaker, for
+ * an echo canceller reference. Runs in the mixer task.
+ */
+typedef void (*mixer_tap_cb_t)(const int16_t *mix, int frames, void *ctx);
+
+typedef struct {
+	int sample_rate;
+	int channels;           // Of the output, sources are mono
+	int out_rb_size;
+	int task_stack;
+	int task_core;
+	int task_prio;
+} mixer_stream_cfg_t;
+
+#define MIXER_STREAM_TASK_STACK (3 * 1024)
+#define MIXER_STREAM_RB_SIZE    (1 * 1024)
+
+#define DEFAULT_MIXER_STREAM_CONFIG() { \
+	.sample_rate = 8000, \
+	.channels = 2, \
+	.out_rb_size = MIXER_STREAM_RB_SIZE, \
+	.task_stack = MIXER_STREAM_TASK_STACK, \
+	.task_core = 0, \
+	.task_prio = 5, \
+}
+
+/**
+ * @brief Source element that mixes named inputs, put it in front of the
+ *        one I2S writer of a port
+ *
+ * Runs for as long as the device is up and writes silence when every
+ * source is off, so starting or ending a source never touches the driver.
+ * Each source has a volume and an on/off level, both ramped per sample.
+ */
+audio_element_handle_t mixer_stream_init(mixer_stream_cfg_t *config);
+
+/**
+ * @brief Add an input, off and at 0 dB, before the element runs
+ *
+ * @param name string literal, the pointer is kept
+ * @return source id, -1 if there is no room
+ */
+int mixer_stream_add_source(audio_element_handle_t self, const char *name, mixer_read_cb_t read, void *ctx);
+
+/**
+ * @brief Set the tap before the element runs
+ */
+void mixer_stream_set_tap(audio_element_handle_t self, mixer_tap_cb_t tap, void *ctx);
+
+/**
+ * @brief Volume of a source in dB, applied over MIXER_GAIN_RAMP_MS
+ */
+esp_err_t mixer_stream_set_gain(audio_element_handle_t self, int id, int gain_db);
+
+/**
+ * @brief Turn a source on or off with a linear fade, 0 for a hard switch
+ */
+esp_err_t mixer_stream_enable(audio_element_handle_t self, int id, bool on, int fade_ms);
+
+/**
+ * @brief Fade one source out and another in starting on the same sample
+ */
+esp_err_t mixer_stream_crossfade(audio_element_handle_t self, int from, int to, int fade_ms);
+
+#endif
@@ -0,0 +1,93 @@
+#include <string.h>
+
+#include "plc.h"
+
+#define ATTEN_STEP  82      // Q15 per sample, 20% per 10 ms
+
+void plc_init(plc_t *plc)
+{
+	memset(plc, 0, sizeof(*plc));
+}
+
+static void history_push(plc_t *plc, const int16_t *x, int count)
+{
+	memmove(plc->hist, plc->hist + count, (PLC_HISTORY - count) * sizeof(int16_t));
+	memcpy(plc->hist + PLC_HISTORY - count, x, count * sizeof(int16_t));
+}
+
+static int find_pitch(const int16_t *hist)
+{
+	const int16_t *x = hist + PLC_HISTORY - PLC_CORR_LEN;
+	int best = PLC_PITCH_MAX;
+	float best_score = 0;
+
+	for (int p = PLC_PITCH_MIN; p <= PLC_PITCH_MAX; p++) {
+		const int16_t *y = x - p;
+		int64_t corr = 0, energy = 1;
+		for (int i = 0; i < PLC_CORR_LEN; i++) {
+			corr += x[i] * y[i];
+			energy += y[i] * y[i];
+		}
+		if (corr <= 0) continue;
+		float score = (float)corr * corr / energy;
+		if (score > best_score) {
+			best_score = score;
+			best = p;
+		}
+	}
+	return best;
+}
+
+/* The last period, its tail blended into what preceded its start so the
+* repetition loops smoothly */
+static void start_erasure(plc_t *plc)
+{
+	int p = plc->pitch = find_pitch(plc->hist);
+	int q = p / 4;
+	const int16_t *last = plc->hist + PLC_HISTORY - p;
+
+	memcpy(plc->period, last, p * sizeof(int16_t));
+	for (int i = 0; i < q; i++) {
+		int32_t w = (i + 1) * 32768 / (q + 1);
+		int32_t lead = last[-q + i];
+		plc->period[p - q + i] = (plc->period[p - q + i] * (32768 - w) + lead * w) >> 15;
+	}
+	plc->pos = 0;
+	plc->synth = 0;
+}
+
+static void synthesize(plc_t *plc, int16_t *out, int count)
+{
+	for (int i = 0; i < count; i++) {
+		int32_t g = 32768;
+		if (plc->synth >= PLC_FRAME) g -= (plc->synth - PLC_FRAME) * ATTEN_STEP;
+		if (g < 0) g = 0;
+		out[i] = (plc->period[plc->pos] * g) >> 15;
+		if (++plc->pos == plc->pitch) plc->pos = 0;
+		plc->synth++;
+	}
+}
+
+void plc_conceal(plc_t *plc, int16_t *frame)
+{
+	if (plc->erased == 0) start_erasure(plc);
+	plc->erased++;
+	synthesize(plc, frame, PLC_FRAME);
+	history_push(plc, frame, PLC_FRAME);
+}
+
+void plc_good(plc_t *plc, int16_t *frame)
+{
+	if (plc->erased > 0) {
+		int16_t tail[PLC_FRAME];
+		int len = plc->pitch / 4 + 32 * (plc->erased - 1);
+		if (len > PLC_FRAME) len = PLC_FRAME;
+		synthesize(plc, tail, len);
+		for (int i = 0; i < len; i++) {
+			int32_t w = (i + 1) * 32768 / (len + 1);
+			frame[i] = (tail[i] * (32768 - w) + frame[i] * w) >> 15;
+		}
+		plc->erased = 0;
+	}
+	history_push(plc, frame, PLC_FRAME);
+}
@@ -0,0 +1,43 @@
+#ifndef PLC_H
+#define PLC_H
+
+#include <stdint.h>
+
+#define PLC_FRAME       80      // 10 ms at 8 kHz
+#define PLC_PITCH_MIN   40      // 200 Hz
+#define PLC_PITCH_MAX   120     // 66 Hz
+#define PLC_CORR_LEN    160     // 20 ms matched for the pitch
+#define PLC_HISTORY     (PLC_PITCH_MAX + PLC_CORR_LEN + PLC_PITCH_MAX / 4)
+#define PLC_MAX_FRAMES  6       // Concealed before it fades to silence
+
+typedef struct {
+	int16_t hist[PLC_HISTORY];  // Last output, newest at the end
+	int16_t period[PLC_PITCH_MAX];
+	int pitch;
+	int pos;                    // In period
+	int erased;                 // Frames concealed in a row
+	int synth;                  // Samples concealed in a row
+} plc_t;
+
+void plc_init(plc_t *plc);
+
+/**
+ * @brief Pass a received frame of PLC_FRAME samples, in place
+ *
+ * After a loss the start of the frame is overlap-added with the
+ * continuation of the concealment, a quarter pitch plus 4 ms per extra
+ * lost frame, so the join does not click.
+ */
+void plc_good(plc_t *plc, int16_t *frame);
+
+/**
+ * @brief Make up the next frame of PLC_FRAME samples
+ *
+ * G.711 Appendix I style: the pitch is found by normalized correlation over
+ * the last 20 ms and the last period is repeated, its ends overlap-added
+ * over a quarter pitch. Unattenuated for the first 10 ms, then 20% less
+ * every 10 ms, silent after PLC_MAX_FRAMES. Does not depend on ESP-IDF.
+ */
+void plc_conceal(plc_t *plc, int16_t *frame);
+
+#endif
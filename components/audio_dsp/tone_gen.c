@@ -0,0 +1,114 @@
+#include <math.h>
+#include <string.h>
+
+#include "tone_gen.h"
+
+#define SINE_BITS   8
+#define SINE_SIZE   (1 << SINE_BITS)
+#define RAMP_MS     5       // Fade in and out, a hard start clicks
+
+const tone_gen_tone_t tone_gen_ringback = {
+	.level = -14, .repeat = true, .steps = 2,
+	.step = { { { 0, 0 }, 0, 260 }, { { 440, 0 }, 1280, 2460 } },
+};
+
+const tone_gen_tone_t tone_gen_ringback_cept = {
+	.level = -14, .repeat = true, .steps = 1,
+	.step = { { { 425, 0 }, 1000, 4000 } },
+};
+
+const tone_gen_tone_t tone_gen_ringback_us = {
+	.level = -17, .repeat = true, .steps = 1,
+	.step = { { { 440, 480 }, 2000, 4000 } },
+};
+
+const tone_gen_tone_t tone_gen_ringback_uk = {
+	.level = -17, .repeat = true, .steps = 2,
+	.step = { { { 400, 450 }, 400, 200 }, { { 400, 450 }, 400, 2000 } },
+};
+
+const tone_gen_tone_t tone_gen_panic = {
+	.level = -8, .repeat = true, .steps = 2,
+	.step = { { { 960, 0 }, 250, 0 }, { { 770, 0 }, 250, 0 } },
+};
+
+const tone_gen_tone_t tone_gen_chime = {
+	.level = -12, .repeat = false, .steps = 2,
+	.step = { { { 660, 0 }, 300, 0 }, { { 523, 0 }, 500, 200 } },
+};
+
+static int16_t sine[SINE_SIZE + 1];  // One extra entry for the interpolation
+
+static void sine_init(void)
+{
+	if (sine[SINE_SIZE / 4] != 0) return;
+	for (int i = 0; i <= SINE_SIZE; i++) {
+		sine[i] = (int16_t)lrintf(32767.0f * sinf(2.0f * (float)M_PI * i / SINE_SIZE));
+	}
+}
+
+/* Q15 sine of a 32 bit phase, linear interpolation between table entries */
+static inline int32_t sine_at(uint32_t phase)
+{
+	uint32_t i = phase >> (32 - SINE_BITS);
+	int32_t frac = (phase >> (16 - SINE_BITS)) & 0xFFFF;
+	return sine[i] + (((sine[i + 1] - sine[i]) * frac) >> 16);
+}
+
+static void step_start(tone_gen_t *gen)
+{
+	const tone_gen_step_t *step = &gen->tone->step[gen->step];
+	gen->pos = 0;
+	gen->on = (uint32_t)step->on_ms * gen->rate / 1000;
+	gen->len = gen->on + (uint32_t)step->off_ms * gen->rate / 1000;
+	for (int i = 0; i < 2; i++) {
+		gen->inc[i] = (uint32_t)(((uint64_t)step->freq[i] << 32) / gen->rate);
+		/* Continuous phase when consecutive steps share a frequency */
+		if (step->freq[i] == 0) gen->phase[i] = 0;
+	}
+}
+
+void tone_gen_init(tone_gen_t *gen, const tone_gen_tone_t *tone, int rate)
+{
+	sine_init();
+	memset(gen, 0, sizeof(*gen));
+	gen->tone = tone;
+	gen->rate = rate;
+	gen->amp = (int32_t)lrintf(32767.0f * powf(10.0f, tone->level / 20.0f));
+	gen->done = tone->steps == 0;
+	if (!gen->done) step_start(gen);
+}
+
+int tone_gen_fill(tone_gen_t *gen, int16_t *buf, int frames, int channels)
+{
+	uint32_t ramp = gen->rate * RAMP_MS / 1000;
+	int n = 0;
+
+	while (n < frames && !gen->done) {
+		int32_t s = 0;
+		if (gen->pos < gen->on) {
+			for (int i = 0; i < 2; i++) {
+				if (gen->inc[i] == 0) continue;
+				s += sine_at(gen->phase[i]);
+				gen->phase[i] += gen->inc[i];
+			}
+			int32_t amp = gen->amp;
+			uint32_t edge = gen->pos < gen->on - gen->pos ? gen->pos : gen->on - gen->pos;
+			if (edge < ramp) amp = amp * (int32_t)edge / (int32_t)ramp;
+			s = (s * amp) >> 15;
+			if (s > INT16_MAX) s = INT16_MAX;
+			if (s < INT16_MIN) s = INT16_MIN;
+		}
+		for (int c = 0; c < channels; c++) *buf++ = (int16_t)s;
+		n++;
+
+		if (++gen->pos >= gen->len) {
+			if (++gen->step >= gen->tone->steps) {
+				gen->step = 0;
+				gen->done = !gen->tone->repeat;
+			}
+			if (!gen->done) step_start(gen);
+		}
+	}
+	return n;
+}
@@ -0,0 +1,64 @@
+#ifndef TONE_GEN_H
+#define TONE_GEN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TONE_GEN_MAX_STEPS  6
+
+/* Plays freq (one or two summed) for on_ms, then silence for off_ms */
+typedef struct {
+	uint16_t freq[2];       // Hz, 0 when unused
+	uint16_t on_ms;
+	uint16_t off_ms;
+} tone_gen_step_t;
+
+/* A cadence of steps, played once or repeated until stopped */
+typedef struct {
+	int8_t level;           // dBFS of each frequency
+	bool repeat;
+	uint8_t steps;
+	tone_gen_step_t step[TONE_GEN_MAX_STEPS];
+} tone_gen_tone_t;
+
+/* Ringback of the former ringback.wav, 440 Hz about 1.3 s every 4 s */
+extern const tone_gen_tone_t tone_gen_ringback;
+/* ITU-T E.180 ringback, 425 Hz 1 s on 4 s off (Argentina, CEPT) */
+extern const tone_gen_tone_t tone_gen_ringback_cept;
+/* 440 + 480 Hz 2 s on 4 s off (North America) */
+extern const tone_gen_tone_t tone_gen_ringback_us;
+/* 400 + 450 Hz 0.4 0.2 0.4 2 s (United Kingdom) */
+extern const tone_gen_tone_t tone_gen_ringback_uk;
+/* Fast two tone warble for a panic call */
+extern const tone_gen_tone_t tone_gen_panic;
+/* Single two note chime, nurse presence */
+extern const tone_gen_tone_t tone_gen_chime;
+
+typedef struct {
+	const tone_gen_tone_t *tone;
+	int rate;
+	uint8_t step;
+	bool done;
+	uint32_t pos;           // Samples into the step
+	uint32_t on, len;       // Samples of tone and of the whole step
+	uint32_t phase[2], inc[2];
+	int32_t amp;            // Q15
+} tone_gen_t;
+
+/**
+ * @brief Start a tone from the first step
+ *
+ * Fixed point phase accumulators over a sine table, no floating point
+ * per sample. Does not depend on ESP-IDF, it builds on the host as well.
+ */
+void tone_gen_init(tone_gen_t *gen, const tone_gen_tone_t *tone, int rate);
+
+/**
+ * @brief Synthesize 16 bit samples, the same value on every channel
+ *
+ * @return frames written, less than frames once a tone that does not
+ *         repeat has ended
+ */
+int tone_gen_fill(tone_gen_t *gen, int16_t *buf, int frames, int channels);
+
+#endif
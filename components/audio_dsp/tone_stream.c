@@ -0,0 +1,101 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "esp_log.h"
+#include "audio_element.h"
+#include "audio_mem.h"
+
+#include "tone_stream.h"
+
+static const char *TAG = "TONE_STREAM";
+
+typedef struct {
+	tone_gen_t gen;
+	const tone_gen_tone_t *tone;
+	const tone_gen_tone_t * volatile next;  // Set from another task, picked up in process
+	int channels;
+} tone_stream_t;
+
+static esp_err_t _tone_open(audio_element_handle_t self)
+{
+	tone_stream_t *tone = (tone_stream_t *)audio_element_getdata(self);
+	audio_element_info_t info = {0};
+	audio_element_getinfo(self, &info);
+	if (tone->next != NULL) {
+		tone->tone = tone->next;
+		tone->next = NULL;
+	}
+	tone_gen_init(&tone->gen, tone->tone, info.sample_rates);
+	return ESP_OK;
+}
+
+static esp_err_t _tone_close(audio_element_handle_t self)
+{
+	return ESP_OK;
+}
+
+static audio_element_err_t _tone_process(audio_element_handle_t self, char *buf, int len)
+{
+	tone_stream_t *tone = (tone_stream_t *)audio_element_getdata(self);
+
+	const tone_gen_tone_t *next = tone->next;
+	if (next != NULL) {
+		tone->next = NULL;
+		tone->tone = next;
+		tone_gen_init(&tone->gen, next, tone->gen.rate);
+	}
+
+	int frame = tone->channels * sizeof(int16_t);
+	int frames = tone_gen_fill(&tone->gen, (int16_t *)buf, len / frame, tone->channels);
+	if (frames == 0) return AEL_IO_DONE;
+	return audio_element_output(self, buf, frames * frame);
+}
+
+static esp_err_t _tone_destroy(audio_element_handle_t self)
+{
+	tone_stream_t *tone = (tone_stream_t *)audio_element_getdata(self);
+	audio_free(tone);
+	return ESP_OK;
+}
+
+esp_err_t tone_stream_set_tone(audio_element_handle_t self, const tone_gen_tone_t *tone)
+{
+	tone_stream_t *ts = (tone_stream_t *)audio_element_getdata(self);
+	ts->next = tone;
+	return ESP_OK;
+}
+
+audio_element_handle_t tone_stream_init(tone_stream_cfg_t *config)
+{
+	tone_stream_t *tone = audio_calloc(1, sizeof(tone_stream_t));
+	AUDIO_MEM_CHECK(TAG, tone, return NULL);
+	tone->tone = config->tone;
+	tone->channels = config->channels;
+
+	audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+	cfg.open = _tone_open;
+	cfg.close = _tone_close;
+	cfg.process = _tone_process;
+	cfg.destroy = _tone_destroy;
+	cfg.task_stack = config->task_stack;
+	cfg.task_core = config->task_core;
+	cfg.task_prio = config->task_prio;
+	cfg.out_rb_size = config->out_rb_size;
+	cfg.tag = "tone";
+
+	audio_element_handle_t el = audio_element_init(&cfg);
+	AUDIO_MEM_CHECK(TAG, el, {
+		audio_free(tone);
+		return NULL;
+	});
+	audio_element_setdata(el, tone);
+
+	audio_element_info_t info = {0};
+	audio_element_getinfo(el, &info);
+	info.sample_rates = config->sample_rate;
+	info.channels = config->channels;
+	info.bits = 16;
+	audio_element_setinfo(el, &info);
+	return el;
+}
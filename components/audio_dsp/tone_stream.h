@@ -0,0 +1,43 @@
+#ifndef TONE_STREAM_H
+#define TONE_STREAM_H
+
+#include "audio_element.h"
+#include "tone_gen.h"
+
+typedef struct {
+	const tone_gen_tone_t *tone;
+	int sample_rate;        // Written directly in the I2S format
+	int channels;
+	int out_rb_size;
+	int task_stack;
+	int task_core;
+	int task_prio;
+} tone_stream_cfg_t;
+
+#define TONE_STREAM_TASK_STACK  (2 * 1024)
+#define TONE_STREAM_RB_SIZE     (2 * 1024)
+
+#define DEFAULT_TONE_STREAM_CONFIG() { \
+	.tone = &tone_gen_ringback, \
+	.sample_rate = 8000, \
+	.channels = 2, \
+	.out_rb_size = TONE_STREAM_RB_SIZE, \
+	.task_stack = TONE_STREAM_TASK_STACK, \
+	.task_core = 0, \
+	.task_prio = 5, \
+}
+
+/**
+ * @brief Source element that synthesizes a tone, 16 bit samples
+ *
+ * Replaces a decoder and a resampler in front of the I2S writer. A tone
+ * that does not repeat finishes the pipeline when it ends.
+ */
+audio_element_handle_t tone_stream_init(tone_stream_cfg_t *config);
+
+/**
+ * @brief Play another tone from its first step, takes effect on the next buffer
+ */
+esp_err_t tone_stream_set_tone(audio_element_handle_t self, const tone_gen_tone_t *tone);
+
+#endif
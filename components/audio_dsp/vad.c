@@ -0,0 +1,95 @@
+#include <string.h>
+
+#include "vad.h"
+
+#define NOISE_INIT      1073        // -60 dBFS, the floor climbs from here
+#define NOISE_MIN       11          // -80 dBFS
+#define SILENCE         108         // -70 dBFS, never speech below it
+#define RISE_SHIFT      7           // 0.034 dB a frame
+#define START_SHIFT     3           // 0.5 dB a frame over the first START_FRAMES
+#define START_FRAMES    50
+#define FALL_SHIFT      2
+#define ZC_UNVOICED     30          // Crossings per frame, 1.5 kHz
+
+static int energy_db(uint32_t e)
+{
+	/* 10 log10(e / 32768^2) from the top bit, 3 dB a bit, plus the next
+	* bit for half of that */
+	if (e == 0) return -100;
+	int bit = 31 - __builtin_clz(e);
+	int half = bit > 0 && (e >> (bit - 1) & 1);
+	return (bit - 30) * 3 + (half ? 2 : 0);
+}
+
+void vad_init(vad_t *vad, int hangover_ms)
+{
+	memset(vad, 0, sizeof(*vad));
+	vad->noise = NOISE_INIT;
+	vad->hangover = hangover_ms * VAD_RATE / 1000 / VAD_FRAME;
+}
+
+static bool decide(vad_t *vad)
+{
+	uint32_t e = vad->sum / VAD_FRAME;
+	uint32_t n = vad->noise;
+
+	bool speech = e > SILENCE &&
+		(e > 4 * n || (e > 2 * n && vad->crossings >= ZC_UNVOICED));
+
+	/* Minimum tracking, speech never holds it up for long as words leave
+	* gaps at the floor */
+	if (vad->hold) {
+		/* The room is muted, not quieter */
+	} else if (e < n) {
+		n -= (n - e) >> FALL_SHIFT;
+	} else {
+		int shift = vad->stats.frames < START_FRAMES ? START_SHIFT : RISE_SHIFT;
+		uint32_t up = n + (n >> shift) + 1;
+		n = up < e ? up : e;
+	}
+	vad->noise = n > NOISE_MIN ? n : NOISE_MIN;
+
+	if (speech) {
+		vad->hang = vad->hangover;
+	} else if (vad->hang > 0) {
+		vad->hang--;
+	}
+	vad->active = speech || vad->hang > 0;
+
+	vad->stats.frames++;
+	if (vad->active) vad->stats.speech++;
+	return vad->active;
+}
+
+bool vad_process(vad_t *vad, const int16_t *pcm, int count)
+{
+	bool any = false, decided = false;
+
+	for (int i = 0; i < count; i++) {
+		int32_t s = pcm[i];
+		bool negative = s < 0;
+		vad->sum += s * s;
+		vad->crossings += negative != vad->negative;
+		vad->negative = negative;
+
+		if (++vad->count == VAD_FRAME) {
+			any |= decide(vad);
+			decided = true;
+			vad->sum = 0;
+			vad->crossings = 0;
+			vad->count = 0;
+		}
+	}
+	return decided ? any : vad->active;
+}
+
+void vad_hold(vad_t *vad, bool hold)
+{
+	vad->hold = hold;
+}
+
+void vad_stats(const vad_t *vad, vad_stats_t *stats)
+{
+	*stats = vad->stats;
+	stats->noise_db = energy_db(vad->noise);
+}
@@ -0,0 +1,61 @@
+#ifndef VAD_H
+#define VAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define VAD_FRAME       80      // Decision unit, 10 ms at 8 kHz
+#define VAD_RATE        8000
+
+typedef struct {
+	uint32_t frames;
+	uint32_t speech;            // Frames decided active, hangover included
+	int noise_db;               // Noise floor, dBFS
+} vad_stats_t;
+
+typedef struct {
+	/* Frame being measured, the blocks need not be frame aligned */
+	uint64_t sum;
+	int crossings;
+	int count;
+	bool negative;              // Sign of the last sample
+
+	uint32_t noise;             // Mean sample energy of the floor
+	bool hold;                  // Floor frozen
+	int hangover, hang;         // Frames
+	bool active;
+	vad_stats_t stats;
+} vad_t;
+
+/**
+ * @param hangover_ms kept active after the last speech frame, covers the
+ *                    soft word endings the energy misses
+ */
+void vad_init(vad_t *vad, int hangover_ms);
+
+/**
+ * @brief Feed mono 16 bit audio at VAD_RATE
+ *
+ * A frame is speech when its energy is 6 dB over the noise floor, or 3 dB
+ * over with a zero crossing rate of unvoiced sounds such as "s" and "f".
+ * The floor follows the quietest frames down at once and rises by about
+ * 3 dB a second, so it also climbs under a steady new noise. Over the
+ * first half second it rises 50 dB a second to find the room. Does not
+ * depend on ESP-IDF.
+ *
+ * @return true if any frame completed in the block is active, the current
+ *         state if none completed
+ */
+bool vad_process(vad_t *vad, const int16_t *pcm, int count);
+
+/**
+ * @brief Freeze the noise floor, while the echo suppressor attenuates
+ *
+ * A muted room would pull the floor down and the room noise after it
+ * would then pass for speech until the floor climbs back.
+ */
+void vad_hold(vad_t *vad, bool hold);
+
+void vad_stats(const vad_t *vad, vad_stats_t *stats);
+
+#endif
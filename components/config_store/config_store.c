@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_spiffs.h"
+#include "nvs.h"
+#include "rom/crc.h"
+
+#include "config_store.h"
+
+static const char *TAG = "CONFIG_STORE";
+
+#define CONFIG_STORE_NAMESPACE  "config"
+#define CONFIG_STORE_MAGIC      0x47464E43  // "CNFG"
+
+#define LEGACY_BASE_PATH        "/spiffs"
+#define LEGACY_PATH             LEGACY_BASE_PATH "/config.txt"
+#define LEGACY_TMP_PATH         LEGACY_BASE_PATH "/config.tmp"
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t size;      // Of the config that follows
+	uint32_t crc;       // CRC32 of the config
+} config_record_t;
+
+esp_err_t config_store_load(const char *key, const size_t *sizes, uint16_t version, void *cfg, size_t size)
+{
+	nvs_handle nvs;
+	esp_err_t err = nvs_open(CONFIG_STORE_NAMESPACE, NVS_READONLY, &nvs);
+	if (err == ESP_ERR_NVS_NOT_FOUND) return ESP_ERR_NOT_FOUND;
+	if (err != ESP_OK) return err;
+
+	size_t len = 0;
+	err = nvs_get_blob(nvs, key, NULL, &len);
+	if (err == ESP_ERR_NVS_NOT_FOUND) {
+		nvs_close(nvs);
+		return ESP_ERR_NOT_FOUND;
+	}
+
+	uint8_t *blob = NULL;
+	if (err == ESP_OK && len > sizeof(config_record_t)) {
+		blob = malloc(len);
+		err = blob ? nvs_get_blob(nvs, key, blob, &len) : ESP_ERR_NO_MEM;
+	}
+	nvs_close(nvs);
+	if (err != ESP_OK) {
+		free(blob);
+		return err;
+	}
+
+	config_record_t rec;
+	if (blob) memcpy(&rec, blob, sizeof(rec));
+	if (blob == NULL || rec.magic != CONFIG_STORE_MAGIC || sizeof(rec) + rec.size != len ||
+		crc32_le(0, blob + sizeof(rec), rec.size) != rec.crc) {
+		ESP_LOGE(TAG, "Damaged %s record", key);
+		free(blob);
+		return ESP_ERR_INVALID_CRC;
+	}
+
+	size_t copy = rec.size < size ? rec.size : size;
+	if (rec.version >= 1 && rec.version < version && sizes[rec.version - 1] < copy) copy = sizes[rec.version - 1];
+	if (rec.version != version || rec.size != size) {
+		ESP_LOGW(TAG, "Converting %s record v%d (%d bytes, %d used) to v%d (%d bytes)", key,
+			rec.version, rec.size, (int)copy, version, (int)size);
+	}
+	memcpy(cfg, blob + sizeof(rec), copy);
+	free(blob);
+	return ESP_OK;
+}
+
+esp_err_t config_store_save(const char *key, uint16_t version, const void *cfg, size_t size)
+{
+	config_record_t rec = {
+		.magic = CONFIG_STORE_MAGIC,
+		.version = version,
+		.size = size,
+		.crc = crc32_le(0, cfg, size),
+	};
+
+	uint8_t *blob = malloc(sizeof(rec) + size);
+	if (blob == NULL) return ESP_ERR_NO_MEM;
+	memcpy(blob, &rec, sizeof(rec));
+	memcpy(blob + sizeof(rec), cfg, size);
+
+	nvs_handle nvs;
+	esp_err_t err = nvs_open(CONFIG_STORE_NAMESPACE, NVS_READWRITE, &nvs);
+	if (err == ESP_OK) {
+		err = nvs_set_blob(nvs, key, blob, sizeof(rec) + size);
+		if (err == ESP_OK) err = nvs_commit(nvs);
+		nvs_close(nvs);
+	}
+	free(blob);
+
+	if (err != ESP_OK) ESP_LOGE(TAG, "Failed to save %s (%s)", key, esp_err_to_name(err));
+	return err;
+}
+
+size_t config_store_legacy_read(char *buf, size_t size)
+{
+	esp_vfs_spiffs_conf_t conf = {
+		.base_path = LEGACY_BASE_PATH,
+		.partition_label = NULL,
+		.max_files = 1,
+		.format_if_mount_failed = false
+	};
+	if (esp_vfs_spiffs_register(&conf) != ESP_OK) return 0;
+
+	struct stat st;
+	bool have_config = stat(LEGACY_PATH, &st) == 0;
+	if (!have_config && stat(LEGACY_TMP_PATH, &st) == 0 && rename(LEGACY_TMP_PATH, LEGACY_PATH) == 0) {
+		ESP_LOGW(TAG, "Completed interrupted config save");
+		have_config = true;
+	}
+
+	size_t len = 0;
+	FILE *f = have_config ? fopen(LEGACY_PATH, "r") : NULL;
+	if (f != NULL) {
+		len = fread(buf, 1, size - 1, f);
+		buf[len] = 0;
+		fclose(f);
+	}
+
+	esp_vfs_spiffs_unregister(NULL);
+	return len;
+}
@@ -0,0 +1,51 @@
+#ifndef CONFIG_STORE_H
+#define CONFIG_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * @brief Load a config record from NVS into cfg
+ *
+ * The record is the config struct itself behind a header with a magic, the
+ * layout version, the size and a CRC32. cfg must already hold the defaults:
+ * members are only ever appended to the struct, so a record written by
+ * another firmware version fills the common prefix and the remaining
+ * members keep their defaults. Changing the type of an existing member
+ * needs a new key.
+ *
+ * An older record is only copied up to the members its version had, the
+ * tail padding of the old struct may overlap the members appended since.
+ *
+ * @param key NVS key, 15 characters at most
+ * @param sizes payload of each version, sizes[v - 1] for version v up to
+ *              the current one, offsetof() the first member it lacks
+ *
+ * @return ESP_ERR_NOT_FOUND if there is no record,
+ *         ESP_ERR_INVALID_CRC if it is damaged, cfg is then untouched
+ */
+esp_err_t config_store_load(const char *key, const size_t *sizes, uint16_t version, void *cfg, size_t size);
+
+/**
+ * @brief Replace the config record in NVS
+ *
+ * NVS writes the new blob before releasing the old one, a power cut keeps
+ * either of them whole.
+ */
+esp_err_t config_store_save(const char *key, uint16_t version, const void *cfg, size_t size);
+
+/**
+ * @brief Read the /spiffs/config.txt JSON left by older firmware
+ *
+ * Mounts SPIFFS, without formatting it, only for the read. Completes a
+ * save that older firmware left between removing config.txt and renaming
+ * config.tmp. The file is kept, firmware without the NVS record still
+ * finds it after a rollback.
+ *
+ * @return length read, 0 if there is no file
+ */
+size_t config_store_legacy_read(char *buf, size_t size);
+
+#endif
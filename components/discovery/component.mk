@@ -0,0 +1,6 @@
+#
+# Component Makefile
+#
+# (Uses default behaviour of compiling all source files in directory, adding '.' to include path.)
+
+COMPONENT_ADD_INCLUDEDIRS := .
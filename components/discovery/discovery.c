@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "tcpip_adapter.h"
+#include "mdns.h"
+
+#include "lwip/sockets.h"
+
+#include "discovery.h"
+
+static const char *TAG = "DISCOVERY";
+
+#define DISCOVERY_PROBE     "DISCOVER"
+#define DISCOVERY_REPLY_SIZE 256
+
+static discovery_config_t config;
+static char chip_id[13];
+static char version_str[8];
+
+void discovery_chip_id(char id[13])
+{
+	uint8_t mac[6];
+	esp_efuse_mac_get_default(mac);
+	snprintf(id, 13, "%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+void discovery_sip_user(const char *uri, char *user, size_t size)
+{
+	const char *s = strstr(uri, "://");
+	s = s ? s + 3 : uri;
+	size_t len = strcspn(s, ":@");
+	if (len >= size) len = size - 1;
+	memcpy(user, s, len);
+	user[len] = 0;
+}
+
+/* Address of the interface facing the prober, any configured one otherwise */
+static ip4_addr_t reply_ip(const struct sockaddr_in *from)
+{
+	static const tcpip_adapter_if_t ifs[] = { TCPIP_ADAPTER_IF_ETH, TCPIP_ADAPTER_IF_STA, TCPIP_ADAPTER_IF_AP };
+	ip4_addr_t any = { 0 };
+
+	for (int i = 0; i < sizeof(ifs) / sizeof(ifs[0]); i++) {
+		tcpip_adapter_ip_info_t info;
+		if (tcpip_adapter_get_ip_info(ifs[i], &info) != ESP_OK || info.ip.addr == 0) continue;
+		if ((info.ip.addr & info.netmask.addr) == (from->sin_addr.s_addr & info.netmask.addr)) return info.ip;
+		if (any.addr == 0) any = info.ip;
+	}
+	return any;
+}
+
+static size_t reply_build(char *buf, size_t size, const struct sockaddr_in *from)
+{
+	ip4_addr_t ip = reply_ip(from);
+	size_t len = snprintf(buf, size, "{\"model\":\"%s\",\"chip_id\":\"%s\",\"version\":%d,\"ip\":\"%s\"",
+		config.model, chip_id, config.version, ip4addr_ntoa(&ip));
+
+	if (config.fields && len + 2 < size) {
+		size_t n = config.fields(buf + len + 1, size - len - 2);
+		if (n > 0 && len + 1 + n + 1 < size) {
+			buf[len] = ',';
+			len += 1 + n;
+		}
+	}
+	if (len + 1 >= size) return 0;
+	buf[len++] = '}';
+	return len;
+}
+
+static void discovery_task(void *arg)
+{
+	int fd = (int)arg;
+	char *reply = malloc(DISCOVERY_REPLY_SIZE);
+
+	while (reply)
+	{
+		char probe[16];
+		struct sockaddr_in from;
+		socklen_t from_len = sizeof(from);
+
+		int n = recvfrom(fd, probe, sizeof(probe), 0, (struct sockaddr *)&from, &from_len);
+		if (n < (int)strlen(DISCOVERY_PROBE) || memcmp(probe, DISCOVERY_PROBE, strlen(DISCOVERY_PROBE)) != 0) continue;
+
+		/* Spread the answers of a whole fleet */
+		vTaskDelay(pdMS_TO_TICKS(esp_random() % (CONFIG_DISCOVERY_REPLY_SPREAD + 1)));
+
+		size_t len = reply_build(reply, DISCOVERY_REPLY_SIZE, &from);
+		if (len > 0) sendto(fd, reply, len, 0, (struct sockaddr *)&from, from_len);
+	}
+
+	ESP_LOGE(TAG, "Out of memory");
+	close(fd);
+	vTaskDelete(NULL);
+}
+
+static esp_err_t mdns_announce(void)
+{
+	char hostname[32], instance[48];
+	snprintf(hostname, sizeof(hostname), "%s-%s", config.model, chip_id + 6);
+	snprintf(instance, sizeof(instance), "%s %s", config.model, chip_id);
+
+	esp_err_t err = mdns_init();
+	if (err != ESP_OK) return err;
+
+	mdns_hostname_set(hostname);
+	mdns_instance_name_set(instance);
+
+	mdns_txt_item_t txt[] = {
+		{ "model", (char *)config.model },
+		{ "version", version_str },
+		{ "chip_id", chip_id },
+	};
+	err = mdns_service_add(NULL, "_http", "_tcp", 80, txt, sizeof(txt) / sizeof(txt[0]));
+	if (err == ESP_OK) ESP_LOGI(TAG, "mDNS %s.local", hostname);
+	return err;
+}
+
+esp_err_t discovery_start(const discovery_config_t *cfg)
+{
+	config = *cfg;
+	discovery_chip_id(chip_id);
+	snprintf(version_str, sizeof(version_str), "%d", cfg->version);
+
+	esp_err_t err = mdns_announce();
+	if (err != ESP_OK) {
+		/* The UDP responder is enough for the fleet tool, carry on */
+		ESP_LOGE(TAG, "mDNS failed (%s)", esp_err_to_name(err));
+	}
+
+	int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (fd < 0) return ESP_FAIL;
+
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(CONFIG_DISCOVERY_PORT),
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+	};
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		ESP_LOGE(TAG, "Failed to bind port %d", CONFIG_DISCOVERY_PORT);
+		close(fd);
+		return ESP_FAIL;
+	}
+
+	if (xTaskCreate(discovery_task, "discovery_task", 2560, (void *)fd, tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+		close(fd);
+		return ESP_ERR_NO_MEM;
+	}
+	ESP_LOGI(TAG, "Answering probes on UDP %d", CONFIG_DISCOVERY_PORT);
+	return ESP_OK;
+}
+
+void discovery_txt_set(const char *key, const char *value)
+{
+	mdns_service_txt_item_set("_http", "_tcp", key, value);
+}
+
+void discovery_event(void *ctx, system_event_t *event)
+{
+	mdns_handle_system_event(ctx, event);
+}
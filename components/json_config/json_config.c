@@ -0,0 +1,411 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "json_config.h"
+
+#define INVALID_JSON "Invalid JSON"
+
+typedef struct {
+	const char *p;
+	const char *end;
+} scanner_t;
+
+typedef enum {
+	SCAN_OK,
+	SCAN_LONG,      // Valid, but does not fit the destination
+	SCAN_BAD,       // Malformed JSON
+} scan_result_t;
+
+static void skip_ws(scanner_t *s)
+{
+	while (s->p < s->end && (*s->p == ' ' || *s->p == '\t' || *s->p == '\n' || *s->p == '\r')) s->p++;
+}
+
+static bool eat(scanner_t *s, char c)
+{
+	skip_ws(s);
+	if (s->p == s->end || *s->p != c) return false;
+	s->p++;
+	return true;
+}
+
+static bool at(scanner_t *s, char c)
+{
+	return s->p < s->end && *s->p == c;
+}
+
+static bool eat_literal(scanner_t *s, const char *lit, size_t len)
+{
+	if ((size_t)(s->end - s->p) < len || memcmp(s->p, lit, len) != 0) return false;
+	s->p += len;
+	return true;
+}
+
+static int hex4(const char *p)
+{
+	int v = 0;
+	for (int i = 0; i < 4; i++) {
+		char c = p[i];
+		v <<= 4;
+		if (c >= '0' && c <= '9') v |= c - '0';
+		else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+		else return -1;
+	}
+	return v;
+}
+
+/* \uXXXX, a surrogate pair takes two of them */
+static long scan_codepoint(scanner_t *s)
+{
+	if (s->end - s->p < 4) return -1;
+	long cp = hex4(s->p);
+	s->p += 4;
+	if (cp >= 0xDC00 && cp <= 0xDFFF) return -1;
+	if (cp >= 0xD800 && cp <= 0xDBFF) {
+		if (s->end - s->p < 6 || s->p[0] != '\\' || s->p[1] != 'u') return -1;
+		long lo = hex4(s->p + 2);
+		if (lo < 0xDC00 || lo > 0xDFFF) return -1;
+		s->p += 6;
+		cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+	}
+	return cp;
+}
+
+static size_t utf8_encode(long cp, char *u)
+{
+	if (cp < 0x80) {
+		u[0] = cp;
+		return 1;
+	} else if (cp < 0x800) {
+		u[0] = 0xC0 | (cp >> 6);
+		u[1] = 0x80 | (cp & 0x3F);
+		return 2;
+	} else if (cp < 0x10000) {
+		u[0] = 0xE0 | (cp >> 12);
+		u[1] = 0x80 | ((cp >> 6) & 0x3F);
+		u[2] = 0x80 | (cp & 0x3F);
+		return 3;
+	}
+	u[0] = 0xF0 | (cp >> 18);
+	u[1] = 0x80 | ((cp >> 12) & 0x3F);
+	u[2] = 0x80 | ((cp >> 6) & 0x3F);
+	u[3] = 0x80 | (cp & 0x3F);
+	return 4;
+}
+
+/* String at s->p, unescaped into dst (NUL terminated) unless dst is NULL */
+static scan_result_t scan_string(scanner_t *s, char *dst, size_t size)
+{
+	size_t n = 0;
+	bool fits = true;
+
+	if (!at(s, '"')) return SCAN_BAD;
+	s->p++;
+
+	while (s->p < s->end && *s->p != '"') {
+		char u[4];
+		size_t ulen = 1;
+		unsigned char c = *s->p++;
+
+		if (c < 0x20) return SCAN_BAD;
+		if (c != '\\') {
+			u[0] = c;
+		} else if (s->p == s->end) {
+			return SCAN_BAD;
+		} else {
+			switch (*s->p++) {
+			case '"':  u[0] = '"'; break;
+			case '\\': u[0] = '\\'; break;
+			case '/':  u[0] = '/'; break;
+			case 'b':  u[0] = '\b'; break;
+			case 'f':  u[0] = '\f'; break;
+			case 'n':  u[0] = '\n'; break;
+			case 'r':  u[0] = '\r'; break;
+			case 't':  u[0] = '\t'; break;
+			case 'u': {
+				long cp = scan_codepoint(s);
+				/* A NUL would silently cut the C string */
+				if (cp <= 0) return SCAN_BAD;
+				ulen = utf8_encode(cp, u);
+				break;
+			}
+			default:
+				return SCAN_BAD;
+			}
+		}
+
+		if (dst && fits) {
+			if (n + ulen < size) {
+				memcpy(dst + n, u, ulen);
+				n += ulen;
+			} else {
+				fits = false;
+			}
+		}
+	}
+
+	if (s->p == s->end) return SCAN_BAD;
+	s->p++;
+	if (dst && size > 0) dst[n] = 0;
+	return fits ? SCAN_OK : SCAN_LONG;
+}
+
+/* Number at s->p, *integer is cleared by a fraction or exponent */
+static bool scan_number(scanner_t *s, bool *integer)
+{
+	const char *p = s->p;
+	*integer = true;
+
+	if (p < s->end && *p == '-') p++;
+	if (p == s->end || *p < '0' || *p > '9') return false;
+	if (*p == '0') {
+		p++;
+	} else {
+		while (p < s->end && *p >= '0' && *p <= '9') p++;
+	}
+	if (p < s->end && *p == '.') {
+		*integer = false;
+		p++;
+		if (p == s->end || *p < '0' || *p > '9') return false;
+		while (p < s->end && *p >= '0' && *p <= '9') p++;
+	}
+	if (p < s->end && (*p == 'e' || *p == 'E')) {
+		*integer = false;
+		p++;
+		if (p < s->end && (*p == '+' || *p == '-')) p++;
+		if (p == s->end || *p < '0' || *p > '9') return false;
+		while (p < s->end && *p >= '0' && *p <= '9') p++;
+	}
+	s->p = p;
+	return true;
+}
+
+static bool int_parse(const char *p, size_t len, int *out)
+{
+	bool neg = len > 0 && *p == '-';
+	if (neg) {
+		p++;
+		len--;
+	}
+	/* Ten digits can not overflow the accumulator */
+	if (len == 0 || len > 10) return false;
+
+	long long v = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (p[i] < '0' || p[i] > '9') return false;
+		v = v * 10 + (p[i] - '0');
+	}
+	if (neg) v = -v;
+	if (v < -2147483647LL - 1 || v > 2147483647LL) return false;
+	*out = v;
+	return true;
+}
+
+static bool ip_valid(const char *s)
+{
+	if (*s == 0) return true;
+
+	for (int part = 0; part < 4; part++) {
+		int v = 0, digits = 0;
+		while (*s >= '0' && *s <= '9' && digits < 3) {
+			v = v * 10 + (*s++ - '0');
+			digits++;
+		}
+		if (digits == 0 || v > 255) return false;
+		if (part < 3 && *s++ != '.') return false;
+	}
+	return *s == 0;
+}
+
+static scan_result_t value_skip(scanner_t *s)
+{
+	bool integer;
+	if (at(s, '"')) return scan_string(s, NULL, 0) == SCAN_BAD ? SCAN_BAD : SCAN_OK;
+	if (eat_literal(s, "true", 4) || eat_literal(s, "false", 5) || eat_literal(s, "null", 4)) return SCAN_OK;
+	return scan_number(s, &integer) ? SCAN_OK : SCAN_BAD;
+}
+
+static const char *value_parse(scanner_t *s, const json_config_field_t *f, void *cfg)
+{
+	char *dst = (char *)cfg + f->offset;
+	scan_result_t r;
+
+	switch (f->type) {
+	case JSON_CONFIG_BOOL:
+		if (eat_literal(s, "true", 4)) {
+			*(bool *)dst = true;
+		} else if (eat_literal(s, "false", 5)) {
+			*(bool *)dst = false;
+		} else {
+			return f->error;
+		}
+		return NULL;
+
+	case JSON_CONFIG_INT: {
+		const char *start;
+		size_t len;
+		char num[12];
+		int v;
+
+		if (at(s, '"')) {
+			/* The web page sends range inputs as strings */
+			r = scan_string(s, num, sizeof(num));
+			if (r == SCAN_BAD) return INVALID_JSON;
+			if (r == SCAN_LONG) return f->error;
+			start = num;
+			len = strlen(num);
+		} else {
+			bool integer;
+			start = s->p;
+			if (!scan_number(s, &integer) || !integer) return f->error;
+			len = s->p - start;
+		}
+		if (!int_parse(start, len, &v) || v < f->min || v > f->max) return f->error;
+		*(int *)dst = v;
+		return NULL;
+	}
+
+	case JSON_CONFIG_STR:
+	case JSON_CONFIG_IP:
+		if (!at(s, '"')) return f->error;
+		r = scan_string(s, dst, f->size);
+		if (r == SCAN_BAD) return INVALID_JSON;
+		if (r == SCAN_LONG) return f->error;
+		if (f->type == JSON_CONFIG_IP && !ip_valid(dst)) return f->error;
+		return NULL;
+	}
+	return f->error;
+}
+
+static const json_config_field_t *field_find(const json_config_field_t *fields, size_t count,
+	const char *key, size_t len)
+{
+	for (size_t i = 0; i < count; i++) {
+		if (fields[i].key_len == len && memcmp(fields[i].key, key, len) == 0) return &fields[i];
+	}
+	return NULL;
+}
+
+const char *json_config_parse(const json_config_field_t *fields, size_t count,
+	const char *json, size_t len, void *cfg)
+{
+	scanner_t s = { .p = json, .end = json + len };
+
+	if (!eat(&s, '{')) return "Object expected";
+
+	if (!eat(&s, '}')) {
+		do {
+			skip_ws(&s);
+			/* Keys are matched raw, an escaped key is never one of ours */
+			const char *key = s.p + 1;
+			if (scan_string(&s, NULL, 0) != SCAN_OK) return INVALID_JSON;
+			size_t key_len = s.p - 1 - key;
+
+			if (!eat(&s, ':')) return INVALID_JSON;
+			skip_ws(&s);
+			if (at(&s, '{') || at(&s, '[')) return "Flat object expected";
+
+			const json_config_field_t *f = field_find(fields, count, key, key_len);
+			if (f) {
+				const char *err = value_parse(&s, f, cfg);
+				if (err) return err;
+			} else if (value_skip(&s) != SCAN_OK) {
+				return INVALID_JSON;
+			}
+		} while (eat(&s, ','));
+
+		if (!eat(&s, '}')) return INVALID_JSON;
+	}
+
+	skip_ws(&s);
+	return s.p == s.end ? NULL : INVALID_JSON;
+}
+
+void json_config_defaults(const json_config_field_t *fields, size_t count, void *cfg)
+{
+	for (size_t i = 0; i < count; i++) {
+		const json_config_field_t *f = &fields[i];
+		char *dst = (char *)cfg + f->offset;
+
+		switch (f->type) {
+		case JSON_CONFIG_BOOL:
+			*(bool *)dst = f->def;
+			break;
+		case JSON_CONFIG_INT:
+			*(int *)dst = f->def;
+			break;
+		case JSON_CONFIG_STR:
+		case JSON_CONFIG_IP:
+			snprintf(dst, f->size, "%s", f->def_str ? f->def_str : "");
+			break;
+		}
+	}
+}
+
+typedef struct {
+	char *buf;
+	size_t size;
+	size_t len;
+} writer_t;
+
+static void emit(writer_t *w, const char *s, size_t len)
+{
+	if (w->len + len < w->size) memcpy(w->buf + w->len, s, len);
+	w->len += len;
+}
+
+static void emit_string(writer_t *w, const char *s)
+{
+	emit(w, "\"", 1);
+	for (; *s; s++) {
+		unsigned char c = *s;
+		char esc[8];
+		if (c == '"' || c == '\\') {
+			esc[0] = '\\';
+			esc[1] = c;
+			emit(w, esc, 2);
+		} else if (c < 0x20) {
+			emit(w, esc, snprintf(esc, sizeof(esc), "\\u%04x", c));
+		} else {
+			emit(w, s, 1);
+		}
+	}
+	emit(w, "\"", 1);
+}
+
+size_t json_config_write(const json_config_field_t *fields, size_t count,
+	const void *cfg, char *buf, size_t size)
+{
+	writer_t w = { .buf = buf, .size = size, .len = 0 };
+
+	emit(&w, "{", 1);
+	for (size_t i = 0; i < count; i++) {
+		const json_config_field_t *f = &fields[i];
+		const char *src = (const char *)cfg + f->offset;
+		char num[12];
+
+		if (i > 0) emit(&w, ",", 1);
+		emit_string(&w, f->key);
+		emit(&w, ":", 1);
+
+		switch (f->type) {
+		case JSON_CONFIG_BOOL:
+			if (*(const bool *)src) emit(&w, "true", 4);
+			else emit(&w, "false", 5);
+			break;
+		case JSON_CONFIG_INT:
+			emit(&w, num, snprintf(num, sizeof(num), "%d", *(const int *)src));
+			break;
+		case JSON_CONFIG_STR:
+		case JSON_CONFIG_IP:
+			emit_string(&w, src);
+			break;
+		}
+	}
+	emit(&w, "}", 1);
+
+	if (w.len >= size) return 0;
+	buf[w.len] = 0;
+	return w.len;
+}
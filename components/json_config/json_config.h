@@ -0,0 +1,88 @@
+#ifndef JSON_CONFIG_H
+#define JSON_CONFIG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+	JSON_CONFIG_BOOL,       // true or false, into a bool
+	JSON_CONFIG_INT,        // Integer or integer string (range inputs), into an int
+	JSON_CONFIG_STR,        // String, into a char array
+	JSON_CONFIG_IP,         // Dotted quad string or empty, into a char array
+} json_config_type_t;
+
+/* One config key. Declare the fields with the JSON_CONFIG_* macros so the
+* destination, size and error message come from the struct member. */
+typedef struct {
+	const char *key;
+	uint8_t key_len;
+	uint8_t type;           // json_config_type_t
+	uint16_t offset;        // Of the member in the config struct
+	uint16_t size;          // Of the member, strings include the terminator
+	int min, max;           // JSON_CONFIG_INT bounds
+	int def;                // JSON_CONFIG_BOOL and JSON_CONFIG_INT default
+	const char *def_str;    // JSON_CONFIG_STR and JSON_CONFIG_IP default
+	const char *error;      // "Invalid <key>"
+} json_config_field_t;
+
+#define JSON_CONFIG_FIELD_(type_, st, member, key_, min_, max_, def_, def_str_) \
+	{ \
+		.key = key_, \
+		.key_len = sizeof(key_) - 1, \
+		.type = type_, \
+		.offset = offsetof(st, member), \
+		.size = sizeof(((st *)0)->member), \
+		.min = min_, \
+		.max = max_, \
+		.def = def_, \
+		.def_str = def_str_, \
+		.error = "Invalid " key_, \
+	}
+
+#define JSON_CONFIG_BOOL(st, member, key, def) \
+	JSON_CONFIG_FIELD_(JSON_CONFIG_BOOL, st, member, key, 0, 1, def, NULL)
+#define JSON_CONFIG_INT(st, member, key, min, max, def) \
+	JSON_CONFIG_FIELD_(JSON_CONFIG_INT, st, member, key, min, max, def, NULL)
+#define JSON_CONFIG_STR(st, member, key, def) \
+	JSON_CONFIG_FIELD_(JSON_CONFIG_STR, st, member, key, 0, 0, 0, def)
+#define JSON_CONFIG_IP(st, member, key, def) \
+	JSON_CONFIG_FIELD_(JSON_CONFIG_IP, st, member, key, 0, 0, 0, def)
+
+#define JSON_CONFIG_COUNT(fields) (sizeof(fields) / sizeof((fields)[0]))
+
+/**
+ * @brief Set every field of cfg to its default
+ *
+ * Members not in the table are left untouched.
+ */
+void json_config_defaults(const json_config_field_t *fields, size_t count, void *cfg);
+
+/**
+ * @brief Parse a flat JSON object into cfg
+ *
+ * A single pass over the text, without a token array or a copy of the
+ * input, so there is no limit on the number of keys. Only the keys present
+ * are written, call json_config_defaults() first for a complete config.
+ * Unknown keys are skipped, a later duplicate key wins.
+ *
+ * The JSON does not need to be NUL terminated. cfg may be partly written
+ * when the JSON is rejected, parse into a scratch copy when that matters.
+ *
+ * Does not depend on ESP-IDF, it builds and runs on the host as well.
+ *
+ * @return NULL if accepted, otherwise a short static reason such as
+ *         "Invalid JSON" or "Invalid ip"
+ */
+const char *json_config_parse(const json_config_field_t *fields, size_t count,
+	const char *json, size_t len, void *cfg);
+
+/**
+ * @brief Serialize cfg as a JSON object, keys in table order
+ *
+ * @return length written without the terminator, 0 if it does not fit
+ */
+size_t json_config_write(const json_config_field_t *fields, size_t count,
+	const void *cfg, char *buf, size_t size);
+
+#endif
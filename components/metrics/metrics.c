@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+
+#include "metrics.h"
+
+static const char *TAG = "METRICS";
+
+#define METRICS_BOOT_MAX     16
+#define METRICS_SOURCE_MAX   8
+
+typedef struct {
+	const char *name;
+	int ms;
+} boot_mark_t;
+
+typedef struct {
+	const char *name;
+	metrics_source_cb_t cb;
+} metrics_source_t;
+
+static boot_mark_t boot[METRICS_BOOT_MAX];
+static int boot_count;
+static metrics_source_t sources[METRICS_SOURCE_MAX];
+static int source_count;
+static portMUX_TYPE metrics_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void metrics_boot_mark(const char *name)
+{
+	int ms = esp_timer_get_time() / 1000;
+	bool added = false;
+
+	portENTER_CRITICAL(&metrics_mux);
+	int i;
+	for (i = 0; i < boot_count && strcmp(boot[i].name, name) != 0; i++);
+	if (i == boot_count && i < METRICS_BOOT_MAX) {
+		boot[i].name = name;
+		boot[i].ms = ms;
+		boot_count++;
+		added = true;
+	}
+	portEXIT_CRITICAL(&metrics_mux);
+
+	if (added) ESP_LOGI(TAG, "Boot %s at %d ms", name, ms);
+}
+
+int metrics_boot_get(const char *name)
+{
+	int ms = -1;
+	portENTER_CRITICAL(&metrics_mux);
+	for (int i = 0; i < boot_count; i++) {
+		if (strcmp(boot[i].name, name) == 0) ms = boot[i].ms;
+	}
+	portEXIT_CRITICAL(&metrics_mux);
+	return ms;
+}
+
+esp_err_t metrics_register(const char *name, metrics_source_cb_t cb)
+{
+	esp_err_t err = ESP_ERR_NO_MEM;
+	portENTER_CRITICAL(&metrics_mux);
+	if (source_count < METRICS_SOURCE_MAX) {
+		sources[source_count].name = name;
+		sources[source_count].cb = cb;
+		source_count++;
+		err = ESP_OK;
+	}
+	portEXIT_CRITICAL(&metrics_mux);
+	return err;
+}
+
+size_t metrics_json(char *buf, size_t size)
+{
+	boot_mark_t marks[METRICS_BOOT_MAX];
+	portENTER_CRITICAL(&metrics_mux);
+	int marks_count = boot_count;
+	memcpy(marks, boot, sizeof(marks));
+	int sources_count = source_count;
+	portEXIT_CRITICAL(&metrics_mux);
+
+	/* Largest block against free heap shows the fragmentation */
+	size_t len = snprintf(buf, size, "{\"uptime_ms\":%d,\"heap_free\":%u,\"heap_min\":%u,\"heap_largest\":%u,\"boot\":{",
+		(int)(esp_timer_get_time() / 1000), esp_get_free_heap_size(), esp_get_minimum_free_heap_size(),
+		heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+
+	for (int i = 0; i < marks_count && len < size; i++) {
+		len += snprintf(buf + len, size - len, "%s\"%s\":%d", i ? "," : "", marks[i].name, marks[i].ms);
+	}
+	if (len < size) len += snprintf(buf + len, size - len, "}");
+
+	/* Sources are only ever added, the first sources_count are stable */
+	for (int i = 0; i < sources_count && len < size; i++) {
+		size_t n = snprintf(buf + len, size - len, ",\"%s\":", sources[i].name);
+		if (len + n >= size) return 0;
+		size_t v = sources[i].cb(buf + len + n, size - len - n);
+		if (v == 0) continue;
+		len += n + v;
+	}
+
+	if (len + 1 >= size) return 0;
+	buf[len++] = '}';
+	buf[len] = 0;
+	return len;
+}
@@ -0,0 +1,46 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+
+#include "esp_err.h"
+
+/* Writes one JSON value (number, object...), returns its length */
+typedef size_t (*metrics_source_cb_t)(char *buf, size_t size);
+
+/**
+ * @brief Record a boot milestone
+ *
+ * Stores the time since the application started, the bootloader runs
+ * before that. Only the first mark of each name counts, so marks can be
+ * placed in event handlers that run again later. Callable from any task.
+ *
+ * @param name string literal, the pointer is kept
+ */
+void metrics_boot_mark(const char *name);
+
+/**
+ * @brief Milliseconds since the application started at a milestone
+ *
+ * @return -1 if the milestone was not reached yet
+ */
+int metrics_boot_get(const char *name);
+
+/**
+ * @brief Add a member to the /metrics JSON
+ *
+ * @param name string literal, the pointer is kept
+ */
+esp_err_t metrics_register(const char *name, metrics_source_cb_t cb);
+
+/**
+ * @brief Build the /metrics JSON
+ *
+ *   {"uptime_ms":61234,"heap_free":81234,"heap_min":70123,"heap_largest":65536,
+ *    "boot":{"nvs":21,"config":22,...,"ready":2730},<sources>}
+ *
+ * @return length written, 0 if it does not fit
+ */
+size_t metrics_json(char *buf, size_t size);
+
+#endif
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+#include "esp_http_server.h"
+
+#include "ota_update.h"
+#include "ota_http.h"
+
+static const char *TAG = "OTA";
+
+/* Consecutive socket timeouts tolerated before the upload is suspended */
+#define OTA_RECV_RETRIES    3
+
+static esp_err_t send_status(httpd_req_t *req, const char *status)
+{
+	ota_status_t st;
+	ota_session_status(&st);
+
+	char sha[65] = "";
+	if (st.has_sha256) ota_sha256_to_hex(st.sha256, sha);
+
+	char resp[192];
+	int len = snprintf(resp, sizeof(resp), "{\"state\":\"%s\",\"size\":%u,\"offset\":%u,\"sha256\":\"%s\"}",
+		st.partial ? "partial" : "idle", st.size, st.offset, sha);
+
+	httpd_resp_set_status(req, status);
+	httpd_resp_set_type(req, "application/json");
+	return httpd_resp_send(req, resp, len);
+}
+
+esp_err_t ota_update_get_handler(httpd_req_t *req)
+{
+	return send_status(req, HTTPD_200);
+}
+
+static uint32_t header_u32(httpd_req_t *req, const char *field, uint32_t def)
+{
+	char value[16];
+	if (httpd_req_get_hdr_value_str(req, field, value, sizeof(value)) != ESP_OK) return def;
+	return strtoul(value, NULL, 10);
+}
+
+static esp_err_t receive_chunk(httpd_req_t *req)
+{
+	uint32_t size = header_u32(req, "X-OTA-Size", req->content_len);
+	uint32_t offset = header_u32(req, "X-OTA-Offset", 0);
+
+	uint8_t sha256[32];
+	bool has_sha256 = false;
+	char hex[72];
+	if (httpd_req_get_hdr_value_str(req, "X-OTA-SHA256", hex, sizeof(hex)) == ESP_OK) {
+		if (!ota_sha256_from_hex(hex, sha256)) {
+			httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid X-OTA-SHA256");
+			return ESP_FAIL;
+		}
+		has_sha256 = true;
+	}
+
+	if (req->content_len == 0 || offset + req->content_len > size) {
+		httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid OTA chunk");
+		return ESP_FAIL;
+	}
+
+	ESP_LOGI(TAG, "File Size: %ukB, chunk %ukB at %ukB", size / 1024, req->content_len / 1024, offset / 1024);
+
+	uint32_t expected;
+	esp_err_t err = ota_session_begin(size, has_sha256 ? sha256 : NULL, offset > 0, &expected);
+	if (err == ESP_ERR_NOT_FOUND || (err == ESP_OK && expected != offset)) {
+		ESP_LOGW(TAG, "Chunk at %u does not match the session", offset);
+		return send_status(req, "409 Conflict");
+	} else if (err != ESP_OK) {
+		ESP_LOGE(TAG, "Error With OTA Begin, Cancelling OTA");
+		httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to OTA Begin, Cancelling OTA");
+		return ESP_FAIL;
+	}
+
+	int remaining = req->content_len;
+	int timeouts = 0;
+
+	while (remaining > 0)
+	{
+		ESP_LOGD(TAG, "Remaining size: %dkB", remaining / 1024);
+
+		/* Fill a whole buffer so flash writes stay sector aligned, the
+		* previous buffer is written to flash in the meantime */
+		char *buf = ota_session_buffer();
+		size_t want = MIN(remaining, OTA_BUF_SIZE);
+		size_t fill = 0;
+
+		while (fill < want)
+		{
+			int received = httpd_req_recv(req, buf + fill, want - fill);
+			if (received == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts <= OTA_RECV_RETRIES) {
+				ESP_LOGW(TAG, "Socket Timeout remaining %d", remaining - (int)fill);
+				continue;
+			}
+			if (received <= 0) {
+				/* Keep what arrived so the sender can resume from there */
+				ota_session_submit(fill);
+				ota_session_suspend(NULL);
+				ESP_LOGE(TAG, "Reception interrupted, upload can be resumed");
+				return send_status(req, received == HTTPD_SOCK_ERR_TIMEOUT ? "408 Request Timeout" : HTTPD_500);
+			}
+			timeouts = 0;
+			fill += received;
+		}
+
+		if (ota_session_submit(fill) != ESP_OK) {
+			ota_session_abort();
+			ESP_LOGE(TAG, "Flash write error");
+			httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "OTA Flash Write Error");
+			return ESP_FAIL;
+		}
+
+		remaining -= fill;
+	}
+
+	if (offset + req->content_len < size) {
+		if (ota_session_suspend(NULL) != ESP_OK) {
+			ota_session_abort();
+			httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "OTA Flash Write Error");
+			return ESP_FAIL;
+		}
+		return send_status(req, HTTPD_200);
+	}
+
+	ESP_LOGI(TAG, "All recieved");
+
+	ota_result_t res;
+	err = ota_session_finish(&res);
+	if (err == ESP_ERR_INVALID_CRC) {
+		httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "OTA SHA-256 Mismatch");
+		return ESP_FAIL;
+	} else if (err != ESP_OK) {
+		ota_session_abort();
+		httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "OTA Image Error");
+		return ESP_FAIL;
+	}
+
+	ESP_LOGI(TAG, "Please Restart System...");
+
+	ota_sha256_to_hex(res.sha256, hex);
+	char resp[192];
+	int len = snprintf(resp, sizeof(resp), "{\"state\":\"done\",\"bytes\":%u,\"ms\":%u,\"kbps\":%u,\"sha256\":\"%s\"}",
+		res.bytes, res.ms, res.kbps, hex);
+	httpd_resp_set_type(req, "application/json");
+	httpd_resp_send(req, resp, len);
+	return ESP_OK;
+}
+
+/* Receive .bin file */
+esp_err_t ota_update_post_handler(httpd_req_t *req)
+{
+	/* A background download owns the session */
+	if (!ota_session_acquire(0)) {
+		httpd_resp_set_status(req, "503 Service Unavailable");
+		httpd_resp_sendstr(req, "Update in progress");
+		return ESP_OK;
+	}
+	esp_err_t err = receive_chunk(req);
+	ota_session_release();
+	return err;
+}
@@ -0,0 +1,24 @@
+#ifndef OTA_HTTP_H
+#define OTA_HTTP_H
+
+#include "esp_http_server.h"
+
+/**
+ * @brief POST /update, receive a .bin image
+ *
+ * A plain upload sends the whole image as the request body. Resumable
+ * uploads send it in chunks with these headers:
+ *   X-OTA-Size    total image size
+ *   X-OTA-Offset  offset of the first byte of this chunk
+ *   X-OTA-SHA256  expected digest of the whole image (hex), optional
+ * A chunk that does not start where the session expects gets a
+ * 409 Conflict with the session status.
+ */
+esp_err_t ota_update_post_handler(httpd_req_t *req);
+
+/**
+ * @brief GET /update, session status as JSON
+ */
+esp_err_t ota_update_get_handler(httpd_req_t *req);
+
+#endif
@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_http_client.h"
+
+#include "jsmn.h"
+
+#include "ota_update.h"
+#include "ota_pull.h"
+
+static const char *TAG = "OTA_PULL";
+
+#define OTA_MANIFEST_SIZE   512
+#define OTA_HTTP_TIMEOUT    10000   // ms
+#define OTA_IDLE_POLL       1000    // ms
+#define OTA_IDLE_HOLD       10000   // ms the device must stay idle before rebooting
+
+typedef struct {
+	int version;
+	char url[128];
+	uint32_t size;
+	bool has_sha256;
+	uint8_t sha256[32];
+	int rollout;
+} ota_manifest_t;
+
+static char manifest_url[128];
+static int running_version;
+static ota_pull_idle_cb_t is_idle;
+
+static int jsoneq(const char *json, jsmntok_t *tok, const char *s) {
+	if (tok->type == JSMN_STRING && (int)strlen(s) == tok->end - tok->start &&
+	strncmp(json + tok->start, s, tok->end - tok->start) == 0) {
+		return 0;
+	}
+	return -1;
+}
+
+static void json_str(const char *json, jsmntok_t *tok, char *dst, size_t size)
+{
+	size_t len = tok->end - tok->start;
+	if (len >= size) len = size - 1;
+	memcpy(dst, json + tok->start, len);
+	dst[len] = 0;
+}
+
+static long json_int(const char *json, jsmntok_t *tok)
+{
+	char s[16];
+	json_str(json, tok, s, sizeof(s));
+	return strtol(s, NULL, 10);
+}
+
+static esp_err_t manifest_parse(const char *json, ota_manifest_t *m)
+{
+	jsmn_parser p;
+	jsmntok_t t[16];
+
+	jsmn_init(&p);
+	int r = jsmn_parse(&p, json, strlen(json), t, sizeof(t) / sizeof(t[0]));
+	if (r < 1 || t[0].type != JSMN_OBJECT) return ESP_ERR_INVALID_ARG;
+
+	memset(m, 0, sizeof(*m));
+	m->rollout = 100;
+
+	for (int i = 1; i + 1 < r; i += 2) {
+		if (jsoneq(json, &t[i], "version") == 0) {
+			m->version = json_int(json, &t[i + 1]);
+		} else if (jsoneq(json, &t[i], "url") == 0) {
+			json_str(json, &t[i + 1], m->url, sizeof(m->url));
+		} else if (jsoneq(json, &t[i], "size") == 0) {
+			m->size = json_int(json, &t[i + 1]);
+		} else if (jsoneq(json, &t[i], "sha256") == 0) {
+			char hex[72];
+			json_str(json, &t[i + 1], hex, sizeof(hex));
+			m->has_sha256 = ota_sha256_from_hex(hex, m->sha256);
+			if (!m->has_sha256) return ESP_ERR_INVALID_ARG;
+		} else if (jsoneq(json, &t[i], "rollout") == 0) {
+			m->rollout = json_int(json, &t[i + 1]);
+		}
+	}
+
+	if (m->version <= 0 || m->url[0] == 0 || m->size == 0) return ESP_ERR_INVALID_ARG;
+	return ESP_OK;
+}
+
+static esp_err_t manifest_fetch(ota_manifest_t *m)
+{
+	esp_http_client_config_t config = {
+		.url = manifest_url,
+		.timeout_ms = OTA_HTTP_TIMEOUT,
+	};
+	esp_http_client_handle_t client = esp_http_client_init(&config);
+	if (!client) return ESP_ERR_NO_MEM;
+
+	char *json = calloc(1, OTA_MANIFEST_SIZE);
+	esp_err_t err = json ? esp_http_client_open(client, 0) : ESP_ERR_NO_MEM;
+	if (err == ESP_OK) {
+		esp_http_client_fetch_headers(client);
+		int status = esp_http_client_get_status_code(client);
+		int len = 0, n;
+		while (len < OTA_MANIFEST_SIZE - 1 && (n = esp_http_client_read(client, json + len, OTA_MANIFEST_SIZE - 1 - len)) > 0) {
+			len += n;
+		}
+		if (status != 200) {
+			ESP_LOGW(TAG, "Manifest HTTP status %d", status);
+			err = ESP_FAIL;
+		} else {
+			err = manifest_parse(json, m);
+			if (err != ESP_OK) ESP_LOGE(TAG, "Invalid manifest");
+		}
+	} else {
+		ESP_LOGW(TAG, "Manifest request failed (%s)", esp_err_to_name(err));
+	}
+
+	free(json);
+	esp_http_client_cleanup(client);
+	return err;
+}
+
+/* Stable bucket 0-99 so every device lands in the same rollout wave */
+static int rollout_bucket(void)
+{
+	uint8_t mac[6];
+	esp_efuse_mac_get_default(mac);
+
+	uint32_t h = 2166136261u;
+	for (int i = 0; i < sizeof(mac); i++) {
+		h ^= mac[i];
+		h *= 16777619u;
+	}
+	return h % 100;
+}
+
+/* Where the body of a 206 reply starts, from its Content-Range */
+typedef struct {
+	bool valid;
+	uint32_t start;
+	uint32_t total;             // 0 when the server sends "*"
+} content_range_t;
+
+static esp_err_t image_http_event(esp_http_client_event_t *evt)
+{
+	content_range_t *range = evt->user_data;
+	unsigned start, end, total;
+
+	if (evt->event_id != HTTP_EVENT_ON_HEADER || strcasecmp(evt->header_key, "Content-Range") != 0) {
+		return ESP_OK;
+	}
+	int n = sscanf(evt->header_value, "bytes %u-%u/%u", &start, &end, &total);
+	range->valid = n >= 2 && end >= start;
+	range->start = start;
+	range->total = n == 3 ? total : 0;
+	return ESP_OK;
+}
+
+static esp_err_t image_download(const ota_manifest_t *m)
+{
+	const uint8_t *sha256 = m->has_sha256 ? m->sha256 : NULL;
+	content_range_t range_reply = { 0 };
+	uint32_t offset;
+
+	esp_err_t err = ota_session_begin(m->size, sha256, true, &offset);
+	if (err == ESP_ERR_NOT_FOUND) err = ota_session_begin(m->size, sha256, false, &offset);
+	if (err != ESP_OK) return err;
+
+	esp_http_client_config_t config = {
+		.url = m->url,
+		.timeout_ms = OTA_HTTP_TIMEOUT,
+		.event_handler = image_http_event,
+		.user_data = &range_reply,
+	};
+	esp_http_client_handle_t client = esp_http_client_init(&config);
+	if (!client) {
+		ota_session_suspend(NULL);
+		return ESP_ERR_NO_MEM;
+	}
+
+	char range[32];
+	if (offset > 0) {
+		snprintf(range, sizeof(range), "bytes=%u-", offset);
+		esp_http_client_set_header(client, "Range", range);
+	}
+
+	err = esp_http_client_open(client, 0);
+	if (err == ESP_OK) {
+		esp_http_client_fetch_headers(client);
+		int status = esp_http_client_get_status_code(client);
+		if (offset > 0 && status == 206 && (!range_reply.valid || range_reply.start != offset ||
+			(range_reply.total != 0 && range_reply.total != m->size))) {
+			/* Appending that body would corrupt the image, ask for all of it */
+			ESP_LOGW(TAG, "Range reply does not start at %u, restarting download", offset);
+			esp_http_client_close(client);
+			esp_http_client_delete_header(client, "Range");
+			err = ota_session_begin(m->size, sha256, false, &offset);
+			if (err == ESP_OK) err = esp_http_client_open(client, 0);
+			if (err == ESP_OK) {
+				esp_http_client_fetch_headers(client);
+				status = esp_http_client_get_status_code(client);
+			}
+		}
+		if (err != ESP_OK) {
+			ESP_LOGE(TAG, "Image download restart failed");
+		} else if (offset > 0 && status == 200) {
+			/* The server ignored the range, start the image over */
+			ESP_LOGW(TAG, "Server does not support ranges, restarting download");
+			err = ota_session_begin(m->size, sha256, false, &offset);
+		} else if (offset == 0 ? status != 200 : status != 206) {
+			ESP_LOGE(TAG, "Image HTTP status %d", status);
+			err = ESP_FAIL;
+		}
+	}
+
+	while (err == ESP_OK && offset < m->size)
+	{
+		/* Fill whole buffers, the previous one is written to flash meanwhile */
+		char *buf = ota_session_buffer();
+		size_t want = m->size - offset < OTA_BUF_SIZE ? m->size - offset : OTA_BUF_SIZE;
+		size_t fill = 0;
+		int n = 0;
+
+		while (fill < want && (n = esp_http_client_read(client, buf + fill, want - fill)) > 0) {
+			fill += n;
+		}
+
+		err = ota_session_submit(fill);
+		offset += fill;
+		if (err == ESP_OK && fill < want) {
+			ESP_LOGW(TAG, "Download interrupted at %ukB", offset / 1024);
+			err = ESP_ERR_TIMEOUT;
+		}
+	}
+
+	esp_http_client_cleanup(client);
+
+	if (err == ESP_OK) {
+		ota_result_t res;
+		err = ota_session_finish(&res);
+		if (err == ESP_OK) ESP_LOGI(TAG, "Version %d downloaded, %ukB/s", m->version, res.kbps);
+	} else if (err == ESP_ERR_TIMEOUT || err == ESP_FAIL || err == ESP_ERR_HTTP_CONNECT) {
+		/* Network trouble, keep what arrived for the next check */
+		ota_session_suspend(NULL);
+	} else {
+		ota_session_abort();
+	}
+	return err;
+}
+
+/* Random spread around the interval, in seconds */
+static uint32_t jitter(void)
+{
+	uint32_t jitter = CONFIG_OTA_PULL_INTERVAL * CONFIG_OTA_PULL_JITTER / 100;
+	return jitter > 0 ? esp_random() % (2 * jitter + 1) : 0;
+}
+
+static TickType_t next_check(void)
+{
+	uint32_t jitter_max = CONFIG_OTA_PULL_INTERVAL * CONFIG_OTA_PULL_JITTER / 100;
+	return pdMS_TO_TICKS((CONFIG_OTA_PULL_INTERVAL - jitter_max + jitter()) * 1000ULL);
+}
+
+static void ota_pull_task(void *arg)
+{
+	int bucket = rollout_bucket();
+	ESP_LOGI(TAG, "Manifest %s, rollout bucket %d", manifest_url, bucket);
+
+	/* Devices powered up together must not hit the server at the same time */
+	vTaskDelay(pdMS_TO_TICKS(jitter() * 1000ULL));
+
+	while (1)
+	{
+		ota_manifest_t m;
+		if (manifest_fetch(&m) == ESP_OK) {
+			if (m.version <= running_version) {
+				ESP_LOGI(TAG, "Up to date, running v%d, manifest v%d", running_version, m.version);
+			} else if (bucket >= m.rollout) {
+				ESP_LOGI(TAG, "v%d available, not in rollout yet (%d%%)", m.version, m.rollout);
+			} else if (ota_session_acquire(0)) {
+				ESP_LOGI(TAG, "Downloading v%d from %s", m.version, m.url);
+				esp_err_t err = image_download(&m);
+				ota_session_release();
+				if (err == ESP_OK) break;
+				ESP_LOGE(TAG, "Update failed (%s)", esp_err_to_name(err));
+			} else {
+				ESP_LOGI(TAG, "Upload in progress, skipping check");
+			}
+		}
+		vTaskDelay(next_check());
+	}
+
+	/* Switch only when nothing is going on */
+	TickType_t idle_since = xTaskGetTickCount();
+	while (1)
+	{
+		if (!is_idle || is_idle()) {
+			if (xTaskGetTickCount() - idle_since >= pdMS_TO_TICKS(OTA_IDLE_HOLD)) break;
+		} else {
+			idle_since = xTaskGetTickCount();
+		}
+		vTaskDelay(pdMS_TO_TICKS(OTA_IDLE_POLL));
+	}
+
+	ESP_LOGW(TAG, "Rebooting into the new firmware");
+	esp_restart();
+}
+
+esp_err_t ota_pull_start(const ota_pull_config_t *cfg)
+{
+	if (!cfg->url || strlen(cfg->url) >= sizeof(manifest_url)) return ESP_ERR_INVALID_ARG;
+
+	strcpy(manifest_url, cfg->url);
+	running_version = cfg->version;
+	is_idle = cfg->is_idle;
+
+	if (xTaskCreate(ota_pull_task, "ota_pull_task", 4096, NULL, tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+		return ESP_ERR_NO_MEM;
+	}
+	return ESP_OK;
+}
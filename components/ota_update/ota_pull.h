@@ -0,0 +1,35 @@
+#ifndef OTA_PULL_H
+#define OTA_PULL_H
+
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+/* Returns true when the device may reboot into a new image */
+typedef bool (*ota_pull_idle_cb_t)(void);
+
+typedef struct {
+	const char *url;              // Manifest URL
+	int version;                  // Running firmware version
+	ota_pull_idle_cb_t is_idle;
+} ota_pull_config_t;
+
+/**
+ * @brief Start the background update task
+ *
+ * The manifest is checked every CONFIG_OTA_PULL_INTERVAL seconds, spread by
+ * CONFIG_OTA_PULL_JITTER percent. It is a JSON object:
+ *
+ *   {"version":10,"url":"http://host/voip_app.bin","size":1048576,
+ *    "sha256":"<hex>","rollout":25}
+ *
+ * An image with a higher version is downloaded into the inactive slot when
+ * the device falls in the rollout: every device hashes its MAC into a bucket
+ * 0-99 and takes part when its bucket is below rollout (default 100), so
+ * raising the value in the manifest releases the next wave. The download
+ * resumes where it stopped. Once verified, the device reboots the first
+ * time is_idle stays true for a few seconds.
+ */
+esp_err_t ota_pull_start(const ota_pull_config_t *cfg);
+
+#endif
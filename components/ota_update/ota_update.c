@@ -0,0 +1,453 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#include "nvs.h"
+#include "mbedtls/sha256.h"
+
+#include "ota_update.h"
+
+static const char *TAG = "OTA";
+
+#define OTA_BUF_COUNT       2
+#define OTA_PERSIST_EVERY   (64 * 1024)
+#define OTA_NVS_NAMESPACE   "ota"
+#define OTA_NVS_KEY         "session"
+
+#define OTA_CMD_FLUSH       -1
+#define OTA_CMD_DIGEST      -2
+#define OTA_CMD_EXIT        -3
+
+#define ALIGN_DOWN(x, a)    ((x) & ~((a) - 1))
+#define ALIGN_UP(x, a)      (((x) + (a) - 1) & ~((a) - 1))
+
+/* Session state persisted in NVS so an upload survives a reboot */
+typedef struct {
+	uint32_t part_addr;
+	uint32_t size;
+	uint32_t offset;
+	uint8_t has_sha256;
+	uint8_t sha256[32];
+} ota_record_t;
+
+typedef struct {
+	int idx;      // Buffer index or OTA_CMD_*
+	size_t len;
+} ota_chunk_t;
+
+static struct {
+	bool active;
+	const esp_partition_t *part;
+	ota_record_t rec;
+	uint32_t erased_to;
+	uint32_t persisted;
+	mbedtls_sha256_context sha;
+	uint8_t digest[32];
+	char *buf[OTA_BUF_COUNT];
+	int cur;
+	QueueHandle_t free_q, full_q;
+	SemaphoreHandle_t flushed;
+	TaskHandle_t writer;
+	volatile esp_err_t err;
+	int64_t run_start;    // Start of the current request
+	int64_t elapsed_us;   // Time spent in previous requests
+	int64_t busy_us;      // Time spent writing flash
+	uint32_t bytes;       // Bytes received in this boot
+} s_ota;
+
+static SemaphoreHandle_t s_owner;
+static portMUX_TYPE s_owner_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static esp_err_t record_load(ota_record_t *rec)
+{
+	nvs_handle nvs;
+	esp_err_t err = nvs_open(OTA_NVS_NAMESPACE, NVS_READONLY, &nvs);
+	if (err != ESP_OK) return err;
+	size_t len = sizeof(*rec);
+	err = nvs_get_blob(nvs, OTA_NVS_KEY, rec, &len);
+	nvs_close(nvs);
+	if (err == ESP_OK && len != sizeof(*rec)) err = ESP_ERR_INVALID_SIZE;
+	return err;
+}
+
+static esp_err_t record_save(const ota_record_t *rec)
+{
+	nvs_handle nvs;
+	esp_err_t err = nvs_open(OTA_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+	if (err != ESP_OK) return err;
+	err = nvs_set_blob(nvs, OTA_NVS_KEY, rec, sizeof(*rec));
+	if (err == ESP_OK) err = nvs_commit(nvs);
+	nvs_close(nvs);
+	return err;
+}
+
+static void record_clear(void)
+{
+	nvs_handle nvs;
+	if (nvs_open(OTA_NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+		nvs_erase_key(nvs, OTA_NVS_KEY);
+		nvs_commit(nvs);
+		nvs_close(nvs);
+	}
+}
+
+static esp_err_t flash_write(const char *data, size_t len)
+{
+	uint32_t end = s_ota.rec.offset + len;
+	if (end > s_ota.rec.size) return ESP_ERR_INVALID_SIZE;
+
+	/* Erase sectors as they are reached instead of the whole partition up front */
+	if (end > s_ota.erased_to) {
+		uint32_t erase_end = ALIGN_UP(end, SPI_FLASH_SEC_SIZE);
+		esp_err_t err = esp_partition_erase_range(s_ota.part, s_ota.erased_to, erase_end - s_ota.erased_to);
+		if (err != ESP_OK) return err;
+		s_ota.erased_to = erase_end;
+	}
+
+	esp_err_t err = esp_partition_write(s_ota.part, s_ota.rec.offset, data, len);
+	if (err != ESP_OK) return err;
+
+	mbedtls_sha256_update_ret(&s_ota.sha, (const unsigned char *)data, len);
+	s_ota.rec.offset = end;
+
+	if (s_ota.rec.offset - s_ota.persisted >= OTA_PERSIST_EVERY) {
+		if (record_save(&s_ota.rec) == ESP_OK) s_ota.persisted = s_ota.rec.offset;
+	}
+	return ESP_OK;
+}
+
+/* Hash what a previous boot already wrote, the digest state is not persisted */
+static esp_err_t rehash(uint32_t len)
+{
+	char *buf = s_ota.buf[0];
+	for (uint32_t pos = 0; pos < len; pos += OTA_BUF_SIZE) {
+		size_t n = len - pos < OTA_BUF_SIZE ? len - pos : OTA_BUF_SIZE;
+		esp_err_t err = esp_partition_read(s_ota.part, pos, buf, n);
+		if (err != ESP_OK) return err;
+		mbedtls_sha256_update_ret(&s_ota.sha, (const unsigned char *)buf, n);
+	}
+	return ESP_OK;
+}
+
+/*
+ * The digest is only touched from this task: the hardware SHA engine stays
+ * locked by the task that started it until the digest is finished.
+ */
+static void ota_writer_task(void *arg)
+{
+	ota_chunk_t chunk;
+
+	mbedtls_sha256_init(&s_ota.sha);
+	mbedtls_sha256_starts_ret(&s_ota.sha, 0);
+	if (s_ota.rec.offset > 0) s_ota.err = rehash(s_ota.rec.offset);
+	xSemaphoreGive(s_ota.flushed);
+
+	while (1)
+	{
+		if (xQueueReceive(s_ota.full_q, &chunk, portMAX_DELAY) != pdTRUE) continue;
+
+		switch (chunk.idx) {
+			case OTA_CMD_FLUSH:
+				xSemaphoreGive(s_ota.flushed);
+				break;
+			case OTA_CMD_DIGEST:
+				mbedtls_sha256_finish_ret(&s_ota.sha, s_ota.digest);
+				xSemaphoreGive(s_ota.flushed);
+				break;
+			case OTA_CMD_EXIT:
+				mbedtls_sha256_free(&s_ota.sha);
+				xSemaphoreGive(s_ota.flushed);
+				vTaskDelete(NULL);
+				return;
+			default:
+				if (s_ota.err == ESP_OK) {
+					int64_t t = esp_timer_get_time();
+					esp_err_t err = flash_write(s_ota.buf[chunk.idx], chunk.len);
+					s_ota.busy_us += esp_timer_get_time() - t;
+					if (err != ESP_OK) {
+						ESP_LOGE(TAG, "Flash write failed at 0x%X (%s)", s_ota.rec.offset, esp_err_to_name(err));
+						s_ota.err = err;
+					}
+				}
+				xQueueSend(s_ota.free_q, &chunk.idx, portMAX_DELAY);
+				break;
+		}
+	}
+}
+
+static esp_err_t command(int cmd)
+{
+	ota_chunk_t chunk = { .idx = cmd, .len = 0 };
+	xQueueSend(s_ota.full_q, &chunk, portMAX_DELAY);
+	xSemaphoreTake(s_ota.flushed, portMAX_DELAY);
+	return s_ota.err;
+}
+
+static void teardown(void)
+{
+	if (s_ota.writer) command(OTA_CMD_EXIT);
+	if (s_ota.free_q) vQueueDelete(s_ota.free_q);
+	if (s_ota.full_q) vQueueDelete(s_ota.full_q);
+	if (s_ota.flushed) vSemaphoreDelete(s_ota.flushed);
+	for (int i = 0; i < OTA_BUF_COUNT; i++) free(s_ota.buf[i]);
+	memset(&s_ota, 0, sizeof(s_ota));
+}
+
+static esp_err_t setup(void)
+{
+	s_ota.free_q = xQueueCreate(OTA_BUF_COUNT, sizeof(int));
+	s_ota.full_q = xQueueCreate(OTA_BUF_COUNT + 1, sizeof(ota_chunk_t));
+	s_ota.flushed = xSemaphoreCreateBinary();
+	if (!s_ota.free_q || !s_ota.full_q || !s_ota.flushed) return ESP_ERR_NO_MEM;
+
+	for (int i = 0; i < OTA_BUF_COUNT; i++) {
+		s_ota.buf[i] = malloc(OTA_BUF_SIZE);
+		if (!s_ota.buf[i]) return ESP_ERR_NO_MEM;
+		xQueueSend(s_ota.free_q, &i, 0);
+	}
+	s_ota.cur = -1;
+
+	if (xTaskCreate(ota_writer_task, "ota_writer", 3072, NULL, tskIDLE_PRIORITY + 5, &s_ota.writer) != pdPASS) {
+		s_ota.writer = NULL;
+		return ESP_ERR_NO_MEM;
+	}
+
+	/* Wait for the writer to rebuild the digest of a resumed image */
+	xSemaphoreTake(s_ota.flushed, portMAX_DELAY);
+	return s_ota.err;
+}
+
+static bool same_image(const ota_record_t *rec, uint32_t size, const uint8_t *sha256)
+{
+	if (rec->size != size) return false;
+	if (rec->has_sha256 != (sha256 != NULL)) return false;
+	return !sha256 || memcmp(rec->sha256, sha256, 32) == 0;
+}
+
+bool ota_session_acquire(TickType_t wait)
+{
+	if (!s_owner) {
+		/* First use, the HTTP server and the pull task may race here */
+		SemaphoreHandle_t m = xSemaphoreCreateMutex();
+		portENTER_CRITICAL(&s_owner_mux);
+		if (!s_owner) {
+			s_owner = m;
+			m = NULL;
+		}
+		portEXIT_CRITICAL(&s_owner_mux);
+		if (m) vSemaphoreDelete(m);
+	}
+	return s_owner && xSemaphoreTake(s_owner, wait) == pdTRUE;
+}
+
+void ota_session_release(void)
+{
+	xSemaphoreGive(s_owner);
+}
+
+esp_err_t ota_session_begin(uint32_t image_size, const uint8_t *sha256, bool resume, uint32_t *offset)
+{
+	const esp_partition_t *part = esp_ota_get_next_update_partition(NULL);
+	if (!part) return ESP_ERR_NOT_FOUND;
+	if (image_size == 0 || image_size > part->size) return ESP_ERR_INVALID_SIZE;
+
+	if (resume && s_ota.active && s_ota.part == part && same_image(&s_ota.rec, image_size, sha256)) {
+		*offset = s_ota.rec.offset;
+		s_ota.run_start = esp_timer_get_time();
+		return ESP_OK;
+	}
+
+	if (s_ota.active) teardown();
+
+	ota_record_t rec;
+	bool restore = resume && record_load(&rec) == ESP_OK && rec.part_addr == part->address &&
+		same_image(&rec, image_size, sha256);
+	if (resume && !restore) return ESP_ERR_NOT_FOUND;
+	if (!restore) {
+		record_clear();
+		memset(&rec, 0, sizeof(rec));
+		rec.part_addr = part->address;
+		rec.size = image_size;
+		if (sha256) {
+			rec.has_sha256 = 1;
+			memcpy(rec.sha256, sha256, 32);
+		}
+	}
+
+	/* Bytes after the last persisted offset may be half written, redo the whole sector */
+	rec.offset = ALIGN_DOWN(rec.offset, SPI_FLASH_SEC_SIZE);
+
+	s_ota.part = part;
+	s_ota.rec = rec;
+	s_ota.erased_to = rec.offset;
+	s_ota.persisted = rec.offset;
+
+	esp_err_t err = setup();
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "Failed to open update session (%s)", esp_err_to_name(err));
+		teardown();
+		return err;
+	}
+
+	if (rec.offset > 0) {
+		ESP_LOGI(TAG, "Resuming update at %ukB of %ukB", rec.offset / 1024, image_size / 1024);
+	} else {
+		ESP_LOGI(TAG, "Writing %ukB to partition %s at offset 0x%X", image_size / 1024, part->label, part->address);
+	}
+	s_ota.run_start = esp_timer_get_time();
+	s_ota.active = true;
+
+	*offset = rec.offset;
+	return ESP_OK;
+}
+
+char *ota_session_buffer(void)
+{
+	if (!s_ota.active) return NULL;
+	xQueueReceive(s_ota.free_q, &s_ota.cur, portMAX_DELAY);
+	return s_ota.buf[s_ota.cur];
+}
+
+esp_err_t ota_session_submit(size_t len)
+{
+	if (!s_ota.active || s_ota.cur < 0) return ESP_ERR_INVALID_STATE;
+
+	ota_chunk_t chunk = { .idx = s_ota.cur, .len = len };
+	s_ota.cur = -1;
+	if (len == 0 || s_ota.err != ESP_OK) {
+		xQueueSend(s_ota.free_q, &chunk.idx, portMAX_DELAY);
+		return s_ota.err;
+	}
+	xQueueSend(s_ota.full_q, &chunk, portMAX_DELAY);
+	s_ota.bytes += len;
+	return ESP_OK;
+}
+
+esp_err_t ota_session_suspend(uint32_t *offset)
+{
+	if (!s_ota.active) return ESP_ERR_INVALID_STATE;
+	if (s_ota.cur >= 0) ota_session_submit(0);
+
+	esp_err_t err = command(OTA_CMD_FLUSH);
+	if (err == ESP_OK && record_save(&s_ota.rec) == ESP_OK) s_ota.persisted = s_ota.rec.offset;
+	s_ota.elapsed_us += esp_timer_get_time() - s_ota.run_start;
+
+	ESP_LOGI(TAG, "Update suspended at %ukB of %ukB", s_ota.rec.offset / 1024, s_ota.rec.size / 1024);
+	if (offset) *offset = s_ota.rec.offset;
+	return err;
+}
+
+esp_err_t ota_session_finish(ota_result_t *result)
+{
+	if (!s_ota.active) return ESP_ERR_INVALID_STATE;
+	if (s_ota.cur >= 0) ota_session_submit(0);
+
+	esp_err_t err = command(OTA_CMD_FLUSH);
+	if (err != ESP_OK) return err;
+
+	if (s_ota.rec.offset != s_ota.rec.size) {
+		ESP_LOGE(TAG, "Image incomplete, %u of %u bytes", s_ota.rec.offset, s_ota.rec.size);
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	ota_result_t res;
+	command(OTA_CMD_DIGEST);
+	memcpy(res.sha256, s_ota.digest, 32);
+
+	int64_t us = s_ota.elapsed_us + esp_timer_get_time() - s_ota.run_start;
+	res.bytes = s_ota.bytes;
+	res.ms = us / 1000;
+	res.kbps = us > 0 ? (uint32_t)((uint64_t)s_ota.bytes * 1000000 / 1024 / us) : 0;
+	ESP_LOGI(TAG, "Received %ukB in %ums (%ukB/s), flash busy %ums",
+		res.bytes / 1024, res.ms, res.kbps, (uint32_t)(s_ota.busy_us / 1000));
+
+	const esp_partition_t *part = s_ota.part;
+	bool sha_ok = !s_ota.rec.has_sha256 || memcmp(res.sha256, s_ota.rec.sha256, 32) == 0;
+
+	record_clear();
+	teardown();
+
+	if (!sha_ok) {
+		ESP_LOGE(TAG, "SHA-256 mismatch, image discarded");
+		return ESP_ERR_INVALID_CRC;
+	}
+
+	/* Validates the image before marking it bootable */
+	err = esp_ota_set_boot_partition(part);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "Image validation failed (%s)", esp_err_to_name(err));
+		return err;
+	}
+
+	ESP_LOGI(TAG, "Next boot partition %s at offset 0x%X", part->label, part->address);
+	if (result) *result = res;
+	return ESP_OK;
+}
+
+void ota_session_abort(void)
+{
+	if (s_ota.active) {
+		if (s_ota.cur >= 0) ota_session_submit(0);
+		command(OTA_CMD_FLUSH);
+		teardown();
+	}
+	record_clear();
+}
+
+esp_err_t ota_session_status(ota_status_t *status)
+{
+	memset(status, 0, sizeof(*status));
+
+	ota_record_t rec;
+	if (s_ota.active) {
+		rec = s_ota.rec;
+		status->active = true;
+	} else if (record_load(&rec) == ESP_OK) {
+		rec.offset = ALIGN_DOWN(rec.offset, SPI_FLASH_SEC_SIZE);
+	} else {
+		return ESP_OK;
+	}
+
+	status->partial = rec.offset < rec.size;
+	status->size = rec.size;
+	status->offset = rec.offset;
+	status->has_sha256 = rec.has_sha256;
+	memcpy(status->sha256, rec.sha256, 32);
+	return ESP_OK;
+}
+
+static int hex_nibble(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+bool ota_sha256_from_hex(const char *hex, uint8_t sha256[32])
+{
+	if (strlen(hex) != 64) return false;
+	for (int i = 0; i < 32; i++) {
+		int hi = hex_nibble(hex[2 * i]);
+		int lo = hex_nibble(hex[2 * i + 1]);
+		if (hi < 0 || lo < 0) return false;
+		sha256[i] = (hi << 4) | lo;
+	}
+	return true;
+}
+
+void ota_sha256_to_hex(const uint8_t sha256[32], char hex[65])
+{
+	for (int i = 0; i < 32; i++) sprintf(hex + 2 * i, "%02x", sha256[i]);
+	hex[64] = 0;
+}
@@ -0,0 +1,93 @@
+#ifndef OTA_UPDATE_H
+#define OTA_UPDATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "esp_err.h"
+
+/* Receive buffer size, a multiple of the flash sector size */
+#define OTA_BUF_SIZE        (2 * 4096)
+
+typedef struct {
+	bool active;          // A session is open in this boot
+	bool partial;         // A session can be resumed
+	uint32_t size;        // Total image size
+	uint32_t offset;      // Bytes written and verified so far
+	bool has_sha256;      // sha256 holds the expected image digest
+	uint8_t sha256[32];
+} ota_status_t;
+
+typedef struct {
+	uint32_t bytes;       // Bytes received in this boot
+	uint32_t ms;          // Time spent receiving and writing them
+	uint32_t kbps;        // Measured throughput in KB/s
+	uint8_t sha256[32];   // Digest of the whole image
+} ota_result_t;
+
+/**
+ * @brief Take ownership of the update session
+ *
+ * Uploads and background downloads must not interleave their chunks, each
+ * one holds the session from begin to suspend, finish or abort.
+ */
+bool ota_session_acquire(TickType_t wait);
+void ota_session_release(void);
+
+/**
+ * @brief Open an update session on the inactive OTA partition
+ *
+ * A fresh session drops any previous one. When resuming, the session of the
+ * same image (size and digest) is picked up, from RAM if it is still open or
+ * from NVS after a reboot, and offset returns the first byte the sender must
+ * transmit. Offsets restored from NVS are aligned to a flash sector.
+ *
+ * @param image_size total size of the image
+ * @param sha256 expected image digest (32 bytes) or NULL to skip verification
+ * @param resume continue an interrupted session instead of starting over
+ * @param offset first byte expected by the session
+ *
+ * @return ESP_ERR_NOT_FOUND if there is nothing to resume
+ */
+esp_err_t ota_session_begin(uint32_t image_size, const uint8_t *sha256, bool resume, uint32_t *offset);
+
+/**
+ * @brief Get a free receive buffer of OTA_BUF_SIZE bytes
+ *
+ * Blocks while both buffers are being written to flash, so network reads
+ * overlap flash writes.
+ */
+char *ota_session_buffer(void);
+
+/**
+ * @brief Queue the last buffer returned by ota_session_buffer for writing
+ */
+esp_err_t ota_session_submit(size_t len);
+
+/**
+ * @brief Wait for queued buffers and persist the offset, keeping the session
+ *
+ * Used when a chunk of a resumable upload completes or the transfer breaks.
+ */
+esp_err_t ota_session_suspend(uint32_t *offset);
+
+/**
+ * @brief Verify the image digest and select the partition for next boot
+ */
+esp_err_t ota_session_finish(ota_result_t *result);
+
+/**
+ * @brief Drop the session and its persisted state
+ */
+void ota_session_abort(void);
+
+esp_err_t ota_session_status(ota_status_t *status);
+
+/* Hex helpers for digests carried in headers and manifests */
+bool ota_sha256_from_hex(const char *hex, uint8_t sha256[32]);
+void ota_sha256_to_hex(const uint8_t sha256[32], char hex[65]);
+
+#endif
@@ -92,4 +92,16 @@
     .uninstall_drv = true,                                                      \
 }
 
+/*
+ *        I2S DMA profiles, see dma_profile.h. Each pipeline picks one
+ *        instead of the dma_buf_count and dma_buf_len above.
+ *
+ *        - call: low latency, 4 x 5 ms
+ *        - paging: rides out WiFi stalls, 6 x 20 ms
+ *        - tone: latency does not matter, 3 x 40 ms
+ */
+#define I2S_DMA_PROFILE_CALL()      { .name = "call", .buf_count = 4, .buf_ms = 5 }
+#define I2S_DMA_PROFILE_PAGING()    { .name = "paging", .buf_count = 6, .buf_ms = 20 }
+#define I2S_DMA_PROFILE_TONE()      { .name = "tone", .buf_count = 3, .buf_ms = 40 }
+
 #endif
@@ -13,6 +13,8 @@ static const char *TAG = "APP";
 
 #include "caller.h"
 #include "client.h"
+#include "config.h"
+#include "stream_server.h"
 
 // pins
 #define KEYBOARD_INT_GPIO 34
@@ -67,6 +69,12 @@ struct m_event
 
 QueueHandle_t xMainLoopQueue, xIOLoopQueue;
 
+/* Names for the /events stream, indexed by the data values above */
+static const char *io_names[] = {
+	"bed1", "call1", "bed2", "call2", "panic", "bath", "dintel_red", "dintel_green",
+	"nurse", "resolve", "black", "gray", "led_on", "led_c1", "led_c2", "led_b",
+};
+
 static esp_err_t i2c_master_driver_initialize(void)
 {
 	i2c_config_t conf = {
@@ -159,6 +167,8 @@ static void notify_key(uint8_t key, uint8_t state)
 	io_event.type = state;
 	io_event.data = key;
 
+	stream_event_post("key", "{\"id\":\"%s\",\"down\":%s}", io_names[key], state == KEY_PRESSED ? "true" : "false");
+
 	if (xMainLoopQueue != NULL)
 	{
 		if (xQueueSend(xMainLoopQueue, &io_event, 0 ) != pdPASS)
@@ -198,8 +208,12 @@ void io_task(void *arg)
 	i2c_driver_install(I2C_NUM_0, I2C_MODE_MASTER, I2C_MASTER_RX_BUF_DISABLE, I2C_MASTER_TX_BUF_DISABLE, 0);
 	i2c_master_driver_initialize();
 
+	/* Own copy of the config, refreshed when a new one is saved */
+	static app_config_t cfg;
+	uint32_t cfg_gen = config_snapshot(&cfg);
+
 	uint8_t board_in, board_in_old;
-	if (caller_config.invert_panic_button)
+	if (cfg.invert_panic_button)
 	{
 		board_in = 0xEF;
 		board_in_old = 0xEF;
@@ -246,14 +260,18 @@ void io_task(void *arg)
 
 	i2c_read_temp();
 	ESP_LOGI(TAG, "Temperature %.1f", temp);
+	stream_state_set("temp", "%.1f", temp);
 	unsigned long last_temp_update = millis();
 
 	while(1)
 	{
+		if (config_generation() != cfg_gen) cfg_gen = config_snapshot(&cfg);
+
 		if (millis() - last_temp_update > temp_period)
 		{
 			last_temp_update = millis();
 			i2c_read_temp();
+			stream_state_set("temp", "%.1f", temp);
 		}
 
 		if (!gpio_get_level(BOARD_INT_GPIO))
@@ -276,7 +294,7 @@ void io_task(void *arg)
 				if (change & 0b00000100) notify_key(BD2_KEY, KEY_PRESSED);
 				if (change & 0b00001000) notify_key(CL2_KEY, KEY_PRESSED);
 				if (change & 0b00010000){
-					if (caller_config.invert_panic_button){
+					if (cfg.invert_panic_button){
 						notify_key(PAN_KEY, KEY_RELEASED);
 					} else {
 						notify_key(PAN_KEY, KEY_PRESSED);
@@ -295,7 +313,7 @@ void io_task(void *arg)
 				if (change & 0b00000100) notify_key(BD2_KEY, KEY_RELEASED);
 				if (change & 0b00001000) notify_key(CL2_KEY, KEY_RELEASED);
 				if (change & 0b00010000){
-					if (caller_config.invert_panic_button){
+					if (cfg.invert_panic_button){
 						notify_key(PAN_KEY, KEY_PRESSED);
 					} else {
 						notify_key(PAN_KEY, KEY_RELEASED);
@@ -427,6 +445,13 @@ typedef enum{
 	OFF             // Apagado
 } led_mode_t;
 
+static const char *led_mode_names[] = {"on", "blink", "blink_fast", "off"};
+
+static void led_mode_publish(uint8_t led, led_mode_t mode)
+{
+	stream_state_set(io_names[led], "\"%s\"", led_mode_names[mode]);
+}
+
 led_mode_t ON_LED_mode;
 led_mode_t C1_LED_mode;
 led_mode_t C2_LED_mode;
@@ -475,6 +500,7 @@ void led_process(unsigned long current_time)
 void ON_LED_set_mode(led_mode_t mode)
 {
 	ON_LED_mode = mode;
+	led_mode_publish(ON_LED, mode);
 	if (mode == ON) led_set_level(ON_LED, true);
 	if (mode == OFF) led_set_level(ON_LED, false);
 }
@@ -482,6 +508,7 @@ void ON_LED_set_mode(led_mode_t mode)
 void C1_LED_set_mode(led_mode_t mode)
 {
 	C1_LED_mode = mode;
+	led_mode_publish(C1_LED, mode);
 	if (mode == ON) led_set_level(C1_LED, true);
 	if (mode == OFF) led_set_level(C1_LED, false);
 }
@@ -489,6 +516,7 @@ void C1_LED_set_mode(led_mode_t mode)
 void C2_LED_set_mode(led_mode_t mode)
 {
 	C2_LED_mode = mode;
+	led_mode_publish(C2_LED, mode);
 	if (mode == ON) led_set_level(C2_LED, true);
 	if (mode == OFF) led_set_level(C2_LED, false);
 }
@@ -496,6 +524,7 @@ void C2_LED_set_mode(led_mode_t mode)
 void B_LED_set_mode(led_mode_t mode)
 {
 	B_LED_mode = mode;
+	led_mode_publish(B_LED, mode);
 	if (mode == ON) led_set_level(B_LED, true);
 	if (mode == OFF) led_set_level(B_LED, false);
 }
@@ -503,6 +532,7 @@ void B_LED_set_mode(led_mode_t mode)
 void DINTEL_RED_set_mode(led_mode_t mode)
 {
 	DINTEL_RED_mode = mode;
+	led_mode_publish(DINTEL_RED, mode);
 	if (mode == ON) led_set_level(DINTEL_RED, true);
 	if (mode == OFF) led_set_level(DINTEL_RED, false);
 	if (mode == BLINK)
@@ -515,12 +545,30 @@ void DINTEL_RED_set_mode(led_mode_t mode)
 
 void DINTEL_GREEN_set_mode(led_mode_t mode){
 	DINTEL_GREEN_mode = mode;
+	led_mode_publish(DINTEL_GREEN, mode);
 	if (mode == ON) led_set_level(DINTEL_GREEN, true);
 	if (mode == OFF) led_set_level(DINTEL_GREEN, false);
 }
 
 extern sip_handle_t sip;
 
+static volatile bool caller_busy = true;
+
+static const char *sip_state_name(sip_state_t state)
+{
+	if (state & SIP_STATE_ON_CALL) return "on_call";
+	if (state & SIP_STATE_RINGING) return "ringing";
+	if (state & (SIP_STATE_CALLING | SIP_STATE_SESS_PROGRESS)) return "calling";
+	if (state & SIP_STATE_REGISTERED) return "registered";
+	return "unregistered";
+}
+
+/* No pending call, ticket, SIP session or configuration in progress */
+bool caller_is_idle(void)
+{
+	return !caller_busy && !http_post_pending();
+}
+
 void main_loop_task(void *arg)
 {
 	xMainLoopQueue = xQueueCreate(16, sizeof(struct m_event));
@@ -538,7 +586,14 @@ void main_loop_task(void *arg)
 	bool priority_activated = false;
 	bool enfermera_present = false;
 
-	if (caller_config.sip_enable)
+	/* Own copy of the config, refreshed when a new one is saved */
+	static app_config_t cfg;
+	uint32_t cfg_gen = config_snapshot(&cfg);
+
+	/* The SIP service is only set up at boot */
+	const bool sip_enable = cfg.sip_enable;
+
+	if (sip_enable)
 	{
 		ON_LED_set_mode(BLINK_FAST);
 	} else {
@@ -551,12 +606,21 @@ void main_loop_task(void *arg)
 	DINTEL_RED_mode = OFF;
 	DINTEL_GREEN_mode = OFF;
 
+	led_mode_publish(C1_LED, OFF);
+	led_mode_publish(C2_LED, OFF);
+	led_mode_publish(B_LED, OFF);
+	led_mode_publish(DINTEL_RED, OFF);
+	led_mode_publish(DINTEL_GREEN, OFF);
+	stream_state_set("sip", "\"%s\"", sip_enable ? sip_state_name(SIP_STATE_NONE) : "disabled");
+
 	unsigned long config_timer_start = millis();
 	bool config_timer = false;
 	bool wifi_ap_on = false;
 
 	while(1)
 	{
+		if (config_generation() != cfg_gen) cfg_gen = config_snapshot(&cfg);
+
 		led_process(millis());
 
 		if (config_timer && !wifi_ap_on)
@@ -622,7 +686,7 @@ void main_loop_task(void *arg)
 
 							priority_activated = true;
 
-							if (sip_state & SIP_STATE_REGISTERED) esp_sip_uac_invite(sip, caller_config.sip_call);
+							if (sip_state & SIP_STATE_REGISTERED) esp_sip_uac_invite(sip, cfg.sip_call);
 
 							http_post(PRIORITY);
 
@@ -641,7 +705,7 @@ void main_loop_task(void *arg)
 
 							bath_activated = true;
 
-							if (sip_state & SIP_STATE_REGISTERED) esp_sip_uac_invite(sip, caller_config.sip_call);
+							if (sip_state & SIP_STATE_REGISTERED) esp_sip_uac_invite(sip, cfg.sip_call);
 
 							http_post(BATH);
 
@@ -660,7 +724,7 @@ void main_loop_task(void *arg)
 
 							bed1_activated = true;
 
-							if (sip_state & SIP_STATE_REGISTERED) esp_sip_uac_invite(sip, caller_config.sip_call);
+							if (sip_state & SIP_STATE_REGISTERED) esp_sip_uac_invite(sip, cfg.sip_call);
 
 							http_post(BED1);
 
@@ -679,7 +743,7 @@ void main_loop_task(void *arg)
 
 							bed2_activated = true;
 
-							if (sip_state & SIP_STATE_REGISTERED) esp_sip_uac_invite(sip, caller_config.sip_call);
+							if (sip_state & SIP_STATE_REGISTERED) esp_sip_uac_invite(sip, cfg.sip_call);
 
 							http_post(BED2);
 
@@ -699,7 +763,7 @@ void main_loop_task(void *arg)
 							if (sip_state & SIP_STATE_REGISTERED)
 							{
 								ESP_LOGI(TAG, "SIP Invite");
-								esp_sip_uac_invite(sip, caller_config.sip_call);
+								esp_sip_uac_invite(sip, cfg.sip_call);
 							}
 
 							if (sip_state & SIP_STATE_ON_CALL)
@@ -776,10 +840,12 @@ void main_loop_task(void *arg)
 			ESP_LOGE(TAG, "MainLoopQueue not created.");
 		}
 
-		if (caller_config.sip_enable)
+		if (sip_enable)
 		{
 			if (sip_state != sip_state_old)
 			{
+				stream_state_set("sip", "\"%s\"", sip_state_name(sip_state));
+
 				if (sip_state < SIP_STATE_REGISTERED)
 				{
 					ON_LED_set_mode(BLINK_FAST);
@@ -801,5 +867,8 @@ void main_loop_task(void *arg)
 		}
 
 		sip_state_old = sip_state;
+
+		caller_busy = bed1_activated || bed2_activated || bath_activated || priority_activated ||
+			enfermera_present || config_timer || (sip_state > SIP_STATE_REGISTERED);
 	}
 }
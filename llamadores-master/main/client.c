@@ -9,6 +9,8 @@
 #include "esp_http_client.h"
 
 #include "client.h"
+#include "config.h"
+#include "stream_server.h"
 
 #define MAX_HTTP_RECV_BUFFER 512
 
@@ -20,6 +22,10 @@ char path[128];
 char post_data[128];
 
 ticket_t ticket;
+app_config_t client_config;
+static volatile bool ticket_sending = false;
+
+static const char *ticket_names[] = {"bed1", "bed2", "bath", "priority", "serve", "resolve"};
 
 esp_err_t _http_event_handler(esp_http_client_event_t *evt)
 {
@@ -46,6 +52,12 @@ void http_post(ticket_t new_ticket)
 	}
 }
 
+bool http_post_pending(void)
+{
+	if (ticket_sending) return true;
+	return xHTTPClientQueue != NULL && uxQueueMessagesWaiting(xHTTPClientQueue) > 0;
+}
+
 void client_task(void *arg)
 {
 	xHTTPClientQueue = xQueueCreate(16, sizeof(ticket_t));
@@ -56,13 +68,18 @@ void client_task(void *arg)
 		if (xQueueReceive(xHTTPClientQueue, &ticket, 100))
 		{
 			ESP_LOGI(TAG, "New ticket");
+			ticket_sending = true;
+
+			/* Pick up the SmartContent settings of the last saved config */
+			config_snapshot(&client_config);
+			sc_config_t *sc = &client_config.sc;
 
 			memset(path, 0, sizeof(path));
 
-			sprintf(path,"/%s/web/webservices/llamadores_ws.php", sc_config.sc_url);
+			sprintf(path,"/%s/web/webservices/llamadores_ws.php", sc->sc_url);
 
 			esp_http_client_config_t config = {
-				.host = sc_config.sc_server,
+				.host = sc->sc_server,
 				.path = path,
 				.transport_type = HTTP_TRANSPORT_OVER_TCP,
 				.event_handler = _http_event_handler,
@@ -77,22 +94,22 @@ void client_task(void *arg)
 
 			switch(ticket){
 				case BED1:
-					sprintf(post_data,"auth_user=%s&auth_pwd=%s&operation=call&button=bed1", sc_config.sc_user, sc_config.sc_pass);
+					sprintf(post_data,"auth_user=%s&auth_pwd=%s&operation=call&button=bed1", sc->sc_user, sc->sc_pass);
 					break;
 				case BED2:
-					sprintf(post_data,"auth_user=%s&auth_pwd=%s&operation=call&button=bed2", sc_config.sc_user, sc_config.sc_pass);
+					sprintf(post_data,"auth_user=%s&auth_pwd=%s&operation=call&button=bed2", sc->sc_user, sc->sc_pass);
 					break;
 				case BATH:
-					sprintf(post_data,"auth_user=%s&auth_pwd=%s&operation=call&button=bath", sc_config.sc_user, sc_config.sc_pass);
+					sprintf(post_data,"auth_user=%s&auth_pwd=%s&operation=call&button=bath", sc->sc_user, sc->sc_pass);
 					break;
 				case PRIORITY:
-					sprintf(post_data,"auth_user=%s&auth_pwd=%s&operation=call&button=priority", sc_config.sc_user, sc_config.sc_pass);
+					sprintf(post_data,"auth_user=%s&auth_pwd=%s&operation=call&button=priority", sc->sc_user, sc->sc_pass);
 					break;
 				case SERVE:
-					sprintf(post_data,"auth_user=%s&auth_pwd=%s&operation=serve", sc_config.sc_user, sc_config.sc_pass);
+					sprintf(post_data,"auth_user=%s&auth_pwd=%s&operation=serve", sc->sc_user, sc->sc_pass);
 					break;
 				case RESOLVE:
-					sprintf(post_data,"auth_user=%s&auth_pwd=%s&operation=resolve", sc_config.sc_user, sc_config.sc_pass);
+					sprintf(post_data,"auth_user=%s&auth_pwd=%s&operation=resolve", sc->sc_user, sc->sc_pass);
 					break;
 				default:
 					ESP_LOGE(TAG, "Ticket type error");
@@ -103,14 +120,19 @@ void client_task(void *arg)
 
 			esp_err_t err = esp_http_client_perform(client);
 
+			int status = 0;
 			if (err == ESP_OK)
 			{
-				ESP_LOGI(TAG, "HTTP POST status = %d", esp_http_client_get_status_code(client));
+				status = esp_http_client_get_status_code(client);
+				ESP_LOGI(TAG, "HTTP POST status = %d", status);
 			} else {
 				ESP_LOGE(TAG, "HTTP POST request failed = %s", esp_err_to_name(err));
 			}
+			/* status 0 when SmartContent could not be reached */
+			stream_event_post("ticket", "{\"op\":\"%s\",\"status\":%d}", ticket_names[ticket], status);
 
 			esp_http_client_cleanup(client);
+			ticket_sending = false;
 		}
 	}
 }
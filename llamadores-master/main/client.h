@@ -8,8 +8,6 @@ typedef struct {
 	char sc_pass[16];
 } sc_config_t;
 
-extern sc_config_t sc_config;
-
 typedef enum{
 	BED1,       	// Ticket con operation=call y button=bed1
 	BED2,       	// Ticket con operation=call y button=bed2
@@ -21,6 +19,8 @@ typedef enum{
 
 void http_post(ticket_t new_ticket);
 
+bool http_post_pending(void);
+
 void client_task(void *arg);
 
 #endif
@@ -5,4 +5,3 @@
 
 COMPONENT_EMBED_FILES := favicon.ico
 COMPONENT_EMBED_FILES += index.html
-COMPONENT_EMBED_FILES += ringback.wav
@@ -0,0 +1,187 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "json_config.h"
+#include "config_store.h"
+#include "g711.h"
+
+#include "config.h"
+#include "config_fields.h"
+#include "stream_server.h"
+
+static const char *TAG = "CONFIG";
+
+/* NVS record, bump the version when app_config_t grows */
+#define CONFIG_RECORD_KEY      "app"
+#define CONFIG_RECORD_VERSION  2
+
+/* Payload of each record version, see config_store_load() */
+static const size_t config_record_sizes[CONFIG_RECORD_VERSION] = {
+	offsetof(app_config_t, codec),          // 1
+	sizeof(app_config_t),                   // 2
+};
+
+/* Published config. Tasks copy it whole and compare generations to spot
+* changes, GET /conf serializes it on request. */
+static app_config_t config_current;
+static uint32_t config_gen;
+static portMUX_TYPE config_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/* Config the device booted with, source of the settings that need a restart */
+static app_config_t config_boot;
+static bool config_boot_valid;
+
+static void config_defaults(app_config_t *cfg)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	json_config_defaults(config_fields, JSON_CONFIG_COUNT(config_fields), cfg);
+}
+
+esp_err_t config_parse(const char *json, size_t len, app_config_t *out, const char **err_msg)
+{
+	app_config_t parsed;
+
+	config_defaults(out);
+	config_defaults(&parsed);
+
+	const char *msg = json_config_parse(config_fields, JSON_CONFIG_COUNT(config_fields), json, len, &parsed);
+	if (!msg && !parsed.dhcp && (parsed.ip[0] == 0 || parsed.mask[0] == 0)) msg = "Static IP without ip or mask";
+	g711_law_t law;
+	if (!msg && g711_law_from_name(parsed.codec, &law) != 0) msg = "Invalid codec";
+
+	if (msg) {
+		ESP_LOGE(TAG, "Config rejected: %s", msg);
+		if (err_msg) *err_msg = msg;
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	*out = parsed;
+	return ESP_OK;
+}
+
+static void publish(const app_config_t *cfg)
+{
+	portENTER_CRITICAL(&config_mux);
+	config_current = *cfg;
+	uint32_t gen = ++config_gen;
+	portEXIT_CRITICAL(&config_mux);
+
+	/* Lets monitoring clients know when to fetch /conf again */
+	stream_state_set("config", "%u", gen);
+}
+
+uint32_t config_snapshot(app_config_t *cfg)
+{
+	portENTER_CRITICAL(&config_mux);
+	*cfg = config_current;
+	uint32_t gen = config_gen;
+	portEXIT_CRITICAL(&config_mux);
+	return gen;
+}
+
+uint32_t config_generation(void)
+{
+	return config_gen;
+}
+
+size_t config_json_get(char *buf, size_t size)
+{
+	app_config_t *cfg = malloc(sizeof(app_config_t));
+	if (cfg == NULL) return 0;
+	config_snapshot(cfg);
+	size_t len = json_config_write(config_fields, JSON_CONFIG_COUNT(config_fields), cfg, buf, size);
+	free(cfg);
+	return len;
+}
+
+static bool needs_restart(const app_config_t *cfg)
+{
+	const app_config_t *b = &config_boot;
+	return !config_boot_valid || cfg->dhcp != b->dhcp ||
+		strcmp(cfg->ip, b->ip) != 0 || strcmp(cfg->gw, b->gw) != 0 || strcmp(cfg->mask, b->mask) != 0 ||
+		cfg->sip_enable != b->sip_enable || strcmp(cfg->sip_uri, b->sip_uri) != 0 ||
+		strcmp(cfg->ota_url, b->ota_url) != 0 || strcmp(cfg->codec, b->codec) != 0;
+}
+
+esp_err_t config_save(const char *json, size_t len, app_config_t *cfg, bool *restart, const char **err_msg)
+{
+	if (len >= CONFIG_JSON_SIZE) {
+		if (err_msg) *err_msg = "Config too large";
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	esp_err_t err = config_parse(json, len, cfg, err_msg);
+	if (err != ESP_OK) return err;
+
+	err = config_store_save(CONFIG_RECORD_KEY, CONFIG_RECORD_VERSION, cfg, sizeof(*cfg));
+	if (err != ESP_OK) {
+		if (err_msg) *err_msg = "Failed to write config to storage";
+		return err;
+	}
+
+	publish(cfg);
+
+	bool need = needs_restart(cfg);
+	if (restart) *restart = need;
+	ESP_LOGI(TAG, "Config saved%s", need ? ", restart needed" : " and applied");
+	return ESP_OK;
+}
+
+/* First boot after an update from the config.txt firmware */
+static esp_err_t config_migrate(app_config_t *cfg)
+{
+	char *json = malloc(CONFIG_JSON_SIZE);
+	if (json == NULL) return ESP_ERR_NO_MEM;
+
+	esp_err_t err = ESP_ERR_NOT_FOUND;
+	size_t len = config_store_legacy_read(json, CONFIG_JSON_SIZE);
+	if (len > 0) {
+		ESP_LOGW(TAG, "Migrating config.txt\n%s", json);
+		err = config_parse(json, len, cfg, NULL);
+		if (err == ESP_OK) err = config_store_save(CONFIG_RECORD_KEY, CONFIG_RECORD_VERSION, cfg, sizeof(*cfg));
+	}
+	free(json);
+	return err;
+}
+
+esp_err_t config_load(app_config_t *cfg)
+{
+	int64_t start = esp_timer_get_time();
+
+	config_defaults(cfg);
+	esp_err_t err = config_store_load(CONFIG_RECORD_KEY, config_record_sizes, CONFIG_RECORD_VERSION,
+		cfg, sizeof(*cfg));
+	if (err == ESP_OK) {
+		ESP_LOGI(TAG, "Config loaded in %d us", (int)(esp_timer_get_time() - start));
+		g711_law_t law;
+		if (g711_law_from_name(cfg->codec, &law) != 0) {
+			ESP_LOGW(TAG, "Stored codec \"%.4s\" not valid, using %s", cfg->codec, CODEC_DEFAULT);
+			snprintf(cfg->codec, sizeof(cfg->codec), "%s", CODEC_DEFAULT);
+		}
+	} else if (err == ESP_ERR_NOT_FOUND) {
+		err = config_migrate(cfg);
+		if (err == ESP_ERR_NOT_FOUND) {
+			/* Nothing stored until the first save */
+			ESP_LOGW(TAG, "No config, using defaults");
+			config_defaults(cfg);
+			err = ESP_OK;
+		}
+	}
+
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "Config not loaded (%s)", esp_err_to_name(err));
+		config_defaults(cfg);
+	}
+
+	publish(cfg);
+	config_boot = *cfg;
+	config_boot_valid = (err == ESP_OK);
+	return err;
+}
@@ -0,0 +1,95 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "client.h"
+
+/* Largest config JSON accepted */
+#define CONFIG_JSON_SIZE 512
+
+/* Accepted tone, spk and mic levels, dB */
+#define VOLUME_MIN  -30
+#define VOLUME_MAX  30
+
+typedef struct {
+	bool dhcp;
+	char ip[16];
+	char gw[16];
+	char mask[16];
+	sc_config_t sc;
+	bool sip_enable;
+	char sip_uri[64];
+	char sip_call[16];
+	int tone;
+	int spk;
+	int mic;
+	bool invert_panic_button;
+	char ota_url[128];
+	char codec[5];          // SDP name, "PCMA" or "PCMU"
+} app_config_t;
+
+/**
+ * @brief Load the config record from NVS and publish it
+ *
+ * Without a record the /spiffs/config.txt of older firmware is migrated,
+ * without either the menuconfig defaults are used in memory. SPIFFS is
+ * only mounted for the migration. The loaded config is also kept as the
+ * boot config, the reference for settings that only apply after a restart.
+ *
+ * @return ESP_ERR_INVALID_CRC if the record is damaged,
+ *         ESP_ERR_INVALID_ARG if config.txt does not validate,
+ *         cfg then holds the defaults
+ */
+esp_err_t config_load(app_config_t *cfg);
+
+/**
+ * @brief Validate a config JSON and fill cfg
+ *
+ * Missing keys take the menuconfig defaults, a rejected config leaves cfg
+ * with the defaults only.
+ *
+ * @param err_msg short reason for a rejected config, may be NULL
+ */
+esp_err_t config_parse(const char *json, size_t len, app_config_t *cfg, const char **err_msg);
+
+/**
+ * @brief Validate, store and publish a new config JSON
+ *
+ * Stored as a binary NVS record, a failed upload or a power cut leaves
+ * the previous config in place.
+ *
+ * @param restart set when IP, SIP service or codec settings changed, those
+ *                only apply after a restart
+ *
+ * @return ESP_ERR_INVALID_ARG if the config does not validate
+ */
+esp_err_t config_save(const char *json, size_t len, app_config_t *cfg, bool *restart, const char **err_msg);
+
+/**
+ * @brief Copy the published config
+ *
+ * Tasks work on their own copy, so a save never changes a config while it
+ * is being used.
+ *
+ * @return generation of the copy
+ */
+uint32_t config_snapshot(app_config_t *cfg);
+
+/**
+ * @brief Generation of the published config, changes on every save
+ */
+uint32_t config_generation(void);
+
+/**
+ * @brief Serialize the published config as JSON
+ *
+ * @return length of the JSON, 0 if it does not fit
+ */
+size_t config_json_get(char *buf, size_t size);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef CONFIG_FIELDS_H
+#define CONFIG_FIELDS_H
+
+/* The config keys, included by config.c and by the host fuzzer and bench
+* in tools/config_fuzz. Needs json_config.h, config.h and the sdkconfig
+* values before it. */
+
+#ifdef CONFIG_DHCP
+#define DHCP_DEFAULT true
+#else
+#define DHCP_DEFAULT false
+#endif
+
+#ifdef CONFIG_SIP_CODEC_G711A
+#define CODEC_DEFAULT "PCMA"
+#else
+#define CODEC_DEFAULT "PCMU"
+#endif
+
+/* Every config key, its limits and the firmware default */
+static const json_config_field_t config_fields[] = {
+	JSON_CONFIG_BOOL(app_config_t, dhcp, "dhcp", DHCP_DEFAULT),
+	JSON_CONFIG_IP(app_config_t, ip, "ip", CONFIG_IP),
+	JSON_CONFIG_IP(app_config_t, gw, "gw", CONFIG_GW),
+	JSON_CONFIG_IP(app_config_t, mask, "mask", CONFIG_MASK),
+	JSON_CONFIG_STR(app_config_t, sc.sc_server, "server", CONFIG_SERVER_IP),
+	JSON_CONFIG_STR(app_config_t, sc.sc_url, "url", CONFIG_SERVER_URL),
+	JSON_CONFIG_STR(app_config_t, sc.sc_user, "user", CONFIG_SERVER_USER),
+	JSON_CONFIG_STR(app_config_t, sc.sc_pass, "pass", CONFIG_SERVER_PASS),
+	JSON_CONFIG_BOOL(app_config_t, sip_enable, "sip_enable", true),
+	JSON_CONFIG_STR(app_config_t, sip_uri, "sip", CONFIG_SIP_URI),
+	JSON_CONFIG_STR(app_config_t, sip_call, "call", CONFIG_SIP_CALL),
+	JSON_CONFIG_INT(app_config_t, tone, "tone", VOLUME_MIN, VOLUME_MAX, -10),
+	JSON_CONFIG_INT(app_config_t, spk, "spk", VOLUME_MIN, VOLUME_MAX, 0),
+	JSON_CONFIG_INT(app_config_t, mic, "mic", VOLUME_MIN, VOLUME_MAX, 0),
+	JSON_CONFIG_BOOL(app_config_t, invert_panic_button, "invert_panic_button", false),
+	JSON_CONFIG_STR(app_config_t, ota_url, "ota_url", ""),
+	JSON_CONFIG_STR(app_config_t, codec, "codec", CODEC_DEFAULT),
+};
+
+#endif
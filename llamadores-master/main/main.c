@@ -1,21 +1,22 @@
 #include <string.h>
+#include <math.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
-#include "freertos/timers.h"
+#include "freertos/semphr.h"
 
 #include "esp_system.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_eth.h"
-#include "esp_spiffs.h"
 #include "nvs_flash.h"
 #include "esp_event_loop.h"
 #include "esp_ota_ops.h"
 #include "esp_flash_partitions.h"
 #include "esp_partition.h"
+#include "esp_timer.h"
 
 #include "board.h"
 
@@ -27,19 +28,26 @@
 #include "esp_peripherals.h"
 #include "audio_mem.h"
 #include "raw_stream.h"
-#include "filter_resample.h"
 #include "esp_sip.h"
-#include "g711_decoder.h"
-#include "g711_encoder.h"
 #include "spiffs_stream.h"
-#include "wav_decoder.h"
 #include "algorithm_stream.h"
 
 #include "caller.h"
 #include "server.h"
+#include "stream_server.h"
 #include "client.h"
-
-#include "jsmn.h"
+#include "config.h"
+#include "ota_pull.h"
+#include "discovery.h"
+#include "metrics.h"
+#include "tone_gen.h"
+#include "mixer_stream.h"
+#include "aec_stream.h"
+#include "jitter_stream.h"
+#include "g711_stream.h"
+#include "vad.h"
+#include "audio_chain.h"
+#include "dma_profile.h"
 
 #define FW_VERSION 9
 
@@ -48,7 +56,13 @@ static const char *TAG = "MAIN";
 // AUDIO ######################################################################
 
 #define I2S_SAMPLE_RATE     8000
+#ifdef CONFIG_I2S_MONO_OUTPUT
+#define I2S_CHANNELS        1
+#define I2S_CHANNEL_FMT     I2S_CHANNEL_FMT_ONLY_LEFT
+#else
 #define I2S_CHANNELS        2
+#define I2S_CHANNEL_FMT     I2S_CHANNEL_FMT_RIGHT_LEFT
+#endif
 #define I2S_BITS            16
 
 #define ADC_SAMPLE_RATE     48000
@@ -60,162 +74,470 @@ static const char *TAG = "MAIN";
 #define CODEC_BITS      		16
 
 sip_handle_t sip;
-audio_element_handle_t raw_read, raw_write;
-audio_element_handle_t i2s_stream_reader, i2s_stream_writer;
-audio_pipeline_handle_t recorder, player, tone_player;
-bool tone_init = false;
+audio_element_handle_t raw_read, raw_write, raw_call;
+audio_element_handle_t i2s_stream_reader, i2s_stream_writer, mixer, aec, jitter;
+audio_element_handle_t sip_encoder, sip_decoder;
+audio_pipeline_handle_t recorder, player, speaker;
+
+/* Inputs of the speaker mixer */
+static int source_ringback = -1, source_call = -1;
+
+// VOLUME #####################################################################
 
-// ECHO CANCELATION ###########################################################
+#define VOLUME_RAMP_PERIOD  10  // ms per 1 dB step
 
+/* Targets, set by the web server and read when a pipeline is built */
+int tone_volume = -10;
 int spk_volume = 0;
 int mic_volume = 0;
 
-#define ALPHA_IN	0.70
-#define ALPHA_OUT	0.55
-#define THRESHOLD 500
+/* Values applied to the mixer gains and the microphone ALC, they follow the
+* targets in 1 dB steps so changes during a call do not click */
+static int tone_volume_cur = -10;
+static int spk_volume_cur = 0;
+static int mic_volume_cur = 0;
 
-int16_t max_filter = 0;
+static esp_timer_handle_t volume_timer;
+static SemaphoreHandle_t volume_lock;  // Held while a session sets its starting volume
 
-void max_write_value_callback(int16_t max)
+static int volume_step(int cur, int target)
 {
-	if (max > max_filter)
-	{
-		max_filter = max * ALPHA_IN + max_filter * (1 - ALPHA_IN);
+	if (cur < target) return cur + 1;
+	if (cur > target) return cur - 1;
+	return cur;
+}
+
+static void volume_ramp_cb(void *arg)
+{
+	/* A session is starting, try again on the next tick */
+	if (xSemaphoreTake(volume_lock, 0) != pdTRUE) return;
+
+	if (tone_volume_cur != tone_volume) {
+		tone_volume_cur = volume_step(tone_volume_cur, tone_volume);
+		if (mixer != NULL) mixer_stream_set_gain(mixer, source_ringback, tone_volume_cur);
+	}
+	if (spk_volume_cur != spk_volume) {
+		spk_volume_cur = volume_step(spk_volume_cur, spk_volume);
+		if (mixer != NULL) mixer_stream_set_gain(mixer, source_call, spk_volume_cur);
+	}
+	if (mic_volume_cur != mic_volume) {
+		mic_volume_cur = volume_step(mic_volume_cur, mic_volume);
+		if (i2s_stream_reader != NULL) i2s_alc_volume_set(i2s_stream_reader, mic_volume_cur);
+	}
+
+	/* Stopped under the lock, a target set meanwhile restarts the timer
+	* only after this */
+	bool done = tone_volume_cur == tone_volume && spk_volume_cur == spk_volume && mic_volume_cur == mic_volume;
+	if (done) esp_timer_stop(volume_timer);
+	xSemaphoreGive(volume_lock);
+}
+
+static void volume_init(void)
+{
+	volume_lock = xSemaphoreCreateMutex();
+
+	esp_timer_create_args_t timer_args = {
+		.callback = volume_ramp_cb,
+		.name = "volume_ramp",
+	};
+	ESP_ERROR_CHECK(esp_timer_create(&timer_args, &volume_timer));
+}
+
+/* Can be called at any rate, the ramp timer only runs until the targets are reached */
+void audio_volume_set(int tone, int spk, int mic)
+{
+	if (volume_timer == NULL) {
+		tone_volume = tone;
+		spk_volume = spk;
+		mic_volume = mic;
+		return;
+	}
+
+	/* Fails harmlessly if the ramp is already running, it picks up the
+	* new targets on its next tick */
+	xSemaphoreTake(volume_lock, portMAX_DELAY);
+	tone_volume = tone;
+	spk_volume = spk;
+	mic_volume = mic;
+	esp_timer_start_periodic(volume_timer, VOLUME_RAMP_PERIOD * 1000);
+	xSemaphoreGive(volume_lock);
+}
+
+/* Jump to the target when a session starts, the ramp is for changes during it */
+static void volume_start(int *cur, int target, int source)
+{
+	xSemaphoreTake(volume_lock, portMAX_DELAY);
+	*cur = target;
+	if (source >= 0) mixer_stream_set_gain(mixer, source, target);
+	else i2s_alc_volume_set(i2s_stream_reader, target);
+	xSemaphoreGive(volume_lock);
+}
+
+// LEVELS #####################################################################
+
+/* Gathered for the stream server while an installer watches the levels,
+* peaks come from the i2s callbacks and RMS from the call audio */
+static volatile bool levels_enabled = false;
+static int mic_peak, spk_peak;
+static uint64_t mic_sum, spk_sum;
+static uint32_t mic_samples, spk_samples;
+static portMUX_TYPE levels_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/* From the config at boot, SIP offers only this one */
+static g711_law_t codec_law;
+
+#ifdef CONFIG_SIP_CODEC_G711U
+#define CODEC_LAW_DEFAULT   G711_ULAW
+#else
+#define CODEC_LAW_DEFAULT   G711_ALAW
+#endif
+
+static void levels_feed(const uint8_t *data, int len, bool mic)
+{
+	if (!levels_enabled || len <= 0) return;
+
+	uint64_t sum = 0;
+	for (int i = 0; i < len; i++) {
+		int32_t s = codec_law == G711_ALAW ? g711_alaw_decode(data[i]) : g711_ulaw_decode(data[i]);
+		sum += s * s;
+	}
+
+	portENTER_CRITICAL(&levels_mux);
+	if (mic) {
+		mic_sum += sum;
+		mic_samples += len;
 	} else {
-		max_filter = max * ALPHA_OUT + max_filter * (1 - ALPHA_OUT);
+		spk_sum += sum;
+		spk_samples += len;
 	}
+	portEXIT_CRITICAL(&levels_mux);
+}
 
-	int vol = mic_volume - max_filter / THRESHOLD;
-	if (vol > mic_volume) vol = mic_volume;
+static void levels_peak(int *peak, int16_t max)
+{
+	if (!levels_enabled) return;
 
-	//ESP_LOGI(TAG, "max %d, max_filter %d, mic_volume %d, vol %d", max, max_filter, mic_volume, vol);
+	portENTER_CRITICAL(&levels_mux);
+	if (max > *peak) *peak = max;
+	portEXIT_CRITICAL(&levels_mux);
+}
 
-	if (i2s_stream_reader != NULL) i2s_alc_volume_set(i2s_stream_reader, vol);
+void audio_levels_enable(bool enable)
+{
+	levels_enabled = enable;
+}
+
+void audio_levels_take(audio_levels_t *levels)
+{
+	portENTER_CRITICAL(&levels_mux);
+	levels->mic_peak = mic_peak;
+	levels->spk_peak = spk_peak;
+	levels->mic_rms = mic_samples ? sqrtf((float)mic_sum / mic_samples) : 0;
+	levels->spk_rms = spk_samples ? sqrtf((float)spk_sum / spk_samples) : 0;
+	levels->duck = aec != NULL ? aec_stream_suppression_db(aec) : 0;
+	mic_peak = spk_peak = 0;
+	mic_sum = spk_sum = 0;
+	mic_samples = spk_samples = 0;
+	portEXIT_CRITICAL(&levels_mux);
+}
+
+// SPEAKER AND MIC PEAKS ######################################################
+
+/* Hooks of the i2s_stream, the echo is handled by the canceller in the
+* recorder pipeline */
+void max_write_value_callback(int16_t max)
+{
+	levels_peak(&spk_peak, max);
 }
 
 void max_read_value_callback(int16_t max)
 {
 	//ESP_LOGI(TAG, "read %d", max);
+	levels_peak(&mic_peak, max);
 }
 
-// TONE GENERATOR #############################################################
+// RINGBACK ###################################################################
 
-int tone_volume = -10;
+static uint32_t audio_config_gen;
+static app_config_t audio_config;
+static portMUX_TYPE audio_config_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/* Pick up the volumes of a newly saved config, values set by /level_test
+* are kept until then. Called from the timer and SIP tasks, the copy is
+* static to spare their stacks. */
+static void audio_config_refresh(void)
+{
+	if (audio_config_gen != 0 && config_generation() == audio_config_gen) return;
+
+	portENTER_CRITICAL(&audio_config_mux);
+	audio_config_gen = config_snapshot(&audio_config);
+	int tone = audio_config.tone, spk = audio_config.spk, mic = audio_config.mic;
+	portEXIT_CRITICAL(&audio_config_mux);
 
-int tomerId = 1;
-TimerHandle_t tmr;
-uint32_t interval = 4 * 1000;
+	audio_volume_set(tone, spk, mic);
+}
 
-extern const uint8_t wav_start[] asm("_binary_ringback_wav_start");
-extern const uint8_t wav_end[]   asm("_binary_ringback_wav_end");
+#if defined(CONFIG_RINGBACK_CEPT)
+#define RINGBACK_TONE       tone_gen_ringback_cept
+#elif defined(CONFIG_RINGBACK_US)
+#define RINGBACK_TONE       tone_gen_ringback_us
+#elif defined(CONFIG_RINGBACK_UK)
+#define RINGBACK_TONE       tone_gen_ringback_uk
+#else
+#define RINGBACK_TONE       tone_gen_ringback
+#endif
+#define RINGBACK_FADE_MS    20      // Also the crossfade into the call audio
 
-static struct marker {
-	int pos;
-	const uint8_t *start;
-	const uint8_t *end;
-} file_marker;
+static tone_gen_t ringback_gen;
+static const tone_gen_tone_t * volatile ringback_next;
+static bool ringback_on;
 
-int wav_music_read_cb(audio_element_handle_t el, char *buf, int len, TickType_t wait_time, void *ctx)
+/* Mixer source, runs in the mixer task. The tone restarts from the top of
+* its cadence on every outgoing call. */
+static int ringback_read(int16_t *buf, int frames, void *ctx)
 {
-	int read_size = file_marker.end - file_marker.start - file_marker.pos;
-	if (read_size == 0) {
-		return AEL_IO_DONE;
-	} else if (len < read_size) {
-		read_size = len;
+	const tone_gen_tone_t *next = ringback_next;
+	if (next != NULL) {
+		ringback_next = NULL;
+		tone_gen_init(&ringback_gen, next, I2S_SAMPLE_RATE);
 	}
-	memcpy(buf, file_marker.start + file_marker.pos, read_size);
-	file_marker.pos += read_size;
-	return read_size;
+	if (ringback_gen.tone == NULL) return 0;
+	return tone_gen_fill(&ringback_gen, buf, frames, 1);
 }
 
-static esp_err_t tone_pipeline_open(void)
+/* From the outgoing call until it is answered or ends */
+static void ringback_start(void)
 {
-	tone_init = true;
+	if (ringback_on) return;
+	ringback_on = true;
+	audio_config_refresh();
+	volume_start(&tone_volume_cur, tone_volume, source_ringback);
+	ringback_next = &RINGBACK_TONE;
+	mixer_stream_enable(mixer, source_ringback, true, 0);
+}
 
-	audio_pipeline_cfg_t pipeline_cfg = DEFAULT_AUDIO_PIPELINE_CONFIG();
-	tone_player = audio_pipeline_init(&pipeline_cfg);
-	AUDIO_NULL_CHECK(TAG, tone_player, return ESP_FAIL);
+static void ringback_stop(void)
+{
+	ringback_on = false;
+	mixer_stream_enable(mixer, source_ringback, false, RINGBACK_FADE_MS);
+}
 
-	wav_decoder_cfg_t  wav_dec_cfg  = DEFAULT_WAV_DECODER_CONFIG();
-	audio_element_handle_t music_decoder = wav_decoder_init(&wav_dec_cfg);
+// BOOT #######################################################################
 
-	file_marker.start = wav_start;
-	file_marker.end   = wav_end;
-	file_marker.pos 	= 0;
+/* App start to registered and ready for calls, with DHCP behind a switch
+* that negotiates the link in about 2 s. The bootloader adds ~300 ms that
+* the boot marks do not see. */
+#define BOOT_READY_TARGET_MS  4000
 
-	audio_element_set_read_cb(music_decoder, wav_music_read_cb, NULL);
+static void boot_ready(void)
+{
+	if (metrics_boot_get("ready") >= 0) return;
+	metrics_boot_mark("ready");
 
-	rsp_filter_cfg_t rsp_cfg = DEFAULT_RESAMPLE_FILTER_CONFIG();
-	rsp_cfg.src_rate = CODEC_SAMPLE_RATE;
-	rsp_cfg.src_ch = CODEC_CHANNELS;
-	rsp_cfg.dest_rate = I2S_SAMPLE_RATE;
-	rsp_cfg.dest_ch = I2S_CHANNELS;
-	audio_element_handle_t music_filter = rsp_filter_init(&rsp_cfg);
+	int ms = metrics_boot_get("ready");
+	if (ms > BOOT_READY_TARGET_MS) {
+		ESP_LOGW(TAG, "Ready after %d ms, target %d ms", ms, BOOT_READY_TARGET_MS);
+	}
+}
 
-	i2s_stream_cfg_t i2s_cfg = I2S_STREAM_CFG();
-	i2s_cfg.i2s_config.sample_rate = I2S_SAMPLE_RATE;
-	i2s_cfg.use_alc = true;
-	i2s_cfg.volume = tone_volume;
+// UPLINK VAD #################################################################
 
-	audio_element_handle_t music_i2s_stream_writer = i2s_stream_init(&i2s_cfg);
-	audio_element_info_t i2s_info = {0};
-	audio_element_getinfo(music_i2s_stream_writer, &i2s_info);
-	i2s_info.bits = I2S_BITS;
-	i2s_info.channels = I2S_CHANNELS;
-	i2s_info.sample_rates = I2S_SAMPLE_RATE;
-	audio_element_setinfo(music_i2s_stream_writer, &i2s_info);
+/* Voice activity of the microphone, decided per packet on exactly what
+* the encoder produced. With UPLINK_DTX a silent packet is not sent, apart
+* from one now and then that keeps the media path and NAT bindings open.
+* esp_sip has no comfort noise payload, so the far end hears its own. */
+#define UPLINK_CHUNK        160
+#define RTP_OVERHEAD        40      // IP, UDP and RTP headers per packet
+#define VAD_HOLD_DB         -6      // Echo suppression that freezes the noise floor
 
-	audio_pipeline_register(tone_player, music_decoder, "music_decoder");
-	audio_pipeline_register(tone_player, music_filter, "music_filter");
-	audio_pipeline_register(tone_player, music_i2s_stream_writer, "music_i2s");
+static vad_t uplink_vad;
+static int16_t uplink_pcm[UPLINK_CHUNK];
+static uint32_t uplink_packets, uplink_silent, uplink_suppressed;
+static uint32_t uplink_ms, uplink_saved_bytes, uplink_quiet_ms;
+static int uplink_packet_ms;         // Of the last one, what the first sample waits to be sent
 
-	const char *link_tag[3] = {"music_decoder", "music_filter", "music_i2s"};
-	audio_pipeline_link(tone_player, &link_tag[0], 3);
+/* Called from the SIP task, as are the session events that reset it */
+static void uplink_start(void)
+{
+	vad_init(&uplink_vad, CONFIG_VAD_HANGOVER_MS);
+	uplink_packets = uplink_silent = uplink_suppressed = 0;
+	uplink_ms = uplink_saved_bytes = uplink_quiet_ms = 0;
+}
 
-	tone_init = false;
+static bool uplink_send(const uint8_t *data, int len)
+{
+	bool speech = false;
+	vad_hold(&uplink_vad, aec_stream_suppression_db(aec) <= VAD_HOLD_DB);
+	for (int i = 0; i < len; i += UPLINK_CHUNK) {
+		int n = len - i < UPLINK_CHUNK ? len - i : UPLINK_CHUNK;
+		g711_decode(codec_law, data + i, uplink_pcm, n);
+		speech |= vad_process(&uplink_vad, uplink_pcm, n);
+	}
 
-	ESP_LOGI(TAG, "Tone has been created");
-	return ESP_OK;
+	int ms = len * 1000 / CODEC_SAMPLE_RATE;
+	uplink_packet_ms = ms;
+	uplink_packets++;
+	uplink_ms += ms;
+	if (speech) {
+		uplink_quiet_ms = 0;
+		return true;
+	}
+	uplink_silent++;
+
+	#ifdef CONFIG_UPLINK_DTX
+	uplink_quiet_ms += ms;
+	if (uplink_quiet_ms < CONFIG_DTX_KEEPALIVE_MS) {
+		uplink_suppressed++;
+		uplink_saved_bytes += len + RTP_OVERHEAD;
+		return false;
+	}
+	uplink_quiet_ms = 0;
+	#endif
+	return true;
 }
 
-void play_tone(TimerHandle_t xTimer)
+static size_t vad_metrics(char *buf, size_t size)
 {
-	if (tone_player != NULL) {
-		audio_pipeline_stop(tone_player);
-		audio_pipeline_wait_for_stop(tone_player);
-		audio_pipeline_deinit(tone_player);
-		tone_player = NULL;
-	}
-	tone_pipeline_open();
-	audio_pipeline_run(tone_player);
+	vad_stats_t st;
+	vad_stats(&uplink_vad, &st);
+	uint32_t ms = uplink_ms;
+	#ifdef CONFIG_UPLINK_DTX
+	bool dtx = true;
+	#else
+	bool dtx = false;
+	#endif
+
+	int len = snprintf(buf, size, "{\"dtx\":%s,\"packets\":%u,\"silent\":%u,\"suppressed\":%u,"
+		"\"speech_pct\":%u,\"noise_db\":%d,\"saved_kbps\":%u}",
+		dtx ? "true" : "false", uplink_packets, uplink_silent, uplink_suppressed,
+		st.frames ? st.speech * 100 / st.frames : 0, st.noise_db,
+		ms ? (uint32_t)((uint64_t)uplink_saved_bytes * 8 / ms) : 0);
+	return len > 0 && len < size ? len : 0;
 }
 
 // SIP ########################################################################
 
-static esp_err_t player_pipeline_open(void)
+static audio_chain_t speaker_chain, player_chain, recorder_chain;
+
+/* The speaker DMA is stepped up between calls after one where its buffer
+* ran dry, and back down after a run of clean ones */
+static const dma_profile_t speaker_profile = I2S_DMA_PROFILE_CALL();
+static const dma_profile_t capture_profile = I2S_DMA_PROFILE_CALL();
+static dma_profile_ctl_t speaker_dma, capture_dma;
+static int mixer_rb_ms;
+
+/* Connect to first audio and setup cost of the last call, for /metrics */
+static int64_t session_begin_us;
+static volatile bool first_audio_pending;
+static int call_count, call_setup_us = -1, call_first_audio_ms = -1;
+static echo_canceller_stats_t call_aec = { .erle_db = -1 };
+static int call_codec_us = -1;
+static int call_mouth_to_wire_ms = -1, call_wire_to_ear_ms = -1;
+
+static size_t call_metrics(char *buf, size_t size)
 {
-	audio_pipeline_cfg_t pipeline_cfg = DEFAULT_AUDIO_PIPELINE_CONFIG();
-	player = audio_pipeline_init(&pipeline_cfg);
-	AUDIO_NULL_CHECK(TAG, player, return ESP_FAIL);
+	int len = snprintf(buf, size, "{\"count\":%d,\"setup_us\":%d,\"first_audio_ms\":%d,"
+		"\"erle_db\":%d,\"double_talk_pct\":%d,\"codec\":\"%s\",\"codec_us\":%d,"
+		"\"mouth_to_wire_ms\":%d,\"wire_to_ear_ms\":%d}",
+		call_count, call_setup_us, call_first_audio_ms, call_aec.erle_db, call_aec.double_talk_pct,
+		g711_law_name(codec_law), call_codec_us, call_mouth_to_wire_ms, call_wire_to_ear_ms);
+	return len > 0 && len < size ? len : 0;
+}
 
-	raw_stream_cfg_t raw_cfg = RAW_STREAM_CFG_DEFAULT();
-	raw_cfg.type = AUDIO_STREAM_WRITER;
-	raw_write = raw_stream_init(&raw_cfg);
+/* Time the audio of a call spends in this device, estimated from the ring
+* buffer fill sampled by audio_chain and the DMA sizes. The microphone
+* waits in the capture buffers and for its packet to fill, the far end in
+* the player buffers, the jitter buffer and the speaker buffers. The
+* network is not counted. */
+static int mouth_to_wire_ms(void)
+{
+	return audio_chain_delay_ms(&recorder_chain) + uplink_packet_ms;
+}
+
+static int wire_to_ear_ms(void)
+{
+	jitter_buffer_stats_t jb;
+	jitter_stream_stats(jitter, &jb);
+	return audio_chain_delay_ms(&player_chain) + jb.target_ms + audio_chain_delay_ms(&speaker_chain);
+}
+
+/* Live during a call, the last call's in between. Per stage fill, where
+* "empty" on the way to the speaker or "full" after the microphone point
+* at an underrun or an overrun. */
+static size_t latency_metrics(char *buf, size_t size)
+{
+	char recorder[384], player[320], speaker[160];
+	if (audio_chain_stats_json(&recorder_chain, recorder, sizeof(recorder)) == 0) return 0;
+	if (audio_chain_stats_json(&player_chain, player, sizeof(player)) == 0) return 0;
+	if (audio_chain_stats_json(&speaker_chain, speaker, sizeof(speaker)) == 0) return 0;
+	int len = snprintf(buf, size, "{\"mouth_to_wire_ms\":%d,\"wire_to_ear_ms\":%d,"
+		"\"recorder\":%s,\"player\":%s,\"speaker\":%s}",
+		mouth_to_wire_ms(), wire_to_ear_ms(), recorder, player, speaker);
+	return len > 0 && len < size ? len : 0;
+}
 
-	g711_decoder_cfg_t g711_cfg = DEFAULT_G711_DECODER_CONFIG();
-	audio_element_handle_t sip_decoder = g711_decoder_init(&g711_cfg);
+/* Mixer source, runs in the mixer task. Always drained so a call that is
+* not on yet cannot back up the decoder, skipped while a session starts or
+* ends and the player ring buffers are reset. */
+static SemaphoreHandle_t call_lock;
+
+static int call_read(int16_t *buf, int frames, void *ctx)
+{
+	if (xSemaphoreTake(call_lock, 0) != pdTRUE) return 0;
+	int len = raw_stream_read(raw_call, (char *)buf, frames * sizeof(int16_t));
+	xSemaphoreGive(call_lock);
+	return len > 0 ? len / sizeof(int16_t) : 0;
+}
+
+/* Echo canceller reference, runs in the mixer task */
+static void speaker_tap(const int16_t *mix, int frames, void *ctx)
+{
+	if (aec != NULL) aec_stream_reference(aec, mix, frames);
+}
 
-	rsp_filter_cfg_t rsp_cfg = DEFAULT_RESAMPLE_FILTER_CONFIG();
-	rsp_cfg.src_rate = CODEC_SAMPLE_RATE;
-	rsp_cfg.src_ch = CODEC_CHANNELS;
-	rsp_cfg.dest_rate = I2S_SAMPLE_RATE;
-	rsp_cfg.dest_ch = I2S_CHANNELS;
-	audio_element_handle_t filter = rsp_filter_init(&rsp_cfg);
+/* Speaker reference to its echo at the canceller. The mixer ring buffer
+* and the speaker DMA are kept full, the microphone waits for one capture
+* DMA buffer, CONFIG_AEC_DELAY_MS covers the rest. Set again whenever
+* speaker_dma_adapt() changes the speaker DMA. */
+static void aec_delay_update(void)
+{
+	const i2s_config_t *spk = &speaker_dma.cfg.i2s_config;
+	const i2s_config_t *mic = &capture_dma.cfg.i2s_config;
+	if (aec == NULL) return;
+	int ms = mixer_rb_ms + spk->dma_buf_count * spk->dma_buf_len * 1000 / spk->sample_rate +
+		mic->dma_buf_len * 1000 / mic->sample_rate + CONFIG_AEC_DELAY_MS;
+
+	aec_stream_set_delay(aec, ms * CODEC_SAMPLE_RATE / 1000);
+	ESP_LOGI(TAG, "AEC delay %d ms", ms);
+}
 
+/* The only owner of the speaker I2S port. Runs from boot, the mixer writes
+* silence while there is no tone or call. */
+static esp_err_t speaker_pipeline_create(void)
+{
+	audio_pipeline_cfg_t pipeline_cfg = DEFAULT_AUDIO_PIPELINE_CONFIG();
+	speaker = audio_pipeline_init(&pipeline_cfg);
+	AUDIO_NULL_CHECK(TAG, speaker, return ESP_FAIL);
+
+	mixer_stream_cfg_t mixer_cfg = DEFAULT_MIXER_STREAM_CONFIG();
+	mixer_cfg.sample_rate = I2S_SAMPLE_RATE;
+	mixer_cfg.channels = I2S_CHANNELS;
+	mixer = mixer_stream_init(&mixer_cfg);
+	AUDIO_NULL_CHECK(TAG, mixer, return ESP_FAIL);
+	mixer_rb_ms = mixer_cfg.out_rb_size / (I2S_SAMPLE_RATE / 1000 * I2S_CHANNELS * I2S_BITS / 8);
+	source_ringback = mixer_stream_add_source(mixer, "ringback", ringback_read, NULL);
+	source_call = mixer_stream_add_source(mixer, "call", call_read, NULL);
+	mixer_stream_set_gain(mixer, source_ringback, tone_volume_cur);
+	mixer_stream_set_gain(mixer, source_call, spk_volume_cur);
+	mixer_stream_set_tap(mixer, speaker_tap, NULL);
+
+	/* Volumes are mixer gains, the ALC stays at 0 dB */
 	i2s_stream_cfg_t i2s_cfg = I2S_STREAM_CFG();
 	i2s_cfg.i2s_config.sample_rate = I2S_SAMPLE_RATE;
+	i2s_cfg.i2s_config.channel_format = I2S_CHANNEL_FMT;
 	i2s_cfg.use_alc = true;
-	i2s_cfg.volume = spk_volume;
+	i2s_cfg.volume = 0;
+	dma_profile_init(&speaker_dma, &speaker_profile, &i2s_cfg);
 
 	i2s_stream_writer = i2s_stream_init(&i2s_cfg);
 	audio_element_info_t i2s_info = {0};
@@ -225,19 +547,94 @@ static esp_err_t player_pipeline_open(void)
 	i2s_info.sample_rates = I2S_SAMPLE_RATE;
 	audio_element_setinfo(i2s_stream_writer, &i2s_info);
 
-	audio_pipeline_register(player, raw_write, "raw");
-	audio_pipeline_register(player, sip_decoder, "sip_dec");
-	audio_pipeline_register(player, filter, "filter");
-	audio_pipeline_register(player, i2s_stream_writer, "i2s");
-
-	const char *link_tag[4] = {"raw", "sip_dec", "filter", "i2s"};
-	audio_pipeline_link(player, &link_tag[0], 4);
+	audio_chain_init(&speaker_chain, speaker, "speaker");
+	audio_chain_format(&speaker_chain, I2S_SAMPLE_RATE, I2S_CHANNELS, I2S_BITS);
+	audio_chain_add(&speaker_chain, mixer, "mixer");
+	audio_chain_add(&speaker_chain, i2s_stream_writer, "i2s");
+	audio_chain_dma(&speaker_chain, &i2s_cfg);
+	audio_chain_link(&speaker_chain);
+	audio_chain_run(&speaker_chain);
+	aec_delay_update();
 
 	ESP_LOGI(TAG, "Speaker has been created");
 	return ESP_OK;
 }
 
-static esp_err_t recorder_pipeline_open(void)
+static size_t jitter_metrics(char *buf, size_t size)
+{
+	return jitter_stream_stats_json(jitter, buf, size);
+}
+
+static size_t dma_metrics(char *buf, size_t size)
+{
+	char speaker[128], capture[128];
+	if (dma_profile_json(&speaker_dma, speaker, sizeof(speaker)) == 0) return 0;
+	if (dma_profile_json(&capture_dma, capture, sizeof(capture)) == 0) return 0;
+	int len = snprintf(buf, size, "{\"speaker\":%s,\"capture\":%s}", speaker, capture);
+	return len > 0 && len < size ? len : 0;
+}
+
+/* Between calls, judged by the buffer into the speaker I2S during the one
+* that ended. The speaker stops for as long as the driver takes to install. */
+static void speaker_dma_adapt(void)
+{
+	audio_chain_fill_t sink;
+	audio_chain_sink_fill(&speaker_chain, &sink);
+	if (!dma_profile_update(&speaker_dma, sink.empty, sink.samples)) return;
+
+	audio_chain_stop(&speaker_chain);
+	if (dma_profile_install(&speaker_dma) == ESP_OK) {
+		i2s_pin_config_t pins = {0};
+		get_i2s_pins(speaker_dma.cfg.i2s_port, &pins);
+		i2s_set_pin(speaker_dma.cfg.i2s_port, &pins);
+	}
+	audio_chain_dma(&speaker_chain, &speaker_dma.cfg);
+	audio_chain_run(&speaker_chain);
+	aec_delay_update();
+}
+
+/* Call audio into the mixer, at the codec format. The jitter buffer writes
+* a frame, made up if need be, every time the mixer takes one. */
+static esp_err_t player_pipeline_create(void)
+{
+	audio_pipeline_cfg_t pipeline_cfg = DEFAULT_AUDIO_PIPELINE_CONFIG();
+	player = audio_pipeline_init(&pipeline_cfg);
+	AUDIO_NULL_CHECK(TAG, player, return ESP_FAIL);
+
+	raw_stream_cfg_t raw_cfg = RAW_STREAM_CFG_DEFAULT();
+	raw_cfg.type = AUDIO_STREAM_WRITER;
+	raw_write = raw_stream_init(&raw_cfg);
+
+	g711_stream_cfg_t g711_cfg = DEFAULT_G711_STREAM_CONFIG();
+	g711_cfg.mode = G711_STREAM_DECODE;
+	g711_cfg.law = codec_law;
+	sip_decoder = g711_stream_init(&g711_cfg);
+	AUDIO_NULL_CHECK(TAG, sip_decoder, return ESP_FAIL);
+
+	jitter_stream_cfg_t jitter_cfg = DEFAULT_JITTER_STREAM_CONFIG();
+	jitter = jitter_stream_init(&jitter_cfg);
+	AUDIO_NULL_CHECK(TAG, jitter, return ESP_FAIL);
+
+	raw_cfg.type = AUDIO_STREAM_READER;
+	raw_call = raw_stream_init(&raw_cfg);
+	audio_element_set_input_timeout(raw_call, 0);
+
+	audio_chain_init(&player_chain, player, "player");
+	audio_chain_format(&player_chain, CODEC_SAMPLE_RATE, CODEC_CHANNELS, 8);
+	audio_chain_add(&player_chain, raw_write, "raw");
+	audio_chain_format(&player_chain, CODEC_SAMPLE_RATE, CODEC_CHANNELS, 16);
+	audio_chain_add(&player_chain, sip_decoder, "sip_dec");
+	audio_chain_add(&player_chain, jitter, "jitter");
+	audio_chain_convert(&player_chain, CODEC_SAMPLE_RATE, CODEC_CHANNELS, I2S_SAMPLE_RATE, 1, 2);
+	audio_chain_add(&player_chain, raw_call, "raw_mix");
+	audio_chain_link(&player_chain);
+	call_lock = xSemaphoreCreateMutex();
+
+	ESP_LOGI(TAG, "SIP player has been created");
+	return ESP_OK;
+}
+
+static esp_err_t recorder_pipeline_create(void)
 {
 	audio_pipeline_cfg_t pipeline_cfg = DEFAULT_AUDIO_PIPELINE_CONFIG();
 	recorder = audio_pipeline_init(&pipeline_cfg);
@@ -246,7 +643,8 @@ static esp_err_t recorder_pipeline_open(void)
 	i2s_stream_cfg_t i2s_cfg = I2S_STREAM_INTERNAL_ADC_CFG();
 	i2s_cfg.i2s_config.sample_rate = ADC_SAMPLE_RATE;
 	i2s_cfg.use_alc = true;
-	i2s_cfg.volume = mic_volume;
+	i2s_cfg.volume = mic_volume_cur;
+	dma_profile_init(&capture_dma, &capture_profile, &i2s_cfg);
 
 	i2s_set_adc_mode(ADC_UNIT, ADC_CHANNEL);
 	adc1_config_channel_atten(ADC_CHANNEL, ADC_ATTEN);
@@ -259,34 +657,91 @@ static esp_err_t recorder_pipeline_open(void)
 	i2s_info.sample_rates = ADC_SAMPLE_RATE;
 	audio_element_setinfo(i2s_stream_reader, &i2s_info);
 
-	rsp_filter_cfg_t rsp_cfg = DEFAULT_RESAMPLE_FILTER_CONFIG();
-	rsp_cfg.src_rate = ADC_SAMPLE_RATE;
-	rsp_cfg.src_ch = ADC_CHANNELS;
-	rsp_cfg.dest_rate = CODEC_SAMPLE_RATE;
-	rsp_cfg.dest_ch = CODEC_CHANNELS;
-	rsp_cfg.complexity = 5;
-	audio_element_handle_t filter = rsp_filter_init(&rsp_cfg);
+	aec_stream_cfg_t aec_cfg = DEFAULT_AEC_STREAM_CONFIG();
+	aec_cfg.taps = CONFIG_AEC_TAIL_MS * CODEC_SAMPLE_RATE / 1000;
+	aec_cfg.delay = 0;      // Known once the speaker is set up, see aec_delay_update()
+	aec = aec_stream_init(&aec_cfg);
+	AUDIO_NULL_CHECK(TAG, aec, return ESP_FAIL);
 
-	g711_encoder_cfg_t g711_cfg = DEFAULT_G711_ENCODER_CONFIG();
-	audio_element_handle_t sip_encoder = g711_encoder_init(&g711_cfg);
+	g711_stream_cfg_t g711_cfg = DEFAULT_G711_STREAM_CONFIG();
+	g711_cfg.mode = G711_STREAM_ENCODE;
+	g711_cfg.law = codec_law;
+	sip_encoder = g711_stream_init(&g711_cfg);
+	AUDIO_NULL_CHECK(TAG, sip_encoder, return ESP_FAIL);
 
 	raw_stream_cfg_t raw_cfg = RAW_STREAM_CFG_DEFAULT();
 	raw_cfg.type = AUDIO_STREAM_READER;
 	raw_read = raw_stream_init(&raw_cfg);
 	audio_element_set_output_timeout(raw_read, portMAX_DELAY);
 
-	audio_pipeline_register(recorder, i2s_stream_reader, "i2s");
-	audio_pipeline_register(recorder, filter, "filter");
-	audio_pipeline_register(recorder, sip_encoder, "sip_enc");
-	audio_pipeline_register(recorder, raw_read, "raw");
-
-	const char *link_tag[4] = {"i2s", "filter", "sip_enc", "raw"};
-	audio_pipeline_link(recorder, &link_tag[0], 4);
+	audio_chain_init(&recorder_chain, recorder, "recorder");
+	audio_chain_format(&recorder_chain, ADC_SAMPLE_RATE, ADC_CHANNELS, ADC_BITS);
+	audio_chain_add(&recorder_chain, i2s_stream_reader, "i2s");
+	audio_chain_dma(&recorder_chain, &i2s_cfg);
+	audio_chain_convert(&recorder_chain, ADC_SAMPLE_RATE, ADC_CHANNELS, CODEC_SAMPLE_RATE, CODEC_CHANNELS, 5);
+	audio_chain_add(&recorder_chain, aec, "aec");
+	audio_chain_format(&recorder_chain, CODEC_SAMPLE_RATE, CODEC_CHANNELS, 8);
+	audio_chain_add(&recorder_chain, sip_encoder, "sip_enc");
+	audio_chain_add(&recorder_chain, raw_read, "raw");
+	audio_chain_link(&recorder_chain);
 
 	ESP_LOGI(TAG, "SIP recorder has been created");
 	return ESP_OK;
 }
 
+static void call_audio_start(void)
+{
+	session_begin_us = esp_timer_get_time();
+
+	audio_config_refresh();
+	volume_start(&spk_volume_cur, spk_volume, source_call);
+	volume_start(&mic_volume_cur, mic_volume, -1);
+	xSemaphoreTake(call_lock, portMAX_DELAY);
+	audio_chain_run(&player_chain);
+	xSemaphoreGive(call_lock);
+	audio_chain_run(&recorder_chain);
+	audio_chain_clear(&speaker_chain);
+	uplink_start();
+
+	/* The ringback, if any, gives way to the voice on the same sample */
+	ringback_on = false;
+	mixer_stream_crossfade(mixer, source_ringback, source_call, RINGBACK_FADE_MS);
+
+	call_count++;
+	call_setup_us = esp_timer_get_time() - session_begin_us;
+	first_audio_pending = true;
+}
+
+static void call_audio_stop(void)
+{
+	first_audio_pending = false;
+	mixer_stream_enable(mixer, source_call, false, 0);
+	audio_chain_report(&player_chain);
+	audio_chain_report(&recorder_chain);
+	call_mouth_to_wire_ms = mouth_to_wire_ms();
+	call_wire_to_ear_ms = wire_to_ear_ms();
+	ESP_LOGI(TAG, "Latency: mouth to wire %d ms, wire to ear %d ms, speaker %d ms",
+		call_mouth_to_wire_ms, call_wire_to_ear_ms, audio_chain_delay_ms(&speaker_chain));
+
+	aec_stream_stats(aec, &call_aec);
+	int ms = (esp_timer_get_time() - session_begin_us) / 1000;
+	ESP_LOGI(TAG, "AEC: %d us over %d ms, ERLE %d dB, double talk %d%%, %d resyncs",
+		(int)aec_stream_get_cpu_us(aec), ms, call_aec.erle_db, call_aec.double_talk_pct, call_aec.resyncs);
+	int enc_us = g711_stream_get_cpu_us(sip_encoder), dec_us = g711_stream_get_cpu_us(sip_decoder);
+	call_codec_us = enc_us + dec_us;
+	ESP_LOGI(TAG, "%s: encode %d us, decode %d us over %d ms", g711_law_name(codec_law), enc_us, dec_us, ms);
+	vad_stats_t vad;
+	vad_stats(&uplink_vad, &vad);
+	ESP_LOGI(TAG, "VAD: speech %u of %u frames, %u of %u packets silent, %u suppressed, noise %d dBFS",
+		vad.speech, vad.frames, uplink_silent, uplink_packets, uplink_suppressed, vad.noise_db);
+
+	xSemaphoreTake(call_lock, portMAX_DELAY);
+	audio_chain_stop(&player_chain);
+	xSemaphoreGive(call_lock);
+	audio_chain_stop(&recorder_chain);
+	speaker_dma_adapt();
+}
+
 static ip4_addr_t _get_network_ip(void)
 {
 	tcpip_adapter_ip_info_t ip;
@@ -297,6 +752,7 @@ static ip4_addr_t _get_network_ip(void)
 static int _sip_event_handler(sip_event_msg_t *event)
 {
 	ip4_addr_t ip;
+	int len;
 	switch ((int)event->type)
 	{
 		case SIP_EVENT_REQUEST_NETWORK_STATUS:
@@ -311,61 +767,43 @@ static int _sip_event_handler(sip_event_msg_t *event)
 			return ip_len;
 		case SIP_EVENT_REGISTERED:
 			ESP_LOGI(TAG, "SIP_EVENT_REGISTERED");
+			metrics_boot_mark("sip_registered");
+			boot_ready();
 			break;
 		case SIP_EVENT_RINGING:
 			ESP_LOGI(TAG, "ringing... RemotePhoneNum %s", (char *)event->data);
 			break;
 		case SIP_EVENT_INVITING:
 			ESP_LOGI(TAG, "SIP_EVENT_INVITING Remote Ring...");
-			xTimerStop(tmr, 0);
-			while (tone_init) vTaskDelay(1);
-			if (tone_player != NULL)
-			{
-				audio_pipeline_stop(tone_player);
-				audio_pipeline_wait_for_stop(tone_player);
-				audio_pipeline_deinit(tone_player);
-				tone_player = NULL;
-			}
-			tone_pipeline_open();
-			audio_pipeline_run(tone_player);
-			xTimerStart(tmr, 0);
+			ringback_start();
 			break;
 		case SIP_EVENT_BUSY:
 			ESP_LOGI(TAG, "SIP_EVENT_BUSY");
+			ringback_stop();
 			break;
 		case SIP_EVENT_HANGUP:
 			ESP_LOGI(TAG, "SIP_EVENT_HANGUP");
-			xTimerStop(tmr, 0);
+			ringback_stop();
 			break;
 		case SIP_EVENT_AUDIO_SESSION_BEGIN:
 			ESP_LOGI(TAG, "SIP_EVENT_AUDIO_SESSION_BEGIN");
-			xTimerStop(tmr, 0);
-			while (tone_init) vTaskDelay(1);
-			if (tone_player != NULL)
-			{
-				audio_pipeline_stop(tone_player);
-				audio_pipeline_wait_for_stop(tone_player);
-				audio_pipeline_deinit(tone_player);
-				tone_player = NULL;
-			}
-			player_pipeline_open();
-			recorder_pipeline_open();
-			audio_pipeline_run(player);
-			audio_pipeline_run(recorder);
+			call_audio_start();
 			break;
 		case SIP_EVENT_AUDIO_SESSION_END:
 			ESP_LOGI(TAG, "SIP_EVENT_AUDIO_SESSION_END");
-			audio_pipeline_stop(player);
-			audio_pipeline_wait_for_stop(player);
-			audio_pipeline_deinit(player);
-			audio_pipeline_stop(recorder);
-			audio_pipeline_wait_for_stop(recorder);
-			audio_pipeline_deinit(recorder);
-			i2s_stream_reader = NULL;
+			call_audio_stop();
 			break;
 		case SIP_EVENT_READ_AUDIO_DATA:
-			return raw_stream_read(raw_read, (char *)event->data, event->data_len);
+			len = raw_stream_read(raw_read, (char *)event->data, event->data_len);
+			levels_feed(event->data, len, true);
+			if (len > 0 && !uplink_send(event->data, len)) return 0;
+			return len;
 		case SIP_EVENT_WRITE_AUDIO_DATA:
+			if (first_audio_pending) {
+				first_audio_pending = false;
+				call_first_audio_ms = (esp_timer_get_time() - session_begin_us) / 1000;
+			}
+			levels_feed(event->data, event->data_len, false);
 			return raw_stream_write(raw_write, (char *)event->data, event->data_len);
 		case SIP_EVENT_READ_DTMF:
 			ESP_LOGI(TAG, "SIP_EVENT_READ_DTMF ID : %d ", ((char *)event->data)[0]);
@@ -374,6 +812,21 @@ static int _sip_event_handler(sip_event_msg_t *event)
 	return 0;
 }
 
+// DISCOVERY ##################################################################
+
+/* Live settings for the fleet tool, the copy is static to spare the stack */
+static size_t discovery_fields(char *buf, size_t size)
+{
+	static app_config_t cfg;
+	char ext[16];
+
+	config_snapshot(&cfg);
+	discovery_sip_user(cfg.sip_uri, ext, sizeof(ext));
+	int len = snprintf(buf, size, "\"sip\":%s,\"ext\":\"%s\",\"call\":\"%s\",\"sc_user\":\"%s\",\"idle\":%s",
+		cfg.sip_enable ? "true" : "false", ext, cfg.sip_call, cfg.sc.sc_user, caller_is_idle() ? "true" : "false");
+	return len > 0 && len < size ? len : 0;
+}
+
 // ETHERNET ###################################################################
 
 #if CONFIG_PHY_LAN8720
@@ -457,10 +910,13 @@ static esp_err_t event_handler(void *ctx, system_event_t *event)
 {
 	tcpip_adapter_ip_info_t ip;
 
+	discovery_event(ctx, event);
+
 	switch (event->event_id)
 	{
 		case SYSTEM_EVENT_ETH_CONNECTED:
 			ESP_LOGI(TAG, "Ethernet Link Up");
+			metrics_boot_mark("eth_link");
 			break;
 		case SYSTEM_EVENT_ETH_DISCONNECTED:
 			ESP_LOGI(TAG, "Ethernet Link Down");
@@ -475,6 +931,9 @@ static esp_err_t event_handler(void *ctx, system_event_t *event)
 			ESP_LOGI(TAG, "ETHIP:" IPSTR, IP2STR(&ip.ip));
 			ESP_LOGI(TAG, "ETHMASK:" IPSTR, IP2STR(&ip.netmask));
 			ESP_LOGI(TAG, "ETHGW:" IPSTR, IP2STR(&ip.gw));
+			metrics_boot_mark("ip");
+			/* Without SIP there is nothing else to wait for */
+			if (sip == NULL) boot_ready();
 			break;
 		case SYSTEM_EVENT_ETH_STOP:
 			ESP_LOGI(TAG, "Ethernet Stopped");
@@ -497,19 +956,7 @@ static esp_err_t event_handler(void *ctx, system_event_t *event)
 
 // CONFIG	#####################################################################
 
-static int jsoneq(const char *json, jsmntok_t *tok, const char *s) {
-	if (tok->type == JSMN_STRING && (int)strlen(s) == tok->end - tok->start &&
-	strncmp(json + tok->start, s, tok->end - tok->start) == 0) {
-		return 0;
-	}
-	return -1;
-}
-
-char ip_aux[16], gw_aux[16], mask_aux[16];
-char sip_uri[64];
-
-sc_config_t sc_config;
-caller_config_t caller_config;
+app_config_t app_config;
 
 // MAIN #######################################################################
 
@@ -519,6 +966,7 @@ void app_main()
 	esp_log_level_set("APP", ESP_LOG_INFO);
 	esp_log_level_set("MAIN", ESP_LOG_INFO);
 	esp_log_level_set("SERVER", ESP_LOG_INFO);
+	esp_log_level_set("CONFIG", ESP_LOG_INFO);
 	esp_log_level_set("HTTP_CLIENT", ESP_LOG_INFO);
 
 	/* Init configuration storage */
@@ -531,6 +979,7 @@ void app_main()
 		err = nvs_flash_init();
 	}
 	ESP_ERROR_CHECK(err);
+	metrics_boot_mark("nvs");
 
 	esp_chip_info_t chip_info;
 	esp_chip_info(&chip_info);
@@ -547,229 +996,20 @@ void app_main()
 	ESP_LOGI(TAG, "Running partition %s type 0x%02X subtype 0x%02X (offset 0x%08X)",
 	running->label, running->type, running->subtype, running->address);
 
-	ESP_LOGI(TAG, "Initializing SPIFFS");
-
-	esp_vfs_spiffs_conf_t conf = {
-		.base_path = "/spiffs",
-		.partition_label = NULL,
-		.max_files = 3,
-		.format_if_mount_failed = true
-	};
-
-	// Use settings defined above to initialize and mount SPIFFS filesystem.
-	esp_err_t ret = esp_vfs_spiffs_register(&conf);
-
-	if (ret != ESP_OK) {
-		if (ret == ESP_FAIL) {
-			ESP_LOGE(TAG, "Failed to mount or format filesystem");
-		} else if (ret == ESP_ERR_NOT_FOUND) {
-			ESP_LOGE(TAG, "Failed to find SPIFFS partition");
-		} else {
-			ESP_LOGE(TAG, "Failed to initialize SPIFFS (%s)", esp_err_to_name(ret));
-		}
-	}
+	/* Load configuration */
 
-	size_t total = 0, used = 0;
-	ret = esp_spiffs_info(NULL, &total, &used);
-	if (ret != ESP_OK) {
-		ESP_LOGE(TAG, "Failed to get SPIFFS partition information (%s)", esp_err_to_name(ret));
-	} else {
-		ESP_LOGI(TAG, "SPIFFS Partition size: total: %dKB, used: %dB", total / 1024, used);
-	}
+	bool config_parsed = (config_load(&app_config) == ESP_OK);
+	metrics_boot_mark("config");
 
-	/* Init configuration variables */
-
-	bool config_parsed = false;
-
-	bool use_dhcp = true;
+	bool use_dhcp = app_config.dhcp;
 	tcpip_adapter_ip_info_t info;
 	memset(&info, 0, sizeof(info));
+	ip4addr_aton(app_config.ip, &info.ip);
+	ip4addr_aton(app_config.gw, &info.gw);
+	ip4addr_aton(app_config.mask, &info.netmask);
 
-	memset(ip_aux, 0, sizeof(ip_aux));
-	memset(gw_aux, 0, sizeof(gw_aux));
-	memset(mask_aux, 0, sizeof(mask_aux));
-
-	memset(sc_config.sc_server, 0, sizeof(sc_config.sc_server));
-	memset(sc_config.sc_url, 0, sizeof(sc_config.sc_url));
-	memset(sc_config.sc_user, 0, sizeof(sc_config.sc_user));
-	memset(sc_config.sc_pass, 0, sizeof(sc_config.sc_pass));
-
-	caller_config.sip_enable = true;
-	memset(sip_uri, 0, sizeof(sip_uri));
-	memset(caller_config.sip_call, 0, sizeof(caller_config.sip_call));
-	caller_config.invert_panic_button = false;
-
-	/* Check if config file exists */
-
-	struct stat st;
-	if (stat("/spiffs/config.txt", &st) == 0) {
-
-		ESP_LOGI(TAG, "Config file found");
-		FILE* f = fopen("/spiffs/config.txt", "r");
-
-		if (f != NULL) {
-
-			char JSON_STRING[320];
-			memset(JSON_STRING, 0, sizeof(JSON_STRING));
-			fgets(JSON_STRING, sizeof(JSON_STRING), f);
-			fclose(f);
-			ESP_LOGW(TAG, "config.txt\n%s", JSON_STRING);
-
-			int i;
-			int r;
-			jsmn_parser p;
-			jsmntok_t t[32]; /* We expect no more than 32 tokens */
-
-			jsmn_init(&p);
-			r = jsmn_parse(&p, JSON_STRING, strlen(JSON_STRING), t, sizeof(t) / sizeof(t[0]));
-
-			if (r < 0) {
-				/* Config file parse error */
-				ESP_LOGE(TAG, "Failed to parse JSON: %d\n", r);
-			} else {
-				/* Assume the top-level element is an object */
-				if (r < 1 || t[0].type != JSMN_OBJECT) {
-					ESP_LOGE(TAG, "Object expected\n");
-				} else {
-					/* Config file parsed */
-					config_parsed = true;
-					char s[8];
-
-					/* Loop over all keys of the root object */
-					for (i = 1; i < r; i++) {
-						if (jsoneq(JSON_STRING, &t[i], "dhcp") == 0) {
-							printf("- DHCP: %.*s\n", t[i + 1].end - t[i + 1].start,
-							JSON_STRING + t[i + 1].start);
-							if (strncmp(JSON_STRING + t[i + 1].start, "false", t[i + 1].end - t[i + 1].start) == 0) {
-								use_dhcp = false;
-							}
-							i++;
-						} else if (jsoneq(JSON_STRING, &t[i], "ip") == 0) {
-							printf("- IP addr: %.*s\n", t[i + 1].end - t[i + 1].start,
-							JSON_STRING + t[i + 1].start);
-							strncpy(ip_aux, JSON_STRING + t[i + 1].start, t[i + 1].end - t[i + 1].start);
-							ip4addr_aton(ip_aux, &info.ip);
-							i++;
-						} else if (jsoneq(JSON_STRING, &t[i], "gw") == 0) {
-							printf("- IP Gateway: %.*s\n", t[i + 1].end - t[i + 1].start,
-							JSON_STRING + t[i + 1].start);
-							strncpy(gw_aux, JSON_STRING + t[i + 1].start, t[i + 1].end - t[i + 1].start);
-							ip4addr_aton(gw_aux, &info.gw);
-							i++;
-						} else if (jsoneq(JSON_STRING, &t[i], "mask") == 0) {
-							printf("- IP Mask: %.*s\n", t[i + 1].end - t[i + 1].start,
-							JSON_STRING + t[i + 1].start);
-							strncpy(mask_aux, JSON_STRING + t[i + 1].start, t[i + 1].end - t[i + 1].start);
-							ip4addr_aton(mask_aux, &info.netmask);
-							i++;
-						} else if (jsoneq(JSON_STRING, &t[i], "server") == 0) {
-							printf("- SC server: %.*s\n", t[i + 1].end - t[i + 1].start,
-							JSON_STRING + t[i + 1].start);
-							strncpy(sc_config.sc_server, JSON_STRING + t[i + 1].start, t[i + 1].end - t[i + 1].start);
-							i++;
-						} else if (jsoneq(JSON_STRING, &t[i], "url") == 0) {
-							printf("- SC url: %.*s\n", t[i + 1].end - t[i + 1].start,
-							JSON_STRING + t[i + 1].start);
-							strncpy(sc_config.sc_url, JSON_STRING + t[i + 1].start, t[i + 1].end - t[i + 1].start);
-							i++;
-						} else if (jsoneq(JSON_STRING, &t[i], "user") == 0) {
-							printf("- SC user: %.*s\n", t[i + 1].end - t[i + 1].start,
-							JSON_STRING + t[i + 1].start);
-							strncpy(sc_config.sc_user, JSON_STRING + t[i + 1].start, t[i + 1].end - t[i + 1].start);
-							i++;
-						} else if (jsoneq(JSON_STRING, &t[i], "pass") == 0) {
-							printf("- SC password: %.*s\n", t[i + 1].end - t[i + 1].start,
-							JSON_STRING + t[i + 1].start);
-							strncpy(sc_config.sc_pass, JSON_STRING + t[i + 1].start, t[i + 1].end - t[i + 1].start);
-							i++;
-						} else if (jsoneq(JSON_STRING, &t[i], "sip_enable") == 0) {
-							printf("- SIP enabled: %.*s\n", t[i + 1].end - t[i + 1].start,
-							JSON_STRING + t[i + 1].start);
-							if (strncmp(JSON_STRING + t[i + 1].start, "false", t[i + 1].end - t[i + 1].start) == 0) {
-								caller_config.sip_enable = false;
-							}
-							i++;
-						} else if (jsoneq(JSON_STRING, &t[i], "sip") == 0) {
-							printf("- SIP uri: %.*s\n", t[i + 1].end - t[i + 1].start,
-							JSON_STRING + t[i + 1].start);
-							strncpy(sip_uri, JSON_STRING + t[i + 1].start, t[i + 1].end - t[i + 1].start);
-							i++;
-						} else if (jsoneq(JSON_STRING, &t[i], "call") == 0) {
-							printf("- SIP call: %.*s\n", t[i + 1].end - t[i + 1].start,
-							JSON_STRING + t[i + 1].start);
-							strncpy(caller_config.sip_call, JSON_STRING + t[i + 1].start, t[i + 1].end - t[i + 1].start);
-							i++;
-						} else if (jsoneq(JSON_STRING, &t[i], "tone") == 0) {
-							printf("- VOL tone: %.*s\n", t[i + 1].end - t[i + 1].start,
-							JSON_STRING + t[i + 1].start);
-							memset(s, 0, sizeof(s));
-							strncpy(s, JSON_STRING + t[i + 1].start, t[i + 1].end - t[i + 1].start);
-							tone_volume = atoi(s);
-							i++;
-						} else if (jsoneq(JSON_STRING, &t[i], "spk") == 0) {
-							printf("- VOL speaker: %.*s\n", t[i + 1].end - t[i + 1].start,
-							JSON_STRING + t[i + 1].start);
-							memset(s, 0, sizeof(s));
-							strncpy(s, JSON_STRING + t[i + 1].start, t[i + 1].end - t[i + 1].start);
-							spk_volume = atoi(s);
-							i++;
-						} else if (jsoneq(JSON_STRING, &t[i], "mic") == 0) {
-							printf("- VOL mic: %.*s\n", t[i + 1].end - t[i + 1].start,
-							JSON_STRING + t[i + 1].start);
-							memset(s, 0, sizeof(s));
-							strncpy(s, JSON_STRING + t[i + 1].start, t[i + 1].end - t[i + 1].start);
-							mic_volume = atoi(s);
-							i++;
-						} else if (jsoneq(JSON_STRING, &t[i], "invert_panic_button") == 0) {
-							printf("- Invert panic button: %.*s\n", t[i + 1].end - t[i + 1].start,
-							JSON_STRING + t[i + 1].start);
-							if (strncmp(JSON_STRING + t[i + 1].start, "true", t[i + 1].end - t[i + 1].start) == 0) {
-								caller_config.invert_panic_button = true;
-							}
-							i++;
-						} else {
-							printf("Unexpected key: %.*s\n", t[i].end - t[i].start,
-							JSON_STRING + t[i].start);
-						}
-					}
-				}
-			}
-			// Delete
-			//unlink("/spiffs/config.txt");
-		} else {
-			ESP_LOGE(TAG, "Failed to open file for reading");
-		}
-	} else {
-		/* Create default config */
-		ESP_LOGW(TAG, "Config file not found");
-		FILE* f = fopen("/spiffs/config.txt", "w");
-		if (f != NULL) {
-			#ifdef CONFIG_DHCP
-			fprintf(f, "{\"dhcp\":true,");
-			#else
-			fprintf(f, "{\"dhcp\":false,");
-			#endif
-			fprintf(f, "\"ip\":\"" CONFIG_IP "\",");
-			fprintf(f, "\"gw\":\"" CONFIG_GW "\",");
-			fprintf(f, "\"mask\":\"" CONFIG_MASK "\",");
-			fprintf(f, "\"server\":\"" CONFIG_SERVER_IP "\",");
-			fprintf(f, "\"url\":\"" CONFIG_SERVER_URL "\",");
-			fprintf(f, "\"user\":\"" CONFIG_SERVER_USER "\",");
-			fprintf(f, "\"pass\":\"" CONFIG_SERVER_PASS "\",");
-			fprintf(f, "\"sip_enable\":true,");
-			fprintf(f, "\"sip\":\"" CONFIG_SIP_URI "\",");
-			fprintf(f, "\"call\":\"" CONFIG_SIP_CALL "\",");
-			fprintf(f, "\"tone\":-10,");
-			fprintf(f, "\"spk\":0,");
-			fprintf(f, "\"mic\":0,");
-			fprintf(f, "\"invert_panic_button\":false}");
-			fclose(f);
-			ESP_LOGW(TAG, "Default config file written");
-		} else {
-			ESP_LOGE(TAG, "Failed to open file for writing");
-		}
-		esp_restart();
-	}
+	volume_init();
+	audio_config_refresh();
 
 	ESP_LOGI(TAG, "Start io loop");
 	xTaskCreate(io_task, "io_task", 2048, NULL, tskIDLE_PRIORITY + 1, NULL);
@@ -781,6 +1021,40 @@ void app_main()
 	tcpip_adapter_init();
 	ESP_ERROR_CHECK(esp_event_loop_init(event_handler, NULL));
 
+	/* SIP service, started before the Ethernet so it registers as soon as
+	* DHCP completes. The SIP task waits for the IP on its own. */
+
+	if (app_config.sip_enable && config_parsed) {
+		/* Built once, calls only run and stop them */
+		if (g711_law_from_name(app_config.codec, &codec_law) != 0) {
+			codec_law = CODEC_LAW_DEFAULT;
+			ESP_LOGE(TAG, "Invalid codec \"%.4s\", using %s", app_config.codec, g711_law_name(codec_law));
+		}
+		ESP_LOGI(TAG, "Create audio pipelines, codec %s", g711_law_name(codec_law));
+		player_pipeline_create();
+		recorder_pipeline_create();
+		speaker_pipeline_create();
+		metrics_register("call", call_metrics);
+		metrics_register("jitter", jitter_metrics);
+		metrics_register("vad", vad_metrics);
+		metrics_register("latency", latency_metrics);
+		metrics_register("dma", dma_metrics);
+		metrics_boot_mark("audio");
+
+		ESP_LOGI(TAG, "Create SIP Service");
+		sip_config_t sip_cfg = {
+			.uri = app_config.sip_uri,
+			.event_handler = _sip_event_handler,
+			.send_options = true,
+			.acodec_type = codec_law == G711_ALAW ? SIP_ACODEC_G711A : SIP_ACODEC_G711U,
+		};
+		sip = esp_sip_init(&sip_cfg);
+		esp_sip_start(sip);
+		metrics_boot_mark("sip_start");
+	} else {
+		ESP_LOGI(TAG, "No SIP Service");
+	}
+
 	/* Ethernet */
 
 	eth_config_t config = DEFAULT_ETHERNET_PHY_CONFIG;
@@ -802,6 +1076,17 @@ void app_main()
 		ESP_ERROR_CHECK(tcpip_adapter_dhcpc_stop(TCPIP_ADAPTER_IF_ETH));
 		ESP_ERROR_CHECK(tcpip_adapter_set_ip_info(TCPIP_ADAPTER_IF_ETH, &info));
 	}
+	metrics_boot_mark("eth_start");
+
+	/* Link negotiation and DHCP take seconds and run in the background,
+	* everything below overlaps with them */
+
+	/* Web server */
+
+	ESP_LOGI(TAG, "Start server");
+	ESP_ERROR_CHECK(start_server(FW_VERSION));
+	ESP_ERROR_CHECK(stream_server_start(CONFIG_STREAM_SERVER_PORT));
+	metrics_boot_mark("http");
 
 	/* WiFi softAP */
 
@@ -822,40 +1107,41 @@ void app_main()
 
 	ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_AP));
 	ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_AP, &wifi_config));
+	metrics_boot_mark("wifi");
 
-	/* Timer for tone enerator */
+	/* Fleet discovery */
 
-	tmr = xTimerCreate("tone_player_timer", pdMS_TO_TICKS(interval), pdTRUE, (void *)tomerId, &play_tone);
-
-	/* SIP service */
-
-	if (caller_config.sip_enable && config_parsed) {
-		ESP_LOGI(TAG, "Create SIP Service");
-		sip_config_t sip_cfg = {
-			.uri = sip_uri,
-			.event_handler = _sip_event_handler,
-			.send_options = true,
-			#ifdef CONFIG_SIP_CODEC_G711A
-			.acodec_type = SIP_ACODEC_G711A,
-			#else
-			.acodec_type = SIP_ACODEC_G711U,
-			#endif
-		};
-		sip = esp_sip_init(&sip_cfg);
-		esp_sip_start(sip);
-	} else {
-		ESP_LOGI(TAG, "No SIP Service");
+	ESP_LOGI(TAG, "Start discovery");
+	discovery_config_t discovery_cfg = {
+		.model = "llamador",
+		.version = FW_VERSION,
+		.fields = discovery_fields,
+	};
+	if (discovery_start(&discovery_cfg) == ESP_OK) {
+		/* The SIP account only changes with a restart */
+		char ext[16];
+		discovery_sip_user(app_config.sip_uri, ext, sizeof(ext));
+		discovery_txt_set("ext", ext);
 	}
 
-	/* Web server */
-
-	ESP_LOGI(TAG, "Start server");
-	ESP_ERROR_CHECK(start_server(FW_VERSION));
-
 	/* Web client */
 
 	if (config_parsed){
 		ESP_LOGI(TAG, "Start client task");
-		xTaskCreate(client_task, "client_task", 2048, &sc_config, tskIDLE_PRIORITY + 1, NULL);
+		xTaskCreate(client_task, "client_task", 2048, NULL, tskIDLE_PRIORITY + 1, NULL);
+	}
+
+	/* Fleet updates */
+
+	if (strlen(app_config.ota_url) > 0) {
+		ESP_LOGI(TAG, "Start OTA pull task");
+		ota_pull_config_t ota_cfg = {
+			.url = app_config.ota_url,
+			.version = FW_VERSION,
+			.is_idle = caller_is_idle,
+		};
+		ESP_ERROR_CHECK(ota_pull_start(&ota_cfg));
 	}
+
+	metrics_boot_mark("init_done");
 }
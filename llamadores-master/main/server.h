@@ -7,6 +7,8 @@ extern int tone_volume;
 extern int spk_volume;
 extern int mic_volume;
 
+void audio_volume_set(int tone, int spk, int mic);
+
 esp_err_t start_server(int fw_version);
 
 #endif
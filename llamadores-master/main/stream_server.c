@@ -0,0 +1,551 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+#include "lwip/sockets.h"
+#include "mbedtls/sha1.h"
+#include "mbedtls/base64.h"
+
+#include "stream_server.h"
+
+static const char *TAG = "STREAM";
+
+#define STREAM_MAX_CLIENTS  4
+#define STREAM_BUF_SIZE     512     // Request headers, then incoming frames
+#define REQUEST_TIMEOUT     5000    // ms to send a complete request
+#define LEVELS_PERIOD       50      // ms, 20 Hz
+#define EVENTS_POLL         50      // ms between event queue checks
+#define EVENTS_KEEPALIVE    15000   // ms of silence before a keepalive comment
+#define EVENTS_QUEUE_LEN    32
+#define STATE_MAX           12
+
+#define WS_GUID             "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_OP_TEXT          0x1
+#define WS_OP_CLOSE         0x8
+#define WS_OP_PING          0x9
+#define WS_OP_PONG          0xA
+#define WS_MAX_PAYLOAD      125     // Single byte length, all we ever send
+
+typedef enum {
+	CLIENT_FREE = 0,
+	CLIENT_REQUEST,     // Reading the HTTP request
+	CLIENT_LEVELS,      // WebSocket level stream
+	CLIENT_EVENTS,      // Server-sent events
+} client_state_t;
+
+typedef struct {
+	int fd;
+	client_state_t state;
+	TickType_t since;       // Connected, last event sent for /events
+	bool resync;            // Events were dropped, send the whole state next
+	size_t len;
+	char buf[STREAM_BUF_SIZE];  // Output queue for /events
+} stream_client_t;
+
+typedef struct {
+	char name[16];
+	char value[40];         // JSON
+} stream_item_t;
+
+static stream_client_t clients[STREAM_MAX_CLIENTS];
+static int listen_fd = -1;
+static int levels_clients;
+static TickType_t levels_next;
+
+/* Last value of every state item, sent whole to new and lagging clients */
+static stream_item_t state[STATE_MAX];
+static int state_count;
+static portMUX_TYPE state_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static QueueHandle_t events_queue;
+static volatile int events_clients;
+static volatile bool events_lost;
+
+static void client_close(stream_client_t *c)
+{
+	if (c->state == CLIENT_LEVELS && --levels_clients == 0) {
+		audio_levels_enable(false);
+	}
+	if (c->state == CLIENT_EVENTS) events_clients--;
+	close(c->fd);
+	c->state = CLIENT_FREE;
+	ESP_LOGD(TAG, "Client %d closed", c->fd);
+}
+
+/* Whole buffer or nothing, a client that can not keep up loses the frame */
+static esp_err_t client_send(stream_client_t *c, const char *data, size_t len)
+{
+	int n = send(c->fd, data, len, MSG_DONTWAIT);
+	if (n == (int)len) return ESP_OK;
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return ESP_ERR_TIMEOUT;
+	return ESP_FAIL;
+}
+
+static void http_error(stream_client_t *c, const char *status)
+{
+	char resp[96];
+	int len = snprintf(resp, sizeof(resp), "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status);
+	client_send(c, resp, len);
+	client_close(c);
+}
+
+/* Copy the value of a request header, names are case insensitive */
+static bool header_get(const char *req, const char *name, char *val, size_t size)
+{
+	size_t name_len = strlen(name);
+	const char *line = strstr(req, "\r\n");
+
+	while (line && line[2] != '\r') {
+		line += 2;
+		if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+			const char *v = line + name_len + 1;
+			while (*v == ' ') v++;
+			size_t len = strcspn(v, "\r\n");
+			if (len >= size) len = size - 1;
+			memcpy(val, v, len);
+			val[len] = 0;
+			return true;
+		}
+		line = strstr(line, "\r\n");
+	}
+	return false;
+}
+
+static esp_err_t ws_send(stream_client_t *c, uint8_t opcode, const char *data, size_t len)
+{
+	char frame[2 + WS_MAX_PAYLOAD];
+	if (len > WS_MAX_PAYLOAD) return ESP_ERR_INVALID_SIZE;
+
+	frame[0] = 0x80 | opcode;   // FIN, server frames are not masked
+	frame[1] = len;
+	memcpy(frame + 2, data, len);
+	return client_send(c, frame, 2 + len);
+}
+
+static void ws_accept(stream_client_t *c)
+{
+	char key[64], upgrade[16];
+	if (!header_get(c->buf, "Sec-WebSocket-Key", key, 25) || strlen(key) != 24 ||
+	!header_get(c->buf, "Upgrade", upgrade, sizeof(upgrade)) || strcasecmp(upgrade, "websocket") != 0) {
+		http_error(c, "400 Bad Request");
+		return;
+	}
+
+	unsigned char sha1[20];
+	unsigned char accept[32];
+	size_t accept_len;
+	strcat(key, WS_GUID);
+	mbedtls_sha1_ret((unsigned char *)key, strlen(key), sha1);
+	mbedtls_base64_encode(accept, sizeof(accept), &accept_len, sha1, sizeof(sha1));
+
+	char resp[160];
+	int len = snprintf(resp, sizeof(resp),
+		"HTTP/1.1 101 Switching Protocols\r\n"
+		"Upgrade: websocket\r\n"
+		"Connection: Upgrade\r\n"
+		"Sec-WebSocket-Accept: %.*s\r\n\r\n", (int)accept_len, accept);
+	if (client_send(c, resp, len) != ESP_OK) {
+		client_close(c);
+		return;
+	}
+
+	/* The buffer now collects incoming frames */
+	c->len = 0;
+	c->state = CLIENT_LEVELS;
+	if (levels_clients++ == 0) {
+		audio_levels_enable(true);
+		levels_next = xTaskGetTickCount();
+	}
+	ESP_LOGI(TAG, "Levels client %d connected", c->fd);
+}
+
+static bool item_format(stream_item_t *it, const char *name, const char *fmt, va_list ap)
+{
+	if (strlen(name) >= sizeof(it->name)) return false;
+	strcpy(it->name, name);
+	int len = vsnprintf(it->value, sizeof(it->value), fmt, ap);
+	return len > 0 && len < sizeof(it->value);
+}
+
+static void event_queue(const stream_item_t *it)
+{
+	if (events_queue == NULL || xQueueSend(events_queue, it, 0) != pdPASS) events_lost = true;
+}
+
+void stream_state_set(const char *name, const char *fmt, ...)
+{
+	stream_item_t it;
+	va_list ap;
+	va_start(ap, fmt);
+	bool valid = item_format(&it, name, fmt, ap);
+	va_end(ap);
+	if (!valid) {
+		ESP_LOGE(TAG, "Invalid state item %s", name);
+		return;
+	}
+
+	bool changed = true;
+	portENTER_CRITICAL(&state_mux);
+	int i;
+	for (i = 0; i < state_count && strcmp(state[i].name, name) != 0; i++);
+	if (i < state_count && strcmp(state[i].value, it.value) == 0) {
+		changed = false;
+	} else if (i < STATE_MAX) {
+		state[i] = it;
+		if (i == state_count) state_count++;
+	}
+	portEXIT_CRITICAL(&state_mux);
+
+	if (changed && events_clients > 0) event_queue(&it);
+}
+
+void stream_event_post(const char *name, const char *fmt, ...)
+{
+	if (events_clients == 0) return;
+
+	stream_item_t it;
+	va_list ap;
+	va_start(ap, fmt);
+	bool valid = item_format(&it, name, fmt, ap);
+	va_end(ap);
+	if (valid) event_queue(&it);
+}
+
+/* Bounded per client, once full the client is resynced when it drains */
+static void events_append(stream_client_t *c, const char *data, size_t len)
+{
+	if (c->resync) return;
+	if (c->len + len > sizeof(c->buf)) {
+		ESP_LOGW(TAG, "Events client %d lagging, resync", c->fd);
+		c->resync = true;
+		return;
+	}
+	memcpy(c->buf + c->len, data, len);
+	c->len += len;
+}
+
+static void events_snapshot(stream_client_t *c)
+{
+	char msg[STREAM_BUF_SIZE];
+	size_t len = snprintf(msg, sizeof(msg), "event: state\ndata: {");
+
+	portENTER_CRITICAL(&state_mux);
+	for (int i = 0; i < state_count && len < sizeof(msg); i++) {
+		len += snprintf(msg + len, sizeof(msg) - len, "%s\"%s\":%s", i ? "," : "", state[i].name, state[i].value);
+	}
+	portEXIT_CRITICAL(&state_mux);
+
+	if (len < sizeof(msg)) len += snprintf(msg + len, sizeof(msg) - len, "}\n\n");
+	if (len < sizeof(msg)) events_append(c, msg, len);
+}
+
+static void events_flush(stream_client_t *c)
+{
+	if (c->len == 0 && c->resync) {
+		c->resync = false;
+		events_snapshot(c);
+	}
+	if (c->len == 0) return;
+
+	int n = send(c->fd, c->buf, c->len, MSG_DONTWAIT);
+	if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		client_close(c);
+	} else if (n > 0) {
+		c->len -= n;
+		memmove(c->buf, c->buf + n, c->len);
+		c->since = xTaskGetTickCount();
+	}
+}
+
+static void events_accept(stream_client_t *c)
+{
+	const char *resp =
+		"HTTP/1.1 200 OK\r\n"
+		"Content-Type: text/event-stream\r\n"
+		"Cache-Control: no-cache\r\n"
+		"Access-Control-Allow-Origin: *\r\n\r\n";
+	if (client_send(c, resp, strlen(resp)) != ESP_OK) {
+		client_close(c);
+		return;
+	}
+
+	/* The buffer now queues outgoing events, starting with the whole state */
+	c->len = 0;
+	c->resync = true;
+	c->since = xTaskGetTickCount();
+	c->state = CLIENT_EVENTS;
+	events_clients++;
+	ESP_LOGI(TAG, "Events client %d connected", c->fd);
+}
+
+static void events_dispatch(void)
+{
+	stream_item_t it;
+	while (xQueueReceive(events_queue, &it, 0) == pdPASS) {
+		char msg[80];
+		int len = snprintf(msg, sizeof(msg), "data: {\"%s\":%s}\n\n", it.name, it.value);
+		for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+			if (clients[i].state == CLIENT_EVENTS) events_append(&clients[i], msg, len);
+		}
+	}
+
+	bool lost = events_lost;
+	events_lost = false;
+
+	TickType_t now = xTaskGetTickCount();
+	for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+		stream_client_t *c = &clients[i];
+		if (c->state != CLIENT_EVENTS) continue;
+		if (lost) c->resync = true;
+		if (c->len == 0 && now - c->since > pdMS_TO_TICKS(EVENTS_KEEPALIVE)) events_append(c, ":\n\n", 3);
+		events_flush(c);
+	}
+}
+
+static void request_handle(stream_client_t *c)
+{
+	char path[32];
+	if (sscanf(c->buf, "GET %31s HTTP/1.1", path) != 1) {
+		http_error(c, "400 Bad Request");
+	} else if (strcmp(path, "/levels") == 0) {
+		ws_accept(c);
+	} else if (strcmp(path, "/events") == 0) {
+		events_accept(c);
+	} else {
+		http_error(c, "404 Not Found");
+	}
+}
+
+/* Browsers only send close and ping frames, anything else is dropped */
+static void ws_frames_handle(stream_client_t *c)
+{
+	uint8_t *b = (uint8_t *)c->buf;
+
+	while (c->len >= 2) {
+		uint8_t opcode = b[0] & 0x0f;
+		size_t payload = b[1] & 0x7f;
+		size_t hdr = 2;
+		if (payload == 126) {
+			if (c->len < 4) return;
+			payload = (b[2] << 8) | b[3];
+			hdr = 4;
+		} else if (payload == 127) {
+			client_close(c);
+			return;
+		}
+		uint8_t *mask = b + hdr;
+		if (b[1] & 0x80) hdr += 4;
+		if (hdr + payload > sizeof(c->buf)) {
+			client_close(c);
+			return;
+		}
+		if (c->len < hdr + payload) return;
+
+		uint8_t *data = b + hdr;
+		if (b[1] & 0x80) {
+			for (size_t i = 0; i < payload; i++) data[i] ^= mask[i % 4];
+		}
+
+		if (opcode == WS_OP_CLOSE) {
+			ws_send(c, WS_OP_CLOSE, (char *)data, payload < 2 ? payload : 2);
+			client_close(c);
+			return;
+		} else if (opcode == WS_OP_PING && payload <= WS_MAX_PAYLOAD) {
+			ws_send(c, WS_OP_PONG, (char *)data, payload);
+		}
+
+		c->len -= hdr + payload;
+		memmove(b, b + hdr + payload, c->len);
+	}
+}
+
+static void client_read(stream_client_t *c)
+{
+	if (c->state == CLIENT_EVENTS) {
+		/* Nothing to read, only notice the close */
+		char discard[32];
+		if (recv(c->fd, discard, sizeof(discard), 0) <= 0) client_close(c);
+		return;
+	}
+
+	int n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len, 0);
+	if (n <= 0) {
+		client_close(c);
+		return;
+	}
+	c->len += n;
+	c->buf[c->len] = 0;
+
+	if (c->state == CLIENT_REQUEST) {
+		if (strstr(c->buf, "\r\n\r\n")) {
+			request_handle(c);
+		} else if (c->len == sizeof(c->buf) - 1) {
+			http_error(c, "431 Request Header Fields Too Large");
+		}
+	} else {
+		ws_frames_handle(c);
+	}
+}
+
+static void client_accept(void)
+{
+	int fd = accept(listen_fd, NULL, NULL);
+	if (fd < 0) return;
+
+	stream_client_t *c = NULL;
+	for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+		if (clients[i].state == CLIENT_FREE) {
+			c = &clients[i];
+			break;
+		}
+	}
+	if (!c) {
+		ESP_LOGW(TAG, "Too many clients");
+		close(fd);
+		return;
+	}
+
+	int nodelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+	c->fd = fd;
+	c->state = CLIENT_REQUEST;
+	c->since = xTaskGetTickCount();
+	c->len = 0;
+}
+
+static void levels_send(void)
+{
+	audio_levels_t lv;
+	audio_levels_take(&lv);
+
+	char msg[WS_MAX_PAYLOAD];
+	int len = snprintf(msg, sizeof(msg), "{\"mic\":[%d,%d],\"spk\":[%d,%d],\"duck\":%d}",
+	lv.mic_peak, lv.mic_rms, lv.spk_peak, lv.spk_rms, lv.duck);
+
+	for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+		stream_client_t *c = &clients[i];
+		if (c->state == CLIENT_LEVELS && ws_send(c, WS_OP_TEXT, msg, len) == ESP_FAIL) {
+			client_close(c);
+		}
+	}
+}
+
+static void stream_server_task(void *arg)
+{
+	while (1)
+	{
+		fd_set rfds;
+		FD_ZERO(&rfds);
+		FD_SET(listen_fd, &rfds);
+		int maxfd = listen_fd;
+		bool pending = false;
+
+		for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+			if (clients[i].state == CLIENT_FREE) continue;
+			FD_SET(clients[i].fd, &rfds);
+			if (clients[i].fd > maxfd) maxfd = clients[i].fd;
+			if (clients[i].state == CLIENT_REQUEST) pending = true;
+		}
+
+		/* Without clients there is nothing to time, sleep until one connects */
+		struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+		struct timeval *timeout = pending ? &tv : NULL;
+		if (events_clients > 0) {
+			tv.tv_sec = 0;
+			tv.tv_usec = EVENTS_POLL * 1000;
+			timeout = &tv;
+		}
+		if (levels_clients > 0) {
+			int32_t wait = levels_next - xTaskGetTickCount();
+			if (wait < 0) wait = 0;
+			if (timeout == NULL || wait * portTICK_PERIOD_MS * 1000 < tv.tv_sec * 1000000 + tv.tv_usec) {
+				tv.tv_sec = 0;
+				tv.tv_usec = wait * portTICK_PERIOD_MS * 1000;
+				timeout = &tv;
+			}
+		}
+
+		int n = select(maxfd + 1, &rfds, NULL, NULL, timeout);
+		if (n < 0) {
+			ESP_LOGE(TAG, "select failed (%d)", errno);
+			vTaskDelay(pdMS_TO_TICKS(100));
+			continue;
+		}
+
+		/* Clients first, a slot freed here may be reused by accept */
+		TickType_t now = xTaskGetTickCount();
+		for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+			stream_client_t *c = &clients[i];
+			if (c->state == CLIENT_FREE) continue;
+			if (n > 0 && FD_ISSET(c->fd, &rfds)) {
+				client_read(c);
+			} else if (c->state == CLIENT_REQUEST && now - c->since > pdMS_TO_TICKS(REQUEST_TIMEOUT)) {
+				client_close(c);
+			}
+		}
+		if (n > 0 && FD_ISSET(listen_fd, &rfds)) client_accept();
+
+		if (levels_clients > 0 && (int32_t)(xTaskGetTickCount() - levels_next) >= 0) {
+			levels_send();
+			levels_next += pdMS_TO_TICKS(LEVELS_PERIOD);
+			if ((int32_t)(xTaskGetTickCount() - levels_next) > 0) levels_next = xTaskGetTickCount();
+		}
+		if (events_clients > 0) events_dispatch();
+	}
+}
+
+esp_err_t stream_server_start(int port)
+{
+	if (listen_fd >= 0) {
+		ESP_LOGE(TAG, "Stream server already started");
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (fd < 0) {
+		ESP_LOGE(TAG, "Failed to create socket (%d)", errno);
+		return ESP_FAIL;
+	}
+
+	int reuse = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+	};
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 2) < 0) {
+		ESP_LOGE(TAG, "Failed to listen on port %d (%d)", port, errno);
+		close(fd);
+		return ESP_FAIL;
+	}
+	listen_fd = fd;
+
+	events_queue = xQueueCreate(EVENTS_QUEUE_LEN, sizeof(stream_item_t));
+	if (events_queue == NULL) {
+		close(fd);
+		listen_fd = -1;
+		return ESP_ERR_NO_MEM;
+	}
+
+	ESP_LOGI(TAG, "Starting stream server on port %d", port);
+	if (xTaskCreate(stream_server_task, "stream_server", 4096, NULL, tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+		close(fd);
+		listen_fd = -1;
+		return ESP_ERR_NO_MEM;
+	}
+	return ESP_OK;
+}
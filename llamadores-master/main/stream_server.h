@@ -0,0 +1,54 @@
+#ifndef STREAM_SERVER_H
+#define STREAM_SERVER_H
+
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+typedef struct {
+	int mic_peak;   // 0-32767, highest sample since the previous take
+	int mic_rms;    // 0-32767, only while a call is up
+	int spk_peak;
+	int spk_rms;
+	int duck;       // dB the echo suppressor currently takes off the mic
+} audio_levels_t;
+
+/* Audio side, levels are only gathered while enabled */
+void audio_levels_enable(bool enable);
+void audio_levels_take(audio_levels_t *levels);
+
+/**
+ * @brief Update a piece of device state for the /events clients
+ *
+ * The last value of every item is kept, only changes are sent. Callable
+ * from any task, also before the server starts.
+ *
+ * @param name item name, under 16 characters
+ * @param fmt  printf style, must produce a JSON value
+ */
+void stream_state_set(const char *name, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Send a momentary event (key press, ticket) to the /events clients
+ *
+ * Dropped when nobody is connected, not part of the state.
+ */
+void stream_event_post(const char *name, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Start the live stream server
+ *
+ * Serves long lived connections the request based web server can not keep:
+ *
+ *   GET /levels  WebSocket, {"mic":[peak,rms],"spk":[peak,rms],"duck":dB}
+ *                text frames at 20 Hz
+ *   GET /events  Server-sent events, a "state" event with every state item
+ *                followed by {"name":value} deltas. Each client has a
+ *                bounded queue, a client that falls behind loses events
+ *                and gets a new "state" event once it catches up.
+ *
+ * The task sleeps in select() while no client is connected.
+ */
+esp_err_t stream_server_start(int port);
+
+#endif
@@ -0,0 +1,133 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "json_config.h"
+#include "config_store.h"
+#include "g711.h"
+
+#include "config.h"
+#include "config_fields.h"
+
+static const char *TAG = "CONFIG";
+
+/* NVS record, bump the version when megafono_config_t grows */
+#define CONFIG_RECORD_KEY      "megafono"
+#define CONFIG_RECORD_VERSION  2
+
+/* Payload of each record version, see config_store_load() */
+static const size_t config_record_sizes[CONFIG_RECORD_VERSION] = {
+	offsetof(megafono_config_t, codec),          // 1
+	sizeof(megafono_config_t),                   // 2
+};
+
+/* Last stored config, what GET /conf shows until the restart applies it */
+static megafono_config_t config_stored;
+
+static void config_defaults(megafono_config_t *cfg)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	json_config_defaults(config_fields, JSON_CONFIG_COUNT(config_fields), cfg);
+}
+
+static esp_err_t config_parse(const char *json, size_t len, megafono_config_t *cfg, const char **err_msg)
+{
+	megafono_config_t parsed;
+	config_defaults(&parsed);
+
+	const char *msg = json_config_parse(config_fields, JSON_CONFIG_COUNT(config_fields), json, len, &parsed);
+	if (!msg && !parsed.dhcp && (parsed.ip[0] == 0 || parsed.mask[0] == 0)) msg = "Static IP without ip or mask";
+	g711_law_t law;
+	if (!msg && g711_law_from_name(parsed.codec, &law) != 0) msg = "Invalid codec";
+
+	if (msg) {
+		ESP_LOGE(TAG, "Config rejected: %s", msg);
+		if (err_msg) *err_msg = msg;
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	*cfg = parsed;
+	return ESP_OK;
+}
+
+esp_err_t config_save(const char *json, size_t len, const char **err_msg)
+{
+	if (len >= CONFIG_JSON_SIZE) {
+		if (err_msg) *err_msg = "Config too large";
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	megafono_config_t cfg;
+	esp_err_t err = config_parse(json, len, &cfg, err_msg);
+	if (err != ESP_OK) return err;
+
+	err = config_store_save(CONFIG_RECORD_KEY, CONFIG_RECORD_VERSION, &cfg, sizeof(cfg));
+	if (err != ESP_OK) {
+		if (err_msg) *err_msg = "Failed to write config to storage";
+		return err;
+	}
+
+	config_stored = cfg;
+	ESP_LOGI(TAG, "Config saved, restart needed");
+	return ESP_OK;
+}
+
+size_t config_json_get(char *buf, size_t size)
+{
+	return json_config_write(config_fields, JSON_CONFIG_COUNT(config_fields), &config_stored, buf, size);
+}
+
+/* First boot after an update from the config.txt firmware */
+static esp_err_t config_migrate(megafono_config_t *cfg)
+{
+	char *json = malloc(CONFIG_JSON_SIZE);
+	if (json == NULL) return ESP_ERR_NO_MEM;
+
+	esp_err_t err = ESP_ERR_NOT_FOUND;
+	size_t len = config_store_legacy_read(json, CONFIG_JSON_SIZE);
+	if (len > 0) {
+		ESP_LOGW(TAG, "Migrating config.txt\n%s", json);
+		err = config_parse(json, len, cfg, NULL);
+		if (err == ESP_OK) err = config_store_save(CONFIG_RECORD_KEY, CONFIG_RECORD_VERSION, cfg, sizeof(*cfg));
+	}
+	free(json);
+	return err;
+}
+
+esp_err_t config_load(megafono_config_t *cfg)
+{
+	int64_t start = esp_timer_get_time();
+
+	config_defaults(cfg);
+	esp_err_t err = config_store_load(CONFIG_RECORD_KEY, config_record_sizes, CONFIG_RECORD_VERSION,
+		cfg, sizeof(*cfg));
+	if (err == ESP_OK) {
+		ESP_LOGI(TAG, "Config loaded in %d us", (int)(esp_timer_get_time() - start));
+		g711_law_t law;
+		if (g711_law_from_name(cfg->codec, &law) != 0) {
+			ESP_LOGW(TAG, "Stored codec \"%.4s\" not valid, using %s", cfg->codec, CODEC_DEFAULT);
+			snprintf(cfg->codec, sizeof(cfg->codec), "%s", CODEC_DEFAULT);
+		}
+	} else if (err == ESP_ERR_NOT_FOUND) {
+		err = config_migrate(cfg);
+		if (err == ESP_ERR_NOT_FOUND) {
+			/* Nothing stored until the first save */
+			ESP_LOGW(TAG, "No config, using defaults");
+			config_defaults(cfg);
+			err = ESP_OK;
+		}
+	}
+
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "Config not loaded (%s)", esp_err_to_name(err));
+		config_defaults(cfg);
+	}
+
+	config_stored = *cfg;
+	return err;
+}
@@ -0,0 +1,50 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+
+/* Largest config JSON accepted */
+#define CONFIG_JSON_SIZE 512
+
+typedef struct {
+	bool dhcp;
+	char ip[16];
+	char gw[16];
+	char mask[16];
+	char sip1_uri[64];
+	char sip2_uri[64];
+	int spk;
+	char codec[5];          // SDP name, "PCMA" or "PCMU", for both lines
+} megafono_config_t;
+
+/**
+ * @brief Load the config record from NVS
+ *
+ * Without a record the /spiffs/config.txt of older firmware is migrated,
+ * without either the menuconfig defaults are used in memory. SPIFFS is
+ * only mounted for the migration.
+ *
+ * @return ESP_ERR_INVALID_CRC if the record is damaged,
+ *         ESP_ERR_INVALID_ARG if config.txt does not validate,
+ *         cfg then holds the defaults
+ */
+esp_err_t config_load(megafono_config_t *cfg);
+
+/**
+ * @brief Validate and store a new config JSON, applied on the next restart
+ *
+ * @return ESP_ERR_INVALID_ARG if the config does not validate
+ */
+esp_err_t config_save(const char *json, size_t len, const char **err_msg);
+
+/**
+ * @brief Serialize the stored config as JSON
+ *
+ * @return length of the JSON, 0 if it does not fit
+ */
+size_t config_json_get(char *buf, size_t size);
+
+#endif
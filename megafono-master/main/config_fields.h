@@ -0,0 +1,32 @@
+#ifndef CONFIG_FIELDS_H
+#define CONFIG_FIELDS_H
+
+/* The config keys, included by config.c and by the host fuzzer and bench
+* in tools/config_fuzz. Needs json_config.h, config.h and the sdkconfig
+* values before it. */
+
+#ifdef CONFIG_DHCP
+#define DHCP_DEFAULT true
+#else
+#define DHCP_DEFAULT false
+#endif
+
+#ifdef CONFIG_SIP_CODEC_G711U
+#define CODEC_DEFAULT "PCMU"
+#else
+#define CODEC_DEFAULT "PCMA"
+#endif
+
+/* Every config key, its limits and the firmware default */
+static const json_config_field_t config_fields[] = {
+	JSON_CONFIG_BOOL(megafono_config_t, dhcp, "dhcp", DHCP_DEFAULT),
+	JSON_CONFIG_IP(megafono_config_t, ip, "ip", CONFIG_IP),
+	JSON_CONFIG_IP(megafono_config_t, gw, "gw", CONFIG_GW),
+	JSON_CONFIG_IP(megafono_config_t, mask, "mask", CONFIG_MASK),
+	JSON_CONFIG_STR(megafono_config_t, sip1_uri, "sip1", CONFIG_SIP_1_URI),
+	JSON_CONFIG_STR(megafono_config_t, sip2_uri, "sip2", CONFIG_SIP_2_URI),
+	JSON_CONFIG_INT(megafono_config_t, spk, "spk", -30, 30, 0),
+	JSON_CONFIG_STR(megafono_config_t, codec, "codec", CODEC_DEFAULT),
+};
+
+#endif
@@ -2,12 +2,12 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_eth.h"
-#include "esp_spiffs.h"
 #include "nvs_flash.h"
 #include "audio_element.h"
 #include "audio_pipeline.h"
@@ -20,18 +20,24 @@
 #include "board.h"
 #include "audio_mem.h"
 #include "raw_stream.h"
-#include "filter_resample.h"
 #include "esp_sip.h"
-#include "g711_decoder.h"
-#include "g711_encoder.h"
 #include "esp_ota_ops.h"
 #include "esp_flash_partitions.h"
 #include "esp_partition.h"
+#include "esp_timer.h"
 #include "server.h"
-#include "jsmn.h"
+#include "discovery.h"
+#include "metrics.h"
+#include "audio_chain.h"
+#include "dma_profile.h"
+#include "jitter_stream.h"
+#include "g711_stream.h"
+#include "config.h"
 #include "esp_event_loop.h"
 #include "driver/dac.h"
 
+#define FW_VERSION 2
+
 static const char *TAG = "MEGA_VOIP";
 
 #define I2S_SAMPLE_RATE     8000
@@ -52,10 +58,38 @@ static const char *TAG = "MEGA_VOIP";
 #define RELAY_2_GPIO GPIO_NUM_33
 
 static bool config_mode;
+static volatile bool lines_busy;    // A line ringing or in a call, for the fleet tool
 
 static sip_handle_t sip_1, sip_2;
 static audio_element_handle_t raw_write_1, raw_write_2;
 static audio_pipeline_handle_t player_1, player_2;
+static audio_chain_t player_1_chain, player_2_chain;
+static audio_element_handle_t i2s_writer_1, i2s_writer_2;
+static audio_element_handle_t jitter_1, jitter_2;
+static audio_element_handle_t sip_decoder_1, sip_decoder_2;
+
+/* The DAC DMA, shared by both lines, is stepped up after a call where its
+* buffer ran dry and back down after a run of clean ones. It is installed
+* again only while both lines are idle, under dac_lock. */
+static const dma_profile_t dac_profile = I2S_DMA_PROFILE_PAGING();
+static dma_profile_ctl_t dac_dma;
+static SemaphoreHandle_t dac_lock;
+
+/* From the config at boot, both lines offer only this one */
+static g711_law_t codec_law;
+
+#ifdef CONFIG_SIP_CODEC_G711U
+#define CODEC_LAW_DEFAULT   G711_ULAW
+#else
+#define CODEC_LAW_DEFAULT   G711_ALAW
+#endif
+
+/* Connect to first audio and setup cost of the last call, for /metrics */
+static int64_t session_begin_us[2];
+static volatile bool first_audio_pending[2];
+static int call_count, call_setup_us = -1, call_first_audio_ms = -1;
+static int call_codec_us = -1;
+static int call_wire_to_ear_ms = -1;
 
 int spk_volume = 0;
 
@@ -64,7 +98,7 @@ void max_write_value_callback(int max)
 	return;
 }
 
-static esp_err_t player_1_pipeline_open()
+static esp_err_t player_1_pipeline_create()
 {
     audio_pipeline_cfg_t pipeline_cfg = DEFAULT_AUDIO_PIPELINE_CONFIG();
     player_1 = audio_pipeline_init(&pipeline_cfg);
@@ -74,38 +108,41 @@ static esp_err_t player_1_pipeline_open()
     raw_cfg.type = AUDIO_STREAM_WRITER;
     raw_write_1 = raw_stream_init(&raw_cfg);
 
-    g711_decoder_cfg_t g711_cfg = DEFAULT_G711_DECODER_CONFIG();
-    audio_element_handle_t sip_decoder = g711_decoder_init(&g711_cfg);
+    g711_stream_cfg_t g711_cfg = DEFAULT_G711_STREAM_CONFIG();
+    g711_cfg.law = codec_law;
+    sip_decoder_1 = g711_stream_init(&g711_cfg);
+    AUDIO_NULL_CHECK(TAG, sip_decoder_1, return ESP_FAIL);
 
-    rsp_filter_cfg_t rsp_cfg = DEFAULT_RESAMPLE_FILTER_CONFIG();
-    rsp_cfg.src_rate = CODEC_SAMPLE_RATE;
-    rsp_cfg.src_ch = CODEC_CHANNELS;
-    rsp_cfg.dest_rate = I2S_SAMPLE_RATE;
-    rsp_cfg.dest_ch = I2S_CHANNELS;
-    rsp_cfg.complexity = 5;
-    audio_element_handle_t filter = rsp_filter_init(&rsp_cfg);
+    /* WiFi jitter is absorbed here instead of underrunning the DAC */
+    jitter_stream_cfg_t jitter_cfg = DEFAULT_JITTER_STREAM_CONFIG();
+    jitter_1 = jitter_stream_init(&jitter_cfg);
+    AUDIO_NULL_CHECK(TAG, jitter_1, return ESP_FAIL);
 
 		i2s_stream_cfg_t i2s_cfg = I2S_STREAM_INTERNAL_DAC_CFG_DEFAULT();
     i2s_cfg.type = AUDIO_STREAM_WRITER;
 		i2s_cfg.i2s_config.sample_rate = I2S_SAMPLE_RATE;
 		i2s_cfg.use_alc = true;
 		i2s_cfg.volume = spk_volume;
-    audio_element_handle_t i2s_stream_writer = i2s_stream_init(&i2s_cfg);
-
-		dac_output_disable(DAC_CHANNEL_1);
-
-    audio_pipeline_register(player_1, raw_write_1, "raw");
-    audio_pipeline_register(player_1, sip_decoder, "sip_dec");
-    audio_pipeline_register(player_1, filter, "filter");
-		audio_pipeline_register(player_1, i2s_stream_writer, "i2s");
-		const char *link_tag[4] = {"raw", "sip_dec", "filter", "i2s"};
-    audio_pipeline_link(player_1, &link_tag[0], 4);
-    audio_pipeline_run(player_1);
+    dma_profile_init(&dac_dma, &dac_profile, &i2s_cfg);
+    dac_lock = xSemaphoreCreateMutex();
+    i2s_writer_1 = i2s_stream_init(&i2s_cfg);
+
+    /* The internal DAC takes stereo frames, one channel per SIP line */
+    audio_chain_init(&player_1_chain, player_1, "player_1");
+    audio_chain_format(&player_1_chain, CODEC_SAMPLE_RATE, CODEC_CHANNELS, 8);
+    audio_chain_add(&player_1_chain, raw_write_1, "raw");
+    audio_chain_format(&player_1_chain, CODEC_SAMPLE_RATE, CODEC_CHANNELS, 16);
+    audio_chain_add(&player_1_chain, sip_decoder_1, "sip_dec");
+    audio_chain_add(&player_1_chain, jitter_1, "jitter");
+    audio_chain_convert(&player_1_chain, CODEC_SAMPLE_RATE, CODEC_CHANNELS, I2S_SAMPLE_RATE, I2S_CHANNELS, 5);
+    audio_chain_add(&player_1_chain, i2s_writer_1, "i2s");
+    audio_chain_dma(&player_1_chain, &i2s_cfg);
+    audio_chain_link(&player_1_chain);
     ESP_LOGI(TAG, "SIP player_1 has been created");
     return ESP_OK;
 }
 
-static esp_err_t player_2_pipeline_open()
+static esp_err_t player_2_pipeline_create()
 {
     audio_pipeline_cfg_t pipeline_cfg = DEFAULT_AUDIO_PIPELINE_CONFIG();
     player_2 = audio_pipeline_init(&pipeline_cfg);
@@ -115,37 +152,137 @@ static esp_err_t player_2_pipeline_open()
     raw_cfg.type = AUDIO_STREAM_WRITER;
     raw_write_2 = raw_stream_init(&raw_cfg);
 
-    g711_decoder_cfg_t g711_cfg = DEFAULT_G711_DECODER_CONFIG();
-    audio_element_handle_t sip_decoder = g711_decoder_init(&g711_cfg);
+    g711_stream_cfg_t g711_cfg = DEFAULT_G711_STREAM_CONFIG();
+    g711_cfg.law = codec_law;
+    sip_decoder_2 = g711_stream_init(&g711_cfg);
+    AUDIO_NULL_CHECK(TAG, sip_decoder_2, return ESP_FAIL);
 
-    rsp_filter_cfg_t rsp_cfg = DEFAULT_RESAMPLE_FILTER_CONFIG();
-    rsp_cfg.src_rate = CODEC_SAMPLE_RATE;
-    rsp_cfg.src_ch = CODEC_CHANNELS;
-    rsp_cfg.dest_rate = I2S_SAMPLE_RATE;
-    rsp_cfg.dest_ch = I2S_CHANNELS;
-    rsp_cfg.complexity = 5;
-    audio_element_handle_t filter = rsp_filter_init(&rsp_cfg);
+    /* WiFi jitter is absorbed here instead of underrunning the DAC */
+    jitter_stream_cfg_t jitter_cfg = DEFAULT_JITTER_STREAM_CONFIG();
+    jitter_2 = jitter_stream_init(&jitter_cfg);
+    AUDIO_NULL_CHECK(TAG, jitter_2, return ESP_FAIL);
 
 		i2s_stream_cfg_t i2s_cfg = I2S_STREAM_INTERNAL_DAC_CFG_DEFAULT();
     i2s_cfg.type = AUDIO_STREAM_WRITER;
 		i2s_cfg.i2s_config.sample_rate = I2S_SAMPLE_RATE;
 		i2s_cfg.use_alc = true;
 		i2s_cfg.volume = spk_volume;
-    audio_element_handle_t i2s_stream_writer = i2s_stream_init(&i2s_cfg);
-
-		dac_output_disable(DAC_CHANNEL_2);
-
-    audio_pipeline_register(player_2, raw_write_2, "raw");
-    audio_pipeline_register(player_2, sip_decoder, "sip_dec");
-    audio_pipeline_register(player_2, filter, "filter");
-		audio_pipeline_register(player_2, i2s_stream_writer, "i2s");
-		const char *link_tag[4] = {"raw", "sip_dec", "filter", "i2s"};
-    audio_pipeline_link(player_2, &link_tag[0], 4);
-    audio_pipeline_run(player_2);
+    dma_profile_apply(&dac_profile, 0, &i2s_cfg);
+    i2s_writer_2 = i2s_stream_init(&i2s_cfg);
+
+    /* The internal DAC takes stereo frames, one channel per SIP line */
+    audio_chain_init(&player_2_chain, player_2, "player_2");
+    audio_chain_format(&player_2_chain, CODEC_SAMPLE_RATE, CODEC_CHANNELS, 8);
+    audio_chain_add(&player_2_chain, raw_write_2, "raw");
+    audio_chain_format(&player_2_chain, CODEC_SAMPLE_RATE, CODEC_CHANNELS, 16);
+    audio_chain_add(&player_2_chain, sip_decoder_2, "sip_dec");
+    audio_chain_add(&player_2_chain, jitter_2, "jitter");
+    audio_chain_convert(&player_2_chain, CODEC_SAMPLE_RATE, CODEC_CHANNELS, I2S_SAMPLE_RATE, I2S_CHANNELS, 5);
+    audio_chain_add(&player_2_chain, i2s_writer_2, "i2s");
+    audio_chain_dma(&player_2_chain, &i2s_cfg);
+    audio_chain_link(&player_2_chain);
     ESP_LOGI(TAG, "SIP player_2 has been created");
     return ESP_OK;
 }
 
+/* Both players share the DAC driver, which is installed once and never
+* removed. Each line mutes the DAC channel of the other as the driver
+* install did when the pipelines were built per call. */
+static void player_start(int line, audio_chain_t *chain, audio_element_handle_t i2s, dac_channel_t mute)
+{
+    session_begin_us[line] = esp_timer_get_time();
+    xSemaphoreTake(dac_lock, portMAX_DELAY);
+    i2s_set_dac_mode(I2S_DAC_CHANNEL_BOTH_EN);
+    dac_output_disable(mute);
+    i2s_alc_volume_set(i2s, spk_volume);
+    audio_chain_run(chain);
+    xSemaphoreGive(dac_lock);
+
+    call_count++;
+    call_setup_us = esp_timer_get_time() - session_begin_us[line];
+    first_audio_pending[line] = true;
+}
+
+/* Time the far end spends in this device, estimated from the ring buffer
+* fill sampled by audio_chain, the DAC DMA and the jitter buffer target.
+* The network is not counted. */
+static int wire_to_ear_ms(int line, audio_chain_t *chain)
+{
+    jitter_buffer_stats_t jb;
+    jitter_stream_stats(line == 0 ? jitter_1 : jitter_2, &jb);
+    return audio_chain_delay_ms(chain) + jb.target_ms;
+}
+
+static void player_stop(int line, audio_chain_t *chain)
+{
+    first_audio_pending[line] = false;
+    audio_chain_report(chain);
+    call_wire_to_ear_ms = wire_to_ear_ms(line, chain);
+    ESP_LOGI(TAG, "SIP_%d latency: wire to ear %d ms", line + 1, call_wire_to_ear_ms);
+
+    call_codec_us = g711_stream_get_cpu_us(line == 0 ? sip_decoder_1 : sip_decoder_2);
+    int ms = (esp_timer_get_time() - session_begin_us[line]) / 1000;
+    ESP_LOGI(TAG, "SIP_%d %s: decode %d us over %d ms", line + 1, g711_law_name(codec_law), call_codec_us, ms);
+    audio_chain_stop(chain);
+
+    audio_chain_fill_t sink;
+    audio_chain_sink_fill(chain, &sink);
+    xSemaphoreTake(dac_lock, portMAX_DELAY);
+    dma_profile_update(&dac_dma, sink.empty, sink.samples);
+    if (dac_dma.pending && !player_1_chain.running && !player_2_chain.running) {
+        if (dma_profile_install(&dac_dma) == ESP_OK) i2s_set_pin(dac_dma.cfg.i2s_port, NULL);
+        audio_chain_dma(&player_1_chain, &dac_dma.cfg);
+        audio_chain_dma(&player_2_chain, &dac_dma.cfg);
+    }
+    xSemaphoreGive(dac_lock);
+}
+
+static void player_first_audio(int line)
+{
+    if (!first_audio_pending[line]) return;
+    first_audio_pending[line] = false;
+    call_first_audio_ms = (esp_timer_get_time() - session_begin_us[line]) / 1000;
+}
+
+static size_t call_metrics(char *buf, size_t size)
+{
+    int len = snprintf(buf, size, "{\"count\":%d,\"setup_us\":%d,\"first_audio_ms\":%d,"
+        "\"codec\":\"%s\",\"codec_us\":%d,\"wire_to_ear_ms\":%d}",
+        call_count, call_setup_us, call_first_audio_ms, g711_law_name(codec_law), call_codec_us,
+        call_wire_to_ear_ms);
+    return len > 0 && len < size ? len : 0;
+}
+
+/* One object per line */
+static size_t jitter_metrics(char *buf, size_t size)
+{
+    char line_1[192], line_2[192];
+    if (jitter_stream_stats_json(jitter_1, line_1, sizeof(line_1)) == 0) return 0;
+    if (jitter_stream_stats_json(jitter_2, line_2, sizeof(line_2)) == 0) return 0;
+    int len = snprintf(buf, size, "[%s,%s]", line_1, line_2);
+    return len > 0 && len < size ? len : 0;
+}
+
+static size_t dma_metrics(char *buf, size_t size)
+{
+    char dac[128];
+    if (dma_profile_json(&dac_dma, dac, sizeof(dac)) == 0) return 0;
+    int len = snprintf(buf, size, "{\"dac\":%s}", dac);
+    return len > 0 && len < size ? len : 0;
+}
+
+/* One object per line, live during a call and the last call's in between.
+* "empty" before the DAC points at an underrun. */
+static size_t latency_metrics(char *buf, size_t size)
+{
+    char line_1[384], line_2[384];
+    if (audio_chain_stats_json(&player_1_chain, line_1, sizeof(line_1)) == 0) return 0;
+    if (audio_chain_stats_json(&player_2_chain, line_2, sizeof(line_2)) == 0) return 0;
+    int len = snprintf(buf, size, "[{\"wire_to_ear_ms\":%d,\"player\":%s},{\"wire_to_ear_ms\":%d,\"player\":%s}]",
+        wire_to_ear_ms(0, &player_1_chain), line_1, wire_to_ear_ms(1, &player_2_chain), line_2);
+    return len > 0 && len < size ? len : 0;
+}
+
 static ip4_addr_t _get_network_ip()
 {
     tcpip_adapter_ip_info_t ip;
@@ -153,6 +290,23 @@ static ip4_addr_t _get_network_ip()
     return ip.ip;
 }
 
+/* App start to both extensions registered, with DHCP on an access point
+* in range. Association takes most of it, the bootloader adds ~300 ms that
+* the boot marks do not see. */
+#define BOOT_READY_TARGET_MS  5000
+
+static void boot_ready(void)
+{
+	if (metrics_boot_get("ready") >= 0) return;
+	if (metrics_boot_get("sip1_registered") < 0 || metrics_boot_get("sip2_registered") < 0) return;
+	metrics_boot_mark("ready");
+
+	int ms = metrics_boot_get("ready");
+	if (ms > BOOT_READY_TARGET_MS) {
+		ESP_LOGW(TAG, "Ready after %d ms, target %d ms", ms, BOOT_READY_TARGET_MS);
+	}
+}
+
 static int _sip_1_event_handler(sip_event_msg_t *event)
 {
     switch ((int)event->type) {
@@ -171,6 +325,8 @@ static int _sip_1_event_handler(sip_event_msg_t *event)
             return ip_len;
         case SIP_EVENT_REGISTERED:
             ESP_LOGI(TAG, "SIP_EVENT_REGISTERED");
+            metrics_boot_mark("sip1_registered");
+            boot_ready();
             break;
         case SIP_EVENT_RINGING:
             ESP_LOGI(TAG, "ringing... RemotePhoneNum %s", (char *)event->data);
@@ -186,17 +342,16 @@ static int _sip_1_event_handler(sip_event_msg_t *event)
             break;
         case SIP_EVENT_AUDIO_SESSION_BEGIN:
             ESP_LOGI(TAG, "SIP_EVENT_AUDIO_SESSION_BEGIN");
-            player_1_pipeline_open();
+            player_start(0, &player_1_chain, i2s_writer_1, DAC_CHANNEL_1);
             break;
         case SIP_EVENT_AUDIO_SESSION_END:
             ESP_LOGI(TAG, "SIP_EVENT_AUDIO_SESSION_END");
-            audio_pipeline_stop(player_1);
-            audio_pipeline_wait_for_stop(player_1);
-            audio_pipeline_deinit(player_1);
+            player_stop(0, &player_1_chain);
             break;
         case SIP_EVENT_READ_AUDIO_DATA:
             return 0;
         case SIP_EVENT_WRITE_AUDIO_DATA:
+            player_first_audio(0);
             return raw_stream_write(raw_write_1, (char *)event->data, event->data_len);
         case SIP_EVENT_READ_DTMF:
             ESP_LOGI(TAG, "SIP_EVENT_READ_DTMF ID : %d ", ((char *)event->data)[0]);
@@ -223,6 +378,8 @@ static int _sip_2_event_handler(sip_event_msg_t *event)
             return ip_len;
         case SIP_EVENT_REGISTERED:
             ESP_LOGI(TAG, "SIP_EVENT_REGISTERED");
+            metrics_boot_mark("sip2_registered");
+            boot_ready();
             break;
         case SIP_EVENT_RINGING:
             ESP_LOGI(TAG, "ringing... RemotePhoneNum %s", (char *)event->data);
@@ -238,17 +395,16 @@ static int _sip_2_event_handler(sip_event_msg_t *event)
             break;
         case SIP_EVENT_AUDIO_SESSION_BEGIN:
             ESP_LOGI(TAG, "SIP_EVENT_AUDIO_SESSION_BEGIN");
-            player_2_pipeline_open();
+            player_start(1, &player_2_chain, i2s_writer_2, DAC_CHANNEL_2);
             break;
         case SIP_EVENT_AUDIO_SESSION_END:
             ESP_LOGI(TAG, "SIP_EVENT_AUDIO_SESSION_END");
-            audio_pipeline_stop(player_2);
-            audio_pipeline_wait_for_stop(player_2);
-            audio_pipeline_deinit(player_2);
+            player_stop(1, &player_2_chain);
             break;
         case SIP_EVENT_READ_AUDIO_DATA:
             return 0;
         case SIP_EVENT_WRITE_AUDIO_DATA:
+            player_first_audio(1);
             return raw_stream_write(raw_write_2, (char *)event->data, event->data_len);
         case SIP_EVENT_READ_DTMF:
             ESP_LOGI(TAG, "SIP_EVENT_READ_DTMF ID : %d ", ((char *)event->data)[0]);
@@ -394,7 +550,8 @@ static void main_loop_task(void *arg)
 			}
 		}
 
-		if(sip_1_state > SIP_STATE_REGISTERED || sip_2_state > SIP_STATE_REGISTERED){
+		lines_busy = sip_1_state > SIP_STATE_REGISTERED || sip_2_state > SIP_STATE_REGISTERED;
+		if(lines_busy){
 			gpio_set_level(MUTE_GPIO, 0);
 		} else {
 			gpio_set_level(MUTE_GPIO, 1);
@@ -404,16 +561,10 @@ static void main_loop_task(void *arg)
 	}
 }
 
-static int jsoneq(const char *json, jsmntok_t *tok, const char *s) {
-  if (tok->type == JSMN_STRING && (int)strlen(s) == tok->end - tok->start &&
-      strncmp(json + tok->start, s, tok->end - tok->start) == 0) {
-    return 0;
-  }
-  return -1;
-}
-
 static esp_err_t event_handler(void *ctx, system_event_t *event)
 {
+    discovery_event(ctx, event);
+
     switch (event->event_id) {
 			case SYSTEM_EVENT_AP_STACONNECTED:
         ESP_LOGI(TAG, "station:"MACSTR" join, AID=%d",
@@ -432,8 +583,17 @@ static esp_err_t event_handler(void *ctx, system_event_t *event)
     return ESP_OK;
 }
 
-char ip_aux[16], gw_aux[16], mask_aux[16];
-char sip1_uri[64], sip2_uri[64];
+static megafono_config_t config;
+
+static size_t discovery_fields(char *buf, size_t size)
+{
+	char ext1[16], ext2[16];
+	discovery_sip_user(config.sip1_uri, ext1, sizeof(ext1));
+	discovery_sip_user(config.sip2_uri, ext2, sizeof(ext2));
+	int len = snprintf(buf, size, "\"ext1\":\"%s\",\"ext2\":\"%s\",\"config_mode\":%s,\"idle\":%s",
+		ext1, ext2, config_mode ? "true" : "false", lines_busy ? "false" : "true");
+	return len > 0 && len < size ? len : 0;
+}
 
 void app_main()
 {
@@ -448,6 +608,7 @@ void app_main()
       err = nvs_flash_init();
     }
     ESP_ERROR_CHECK(err);
+		metrics_boot_mark("nvs");
 
 		esp_chip_info_t chip_info;
 		esp_chip_info(&chip_info);
@@ -464,157 +625,9 @@ void app_main()
 	  ESP_LOGI(TAG, "Running partition %s type 0x%02X subtype 0x%02X (offset 0x%08X)",
 	             running->label, running->type, running->subtype, running->address);
 
-		ESP_LOGI(TAG, "Initializing SPIFFS");
-
-	  esp_vfs_spiffs_conf_t conf = {
-	    .base_path = "/spiffs",
-	    .partition_label = NULL,
-	    .max_files = 5,
-	    .format_if_mount_failed = true
-	  };
-
-	  // Use settings defined above to initialize and mount SPIFFS filesystem.
-	  // Note: esp_vfs_spiffs_register is an all-in-one convenience function.
-	  esp_err_t ret = esp_vfs_spiffs_register(&conf);
-
-	  if (ret != ESP_OK) {
-	      if (ret == ESP_FAIL) {
-	          ESP_LOGE(TAG, "Failed to mount or format filesystem");
-	      } else if (ret == ESP_ERR_NOT_FOUND) {
-	          ESP_LOGE(TAG, "Failed to find SPIFFS partition");
-	      } else {
-	          ESP_LOGE(TAG, "Failed to initialize SPIFFS (%s)", esp_err_to_name(ret));
-	      }
-	      //return;
-	  }
-
-	  size_t total = 0, used = 0;
-	  ret = esp_spiffs_info(NULL, &total, &used);
-	  if (ret != ESP_OK) {
-	      ESP_LOGE(TAG, "Failed to get SPIFFS partition information (%s)", esp_err_to_name(ret));
-	  } else {
-	      ESP_LOGI(TAG, "SPIFFS Partition size: total: %dkB, used: %dB", total/(1024), used);
-	  }
-
-		bool use_dhcp = true;
-
-		tcpip_adapter_ip_info_t info;
-
-		memset(&info, 0, sizeof(info));
-
-		memset(ip_aux, 0, sizeof(ip_aux));
-		memset(gw_aux, 0, sizeof(gw_aux));
-		memset(mask_aux, 0, sizeof(mask_aux));
-
-		memset(sip1_uri, 0, sizeof(sip1_uri));
-		memset(sip2_uri, 0, sizeof(sip2_uri));
-
-		// Check if config file exists
-	  struct stat st;
-
-	  if (stat("/spiffs/config.txt", &st) == 0) {
-			ESP_LOGI(TAG, "Config file found");
-			FILE* f = fopen("/spiffs/config.txt", "r");
-			if (f != NULL) {
-				char JSON_STRING[256];
-				memset(JSON_STRING, 0, sizeof(JSON_STRING));
-				fgets(JSON_STRING, sizeof(JSON_STRING), f);
-				fclose(f);
-				ESP_LOGW(TAG, "config.txt\n%s", JSON_STRING);
-
-				int i;
-				int r;
-				jsmn_parser p;
-				jsmntok_t t[32]; /* We expect no more than 32 tokens */
-
-				jsmn_init(&p);
-				r = jsmn_parse(&p, JSON_STRING, strlen(JSON_STRING), t, sizeof(t) / sizeof(t[0]));
-
-				if (r < 0) {
-					ESP_LOGE(TAG, "Failed to parse JSON: %d\n", r);
-				} else {
-					/* Assume the top-level element is an object */
-					if (r < 1 || t[0].type != JSMN_OBJECT) {
-						ESP_LOGE(TAG, "Object expected\n");
-					} else {
-						/* Loop over all keys of the root object */
-						for (i = 1; i < r; i++) {
-							if (jsoneq(JSON_STRING, &t[i], "dhcp") == 0) {
-								printf("- DHCP: %.*s\n", t[i + 1].end - t[i + 1].start,
-									JSON_STRING + t[i + 1].start);
-								if (strncmp(JSON_STRING + t[i + 1].start, "false", t[i + 1].end - t[i + 1].start) == 0) {
-									use_dhcp = false;
-								}
-								i++;
-							} else if (jsoneq(JSON_STRING, &t[i], "ip") == 0) {
-								printf("- IP addr: %.*s\n", t[i + 1].end - t[i + 1].start,
-									JSON_STRING + t[i + 1].start);
-								strncpy(ip_aux, JSON_STRING + t[i + 1].start, t[i + 1].end - t[i + 1].start);
-								ip4addr_aton(ip_aux, &info.ip);
-								i++;
-							} else if (jsoneq(JSON_STRING, &t[i], "gw") == 0) {
-								printf("- IP Gateway: %.*s\n", t[i + 1].end - t[i + 1].start,
-									JSON_STRING + t[i + 1].start);
-								strncpy(gw_aux, JSON_STRING + t[i + 1].start, t[i + 1].end - t[i + 1].start);
-								ip4addr_aton(gw_aux, &info.gw);
-								i++;
-							} else if (jsoneq(JSON_STRING, &t[i], "mask") == 0) {
-								printf("- IP Mask: %.*s\n", t[i + 1].end - t[i + 1].start,
-									JSON_STRING + t[i + 1].start);
-								strncpy(mask_aux, JSON_STRING + t[i + 1].start, t[i + 1].end - t[i + 1].start);
-								ip4addr_aton(mask_aux, &info.netmask);
-								i++;
-							} else 	if (jsoneq(JSON_STRING, &t[i], "sip1") == 0) {
-								printf("- SIP 1 uri: %.*s\n", t[i + 1].end - t[i + 1].start,
-									JSON_STRING + t[i + 1].start);
-								strncpy(sip1_uri, JSON_STRING + t[i + 1].start, t[i + 1].end - t[i + 1].start);
-								i++;
-							} else if (jsoneq(JSON_STRING, &t[i], "sip2") == 0) {
-								printf("- SIP 2 uri: %.*s\n", t[i + 1].end - t[i + 1].start,
-									JSON_STRING + t[i + 1].start);
-								strncpy(sip2_uri, JSON_STRING + t[i + 1].start, t[i + 1].end - t[i + 1].start);
-								i++;
-							} else if (jsoneq(JSON_STRING, &t[i], "spk") == 0) {
-								printf("- VOL speaker: %.*s\n", t[i + 1].end - t[i + 1].start,
-									JSON_STRING + t[i + 1].start);
-								char s[8];
-								strncpy(s, JSON_STRING + t[i + 1].start, t[i + 1].end - t[i + 1].start);
-								spk_volume = atoi(s);
-								i++;
-							} else {
-								printf("Unexpected key: %.*s\n", t[i].end - t[i].start,
-									JSON_STRING + t[i].start);
-							}
-						}
-					}
-				}
-				// Delete
-				//unlink("/spiffs/config.txt");
-			} else {
-					ESP_LOGE(TAG, "Failed to open file for reading");
-			}
-		} else {
-			ESP_LOGW(TAG, "Config file not found");
-			FILE* f = fopen("/spiffs/config.txt", "w");
-			if (f != NULL) {
-	#ifdef CONFIG_DHCP
-				fprintf(f, "{\"dhcp\":true,");
-	#else
-				fprintf(f, "{\"dhcp\":false,");
-	#endif
-				fprintf(f, "\"ip\":\"" CONFIG_IP "\",");
-				fprintf(f, "\"gw\":\"" CONFIG_GW "\",");
-				fprintf(f, "\"mask\":\"" CONFIG_MASK "\",");
-				fprintf(f, "\"sip1\":\"" CONFIG_SIP_1_URI "\",");
-				fprintf(f, "\"sip2\":\"" CONFIG_SIP_2_URI "\",");
-				fprintf(f, "\"spk\":0}");
-				fclose(f);
-				ESP_LOGW(TAG, "Default config file written");
-			} else {
-				ESP_LOGE(TAG, "Failed to open file for writing");
-			}
-			esp_restart();
-		}
+		config_load(&config);
+		spk_volume = config.spk;
+		metrics_boot_mark("config");
 
 		// Config mode?
 
@@ -622,6 +635,8 @@ void app_main()
 		gpio_pad_select_gpio(BTN_1_GPIO);
 		gpio_set_direction(BTN_1_GPIO, GPIO_MODE_INPUT);
 
+		esp_periph_handle_t wifi_handle = NULL;
+
 		config_mode = false;
 		if (!gpio_get_level(BTN_1_GPIO)) {
 			vTaskDelay(100 / portTICK_PERIOD_MS);
@@ -664,10 +679,14 @@ void app_main()
 
 			tcpip_adapter_init();
 
-			if (use_dhcp) {
+			if (config.dhcp) {
 				ESP_LOGI(TAG, "Using DHCP");
 			} else {
 				ESP_LOGI(TAG, "Using static IP");
+				tcpip_adapter_ip_info_t info = { 0 };
+				ip4addr_aton(config.ip, &info.ip);
+				ip4addr_aton(config.gw, &info.gw);
+				ip4addr_aton(config.mask, &info.netmask);
 				ESP_ERROR_CHECK(tcpip_adapter_dhcpc_stop(TCPIP_ADAPTER_IF_STA));
 				ESP_ERROR_CHECK(tcpip_adapter_set_ip_info(TCPIP_ADAPTER_IF_STA, &info));
 			}
@@ -682,23 +701,33 @@ void app_main()
 	        .password = CONFIG_STA_PASS,
 	    };
 
-	    esp_periph_handle_t wifi_handle = periph_wifi_init(&wifi_cfg);
+	    wifi_handle = periph_wifi_init(&wifi_cfg);
 
 	    esp_periph_start(set, wifi_handle);
 
-	    periph_wifi_wait_for_connected(wifi_handle, portMAX_DELAY);
-
+			/* Built once, calls only run and stop them */
+			if (g711_law_from_name(config.codec, &codec_law) != 0) {
+				codec_law = CODEC_LAW_DEFAULT;
+				ESP_LOGE(TAG, "Invalid codec \"%.4s\", using %s", config.codec, g711_law_name(codec_law));
+			}
+			ESP_LOGI(TAG, "Create audio pipelines, codec %s", g711_law_name(codec_law));
+			player_1_pipeline_create();
+			player_2_pipeline_create();
+			metrics_register("call", call_metrics);
+			metrics_register("jitter", jitter_metrics);
+			metrics_register("latency", latency_metrics);
+			metrics_register("dma", dma_metrics);
+			metrics_boot_mark("audio");
+
+			/* Start SIP while WiFi associates, the services keep retrying the
+			 * registration until the interface is up */
 			ESP_LOGI(TAG, "Create SIP_1 Service");
 			
 			sip_config_t sip_1_cfg = {
-					.uri = sip1_uri,
+					.uri = config.sip1_uri,
 					.event_handler = _sip_1_event_handler,
 					.send_options = true,
-		#ifdef CONFIG_SIP_CODEC_G711A
-					.acodec_type = SIP_ACODEC_G711A,
-		#else
-					.acodec_type = SIP_ACODEC_G711U,
-		#endif
+					.acodec_type = codec_law == G711_ALAW ? SIP_ACODEC_G711A : SIP_ACODEC_G711U,
 			};
 			sip_1 = esp_sip_init(&sip_1_cfg);
 			esp_sip_start(sip_1);
@@ -706,22 +735,42 @@ void app_main()
 			ESP_LOGI(TAG, "Create SIP_2 Service");
 
 			sip_config_t sip_2_cfg = {
-					.uri = sip2_uri,
+					.uri = config.sip2_uri,
 					.event_handler = _sip_2_event_handler,
 					.send_options = true,
-		#ifdef CONFIG_SIP_CODEC_G711A
-					.acodec_type = SIP_ACODEC_G711A,
-		#else
-					.acodec_type = SIP_ACODEC_G711U,
-		#endif
+					.acodec_type = codec_law == G711_ALAW ? SIP_ACODEC_G711A : SIP_ACODEC_G711U,
 			};
 			sip_2 = esp_sip_init(&sip_2_cfg);
 			esp_sip_start(sip_2);
+			metrics_boot_mark("sip_start");
 		}
 
 		ESP_LOGI(TAG, "Start server");
-		ESP_ERROR_CHECK(start_server());
+		ESP_ERROR_CHECK(start_server(FW_VERSION));
+		metrics_boot_mark("http");
+
+		if (!config_mode) {
+			periph_wifi_wait_for_connected(wifi_handle, portMAX_DELAY);
+			metrics_boot_mark("wifi_ip");
+		}
+
+		/* In STA mode the WiFi peripheral owns the event loop, mDNS picks up
+		 * the interface that is already connected at this point */
+		ESP_LOGI(TAG, "Start discovery");
+		discovery_config_t discovery_cfg = {
+			.model = "megafono",
+			.version = FW_VERSION,
+			.fields = discovery_fields,
+		};
+		if (discovery_start(&discovery_cfg) == ESP_OK) {
+			char ext[16];
+			discovery_sip_user(config.sip1_uri, ext, sizeof(ext));
+			discovery_txt_set("ext1", ext);
+			discovery_sip_user(config.sip2_uri, ext, sizeof(ext));
+			discovery_txt_set("ext2", ext);
+		}
 
 		ESP_LOGI(TAG, "Start main loop");
 		xTaskCreate(main_loop_task, "main_loop_task", 2048, NULL, tskIDLE_PRIORITY + 1, NULL);
+		metrics_boot_mark("init_done");
 }
@@ -1 +1 @@
-esp_err_t start_server(void);
\ No newline at end of file
+esp_err_t start_server(int fw_version);
\ No newline at end of file
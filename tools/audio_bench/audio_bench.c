@@ -0,0 +1,216 @@
+/* Medición en la PC del audio de audio_dsp, el mismo código que corre en
+* cada llamada.
+*
+*   make && ./audio_bench [-n iteraciones] [-c PCMA|PCMU] [-j ms] [-l %]
+*                         [-i mic.wav] [-f lejano.wav] [-o dir]
+*                         [-g golden.txt] [-u golden.txt]
+*
+* Primero verifica que el G.711 por tablas dé exactamente lo mismo que la
+* versión de referencia y compara los tiempos de ambas sobre bloques de
+* 20 ms. Después corre las cadenas de captura y reproducción del llamador
+* en pasos de 10 ms (ver chains.c) e informa el tiempo de cada etapa y la
+* demora de cada sentido. Al final pasa un impulso, un barrido y dos tonos
+* sólo por el decimador.
+*
+*   -i  micrófono, WAV mono de 16 bits a 48 kHz; sin -i una voz sintética
+*   -f  extremo lejano, WAV mono de 16 bits a 8 kHz; sin -f otra voz
+*   -o  escribe ahí uplink.wav (lo enviado) y downlink.wav (el parlante)
+*   -j  jitter de la red en ms (20), -l pérdida de paquetes en % (1)
+*   -g  compara las salidas con una referencia, -u la escribe
+*
+* El código de salida es 1 si alguna verificación falla, "make check" corre
+* la comparación con golden.txt y con dos referencias con 5% de pérdida,
+* golden_loss5.txt y golden_loss5_j0.txt (sin jitter). Los tiempos son de la PC, sirven para
+* comparar versiones entre sí; en el equipo los tiempos por llamada están
+* en el log y en /metrics. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "g711.h"
+
+#include "bench.h"
+
+#define FRAME       160     // 20 ms at 8 kHz
+
+volatile uint32_t bench_sink;
+static int failures;
+
+void bench_check(int ok, const char *what)
+{
+	printf("  %-40s %s\n", what, ok ? "ok" : "FALLA");
+	if (!ok) failures++;
+}
+
+static void report(const char *what, double ns, int frames)
+{
+	printf("  %-40s %8.1f ns/bloque\n", what, ns / frames);
+}
+
+/* Speech-like test signal, a decaying mix of tones and noise with the
+* large dynamic range that exercises every segment */
+static void test_signal(int16_t *pcm, int count)
+{
+	uint32_t seed = 1;
+	for (int i = 0; i < count; i++) {
+		seed = seed * 1664525 + 1013904223;
+		int env = (i / 400) % 8;
+		int s = ((int)(seed >> 16) - 32768) >> (env + 1);
+		s += (i * 37 % 200 - 100) * (64 >> env);
+		pcm[i] = s > INT16_MAX ? INT16_MAX : s < INT16_MIN ? INT16_MIN : s;
+	}
+}
+
+// G.711 ######################################################################
+
+static uint8_t ref_encode(g711_law_t law, int16_t pcm)
+{
+	return law == G711_ALAW ? g711_alaw_encode(pcm) : g711_ulaw_encode(pcm);
+}
+
+static int16_t ref_decode(g711_law_t law, uint8_t code)
+{
+	return law == G711_ALAW ? g711_alaw_decode(code) : g711_ulaw_decode(code);
+}
+
+static void g711_check(g711_law_t law)
+{
+	static int16_t pcm[65536];
+	static uint8_t code[65536];
+	char what[64];
+
+	for (int i = 0; i < 65536; i++) pcm[i] = i - 32768;
+	g711_encode(law, pcm, code, 65536);
+	int ok = 1;
+	for (int i = 0; i < 65536; i++) ok &= code[i] == ref_encode(law, pcm[i]);
+	snprintf(what, sizeof(what), "%s codifica las 65536 muestras", g711_law_name(law));
+	bench_check(ok, what);
+
+	uint8_t all[256];
+	int16_t out[256];
+	for (int i = 0; i < 256; i++) all[i] = i;
+	g711_decode(law, all, out, 256);
+	ok = 1;
+	for (int i = 0; i < 256; i++) ok &= out[i] == ref_decode(law, all[i]);
+	snprintf(what, sizeof(what), "%s decodifica los 256 códigos", g711_law_name(law));
+	bench_check(ok, what);
+
+	/* The layouts g711_stream uses: encode in place, decode from the upper half */
+	int16_t buf[FRAME + 3];
+	test_signal(buf, FRAME + 3);
+	memcpy(pcm, buf, sizeof(buf));
+	g711_encode(law, buf, (uint8_t *)buf, FRAME + 3);
+	ok = 1;
+	for (int i = 0; i < FRAME + 3; i++) ok &= ((uint8_t *)buf)[i] == ref_encode(law, pcm[i]);
+	int n = FRAME + 3;
+	uint8_t *upper = (uint8_t *)buf + n;
+	memcpy(code, buf, n);
+	memcpy(upper, code, n);
+	g711_decode(law, upper, buf, n);
+	for (int i = 0; i < n; i++) ok &= buf[i] == ref_decode(law, code[i]);
+	snprintf(what, sizeof(what), "%s en el mismo buffer", g711_law_name(law));
+	bench_check(ok, what);
+}
+
+static void g711_bench(g711_law_t law, int iterations)
+{
+	int16_t pcm[FRAME], out[FRAME];
+	uint8_t code[FRAME];
+	char what[64];
+	test_signal(pcm, FRAME);
+	uint32_t acc = 0;
+
+	double t = bench_now_ns();
+	for (int it = 0; it < iterations; it++) {
+		for (int i = 0; i < FRAME; i++) code[i] = ref_encode(law, pcm[i]);
+		acc += code[it % FRAME];
+	}
+	double ref_enc = bench_now_ns() - t;
+
+	t = bench_now_ns();
+	for (int it = 0; it < iterations; it++) {
+		g711_encode(law, pcm, code, FRAME);
+		acc += code[it % FRAME];
+	}
+	double enc = bench_now_ns() - t;
+
+	t = bench_now_ns();
+	for (int it = 0; it < iterations; it++) {
+		for (int i = 0; i < FRAME; i++) out[i] = ref_decode(law, code[i]);
+		acc += out[it % FRAME];
+	}
+	double ref_dec = bench_now_ns() - t;
+
+	t = bench_now_ns();
+	for (int it = 0; it < iterations; it++) {
+		g711_decode(law, code, out, FRAME);
+		acc += out[it % FRAME];
+	}
+	double dec = bench_now_ns() - t;
+	bench_sink = acc;
+
+	snprintf(what, sizeof(what), "%s codificar, referencia", g711_law_name(law));
+	report(what, ref_enc, iterations);
+	snprintf(what, sizeof(what), "%s codificar, tablas (x%.1f)", g711_law_name(law), ref_enc / enc);
+	report(what, enc, iterations);
+	snprintf(what, sizeof(what), "%s decodificar, referencia", g711_law_name(law));
+	report(what, ref_dec, iterations);
+	snprintf(what, sizeof(what), "%s decodificar, tablas (x%.1f)", g711_law_name(law), ref_dec / dec);
+	report(what, dec, iterations);
+}
+
+// MAIN #######################################################################
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "uso: %s [-n iteraciones] [-c PCMA|PCMU] [-j ms] [-l %%] [-i mic.wav] [-f lejano.wav]"
+		" [-o dir] [-g golden.txt] [-u golden.txt]\n", name);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = 200000;
+	chains_cfg_t cfg = {
+		.law = G711_ALAW,
+		.jitter_ms = 20,
+		.loss_pct = 1,
+	};
+
+	int opt;
+	g711_law_t law;
+	while ((opt = getopt(argc, argv, "n:c:j:l:i:f:o:g:u:")) != -1) {
+		switch (opt) {
+		case 'n': iterations = atoi(optarg); break;
+		case 'c':
+			if (g711_law_from_name(optarg, &law) != 0) usage(argv[0]);
+			cfg.law = law;
+			break;
+		case 'j': cfg.jitter_ms = atoi(optarg); break;
+		case 'l': cfg.loss_pct = atoi(optarg); break;
+		case 'i': cfg.mic_path = optarg; break;
+		case 'f': cfg.far_path = optarg; break;
+		case 'o': cfg.out_dir = optarg; break;
+		case 'g': cfg.golden = optarg; break;
+		case 'u': cfg.update = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (iterations <= 0 || cfg.jitter_ms < 0 || cfg.loss_pct < 0 || cfg.loss_pct > 100 || optind != argc) {
+		usage(argv[0]);
+	}
+
+	printf("G.711\n");
+	g711_check(G711_ALAW);
+	g711_check(G711_ULAW);
+	g711_bench(G711_ALAW, iterations);
+	g711_bench(G711_ULAW, iterations);
+
+	chains_run(&cfg);
+
+	if (failures) printf("%d verificaciones fallaron\n", failures);
+	return failures ? 1 : 0;
+}
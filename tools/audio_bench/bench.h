@@ -0,0 +1,64 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_CYCLES() __rdtsc()
+#else
+#define BENCH_CYCLES() 0
+#endif
+
+/* Time spent in one processing stage, summed over the run */
+typedef struct {
+	const char *name;
+	double ns;
+	uint64_t cycles;
+	double start_ns;
+	uint64_t start_cycles;
+} bench_stage_t;
+
+static inline double bench_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static inline void bench_begin(bench_stage_t *st)
+{
+	st->start_cycles = BENCH_CYCLES();
+	st->start_ns = bench_now_ns();
+}
+
+static inline void bench_end(bench_stage_t *st)
+{
+	st->ns += bench_now_ns() - st->start_ns;
+	st->cycles += BENCH_CYCLES() - st->start_cycles;
+}
+
+/* Prints the result, a failure makes the exit code 1 */
+void bench_check(int ok, const char *what);
+
+/* Keeps the compiler from dropping the work being timed */
+extern volatile uint32_t bench_sink;
+
+/**
+ * @brief Run the capture and playback chains, see audio_bench.c
+ */
+typedef struct {
+	const char *mic_path;       // 48 kHz, NULL for the built in near end
+	const char *far_path;       // 8 kHz, NULL for the built in far end
+	const char *out_dir;        // For uplink.wav and downlink.wav, may be NULL
+	const char *golden;         // Compared with, may be NULL
+	const char *update;         // Rewritten, may be NULL
+	int law;                    // g711_law_t
+	int jitter_ms;
+	int loss_pct;
+} chains_cfg_t;
+
+void chains_run(const chains_cfg_t *cfg);
+
+#endif
@@ -0,0 +1,498 @@
+/* The capture and playback chains of the llamador, run on the host in 10 ms
+* ticks of simulated time.
+*
+* Capture:  mic 48 kHz + echo -> decimator -> echo canceller -> VAD -> G.711
+* Playback: far end -> G.711 -> network (delay, jitter, loss) -> G.711
+*           -> jitter buffer -> speaker, which is also the echo reference
+*
+* The echo is the speaker output 40 ms later and 12 dB down. */
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decimator.h"
+#include "echo_canceller.h"
+#include "g711.h"
+#include "jitter_buffer.h"
+#include "tone_gen.h"
+#include "vad.h"
+
+#include "bench.h"
+#include "wav.h"
+
+#define RATE            8000
+#define MIC_RATE        48000
+#define TICK            80          // 10 ms at 8 kHz
+#define TICK_MIC        (TICK * DECIMATOR_FACTOR)
+#define PACKET          160         // 20 ms, as esp_sip sends them
+#define SYNTH_SECONDS   12
+#define NET_BASE_MS     20
+#define PENDING_MAX     64
+#define ECHO_DELAY      320         // 40 ms
+#define ECHO_SHIFT      2           // 12 dB
+#define AEC_TAPS        256
+#define JB_MIN_MS       20          // As jitter_stream
+#define JB_MAX_MS       200
+#define MAX_LAG_MS      400
+#define VAD_HOLD_DB     -6          // As the llamador
+#define ROOM_NOISE      6           // Shift of the full scale noise, about -50 dBFS
+
+/* Built in voices, tones with noise on top so the delay correlation has a
+* single peak. A 4 s turn each, the near end starts 200 ms before the far
+* end stops for some double talk. */
+static const tone_gen_tone_t near_voice = {
+	.level = -20, .repeat = true, .steps = 3,
+	.step = { { { 0, 0 }, 0, 1400 }, { { 220, 1320 }, 500, 100 }, { { 180, 900 }, 600, 1400 } },
+};
+
+static const tone_gen_tone_t far_voice = {
+	.level = -18, .repeat = true, .steps = 2,
+	.step = { { { 300, 1100 }, 800, 100 }, { { 200, 800 }, 700, 2400 } },
+};
+
+static uint32_t seed = 1;
+
+static int16_t noise(int shift)
+{
+	seed = seed * 1664525 + 1013904223;
+	return (int16_t)(seed >> 16) >> shift;
+}
+
+/* The network model draws from its own state, so the losses do not depend
+* on how much noise the voices and the room took before */
+static uint32_t net_seed = 1;
+
+static uint32_t net_random(void)
+{
+	net_seed ^= net_seed << 13;
+	net_seed ^= net_seed >> 17;
+	net_seed ^= net_seed << 5;
+	return net_seed;
+}
+
+static int16_t sat(int32_t s)
+{
+	return s > INT16_MAX ? INT16_MAX : s < INT16_MIN ? INT16_MIN : s;
+}
+
+static int16_t *synth(const tone_gen_tone_t *tone, int rate, int count)
+{
+	int16_t *pcm = malloc(count * sizeof(int16_t));
+	tone_gen_t gen;
+	tone_gen_init(&gen, tone, rate);
+	tone_gen_fill(&gen, pcm, count, 1);
+	for (int i = 0; i < count; i++) {
+		if (pcm[i] != 0) pcm[i] = sat(pcm[i] + noise(3) / 8);
+	}
+	return pcm;
+}
+
+static int16_t *load(const char *path, int want_rate, int *count)
+{
+	int rate = 0;
+	int16_t *pcm = wav_read(path, count, &rate);
+	if (pcm && rate != want_rate) {
+		fprintf(stderr, "%s: %d Hz, se espera %d Hz\n", path, rate, want_rate);
+		free(pcm);
+		pcm = NULL;
+	}
+	if (pcm == NULL) exit(2);
+	return pcm;
+}
+
+/* Lag of y behind x with the largest cross correlation, samples */
+static int best_lag(const int16_t *x, const int16_t *y, int count, int max_lag)
+{
+	double best = 0;
+	int lag = -1;
+	for (int l = 0; l < max_lag && l < count; l++) {
+		double c = 0;
+		for (int i = 0; i + l < count; i++) c += (double)x[i] * y[i + l];
+		if (c > best) {
+			best = c;
+			lag = l;
+		}
+	}
+	return lag;
+}
+
+static uint32_t fnv1a(uint32_t h, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	for (size_t i = 0; i < len; i++) h = (h ^ p[i]) * 16777619u;
+	return h;
+}
+
+static uint32_t hash_pcm(const int16_t *pcm, int count)
+{
+	uint32_t h = 2166136261u;
+	for (int i = 0; i < count; i++) {
+		uint8_t le[2] = { (uint8_t)pcm[i], (uint8_t)(pcm[i] >> 8) };
+		h = fnv1a(h, le, 2);
+	}
+	return h;
+}
+
+typedef struct {
+	int64_t arrival_us;
+	uint8_t code[PACKET];
+} packet_t;
+
+// GOLDEN #####################################################################
+
+#define RESULTS_MAX 24
+
+typedef struct {
+	int count;
+	char key[RESULTS_MAX][24];
+	char value[RESULTS_MAX][24];
+} results_t;
+
+static void result(results_t *r, const char *key, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	snprintf(r->key[r->count], sizeof(r->key[0]), "%s", key);
+	vsnprintf(r->value[r->count], sizeof(r->value[0]), fmt, ap);
+	va_end(ap);
+	r->count++;
+}
+
+static void golden_compare(const results_t *r, const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		perror(path);
+		bench_check(0, "salidas contra la referencia");
+		return;
+	}
+
+	char line[128], key[32], value[32];
+	int found[RESULTS_MAX] = { 0 };
+	int ok = 1;
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || sscanf(line, "%31s %31s", key, value) != 2) continue;
+		for (int i = 0; i < r->count; i++) {
+			if (strcmp(key, r->key[i]) != 0) continue;
+			found[i] = 1;
+			if (strcmp(value, r->value[i]) != 0) {
+				printf("  %s: referencia %s, ahora %s\n", key, value, r->value[i]);
+				ok = 0;
+			}
+		}
+	}
+	fclose(f);
+	for (int i = 0; i < r->count; i++) {
+		if (!found[i]) {
+			printf("  %s: falta en %s\n", r->key[i], path);
+			ok = 0;
+		}
+	}
+	bench_check(ok, "salidas iguales a la referencia");
+}
+
+static void golden_update(const results_t *r, const char *path)
+{
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		perror(path);
+		exit(2);
+	}
+	fprintf(f, "# Salidas de referencia de audio_bench, regenerar con -u\n");
+	for (int i = 0; i < r->count; i++) fprintf(f, "%s %s\n", r->key[i], r->value[i]);
+	fclose(f);
+	printf("  referencia escrita en %s\n", path);
+}
+
+// DECIMATOR ##################################################################
+
+#define DEC_SECONDS     1
+#define DEC_CHUNK       7           // Splits the kept outputs unevenly
+
+/* Decimate the whole signal, in one call or DEC_CHUNK samples at a time */
+static int16_t *decimate(const int16_t *in, int count, int chunk, int *out_count)
+{
+	static decimator_t dec;
+	int16_t *out = malloc((count / DECIMATOR_FACTOR + 1) * sizeof(int16_t));
+	int n = 0;
+	decimator_init(&dec);
+	for (int i = 0; i < count; i += chunk) {
+		n += decimator_process(&dec, in + i, count - i < chunk ? count - i : chunk, out + n);
+	}
+	*out_count = n;
+	return out;
+}
+
+/* Level of a tone after the decimator, dB relative to its input. The
+* first 100 ms let the DC blocker and the filter settle. */
+static double tone_gain_db(int freq)
+{
+	int count = DEC_SECONDS * MIC_RATE, n;
+	int16_t *in = malloc(count * sizeof(int16_t));
+	for (int i = 0; i < count; i++) in[i] = lrint(16384 * sin(2 * M_PI * freq * i / MIC_RATE));
+	int16_t *out = decimate(in, count, count, &n);
+
+	double in_sum = 0, out_sum = 0;
+	for (int i = count / 10; i < count; i++) in_sum += (double)in[i] * in[i];
+	for (int i = n / 10; i < n; i++) out_sum += (double)out[i] * out[i];
+	free(out);
+	free(in);
+	return 10 * log10((out_sum / (n - n / 10)) / (in_sum / (count - count / 10)) + 1e-12);
+}
+
+/* Fixed vectors through the decimator alone, so a change to its filter
+* shows here and not only in the hash of the whole uplink */
+static void decimator_vectors(results_t *r)
+{
+	int count = DEC_SECONDS * MIC_RATE, n, chunked_n;
+	int16_t *impulse = calloc(count, sizeof(int16_t));
+	impulse[0] = 16384;
+	int16_t *out = decimate(impulse, count, count, &n);
+	int16_t *chunked = decimate(impulse, count, DEC_CHUNK, &chunked_n);
+	int peak = 0;
+	for (int i = 1; i < n; i++) {
+		if (abs(out[i]) > abs(out[peak])) peak = i;
+	}
+	int same = n == count / DECIMATOR_FACTOR && chunked_n == n && memcmp(out, chunked, n * sizeof(int16_t)) == 0;
+	result(r, "decim_impulse", "%08x", hash_pcm(out, n));
+	result(r, "decim_impulse_peak", "%d", peak);
+	free(chunked);
+	free(out);
+	free(impulse);
+
+	/* Exponential sweep from 20 Hz to 24 kHz at -6 dBFS, through the
+	* passband, the transition and everything that would alias */
+	int16_t *sweep = malloc(count * sizeof(int16_t));
+	double k = log(24000.0 / 20), phase = 0;
+	for (int i = 0; i < count; i++) {
+		phase += 2 * M_PI * 20 * exp(k * i / count) / MIC_RATE;
+		sweep[i] = lrint(16384 * sin(phase));
+	}
+	out = decimate(sweep, count, count, &n);
+	chunked = decimate(sweep, count, DEC_CHUNK, &chunked_n);
+	same = same && chunked_n == n && memcmp(out, chunked, n * sizeof(int16_t)) == 0;
+	result(r, "decim_sweep", "%08x", hash_pcm(out, n));
+	free(chunked);
+	free(out);
+	free(sweep);
+
+	double pass = tone_gain_db(1000), stop = tone_gain_db(6000);
+	result(r, "decim_1k_db", "%.2f", pass);
+	result(r, "decim_6k_db", "%.1f", stop);
+
+	printf("Decimador 48 a 8 kHz\n");
+	printf("  impulso: pico en la salida %d (%.1f ms), 1 kHz %+.2f dB, 6 kHz %.1f dB\n",
+		peak, peak * 1000.0 / RATE, pass, stop);
+	bench_check(same, "decimador igual en bloques de 7 muestras");
+	bench_check(fabs(pass) < 0.1, "decimador plano en la banda de voz");
+	bench_check(stop < -49, "decimador atenúa lo que se plegaría");
+}
+
+// CHAINS #####################################################################
+
+enum { ST_DECIM, ST_AEC, ST_VAD, ST_ENCODE, ST_DECODE, ST_JITTER, ST_COUNT };
+
+void chains_run(const chains_cfg_t *cfg)
+{
+	g711_law_t law = cfg->law;
+	int mic_count, far_count;
+	seed = 1;
+	net_seed = 1;
+
+	int16_t *near = cfg->mic_path ? load(cfg->mic_path, MIC_RATE, &mic_count) :
+		synth(&near_voice, MIC_RATE, mic_count = SYNTH_SECONDS * MIC_RATE);
+	int16_t *far = cfg->far_path ? load(cfg->far_path, RATE, &far_count) :
+		synth(&far_voice, RATE, far_count = SYNTH_SECONDS * RATE);
+
+	int ticks = mic_count / TICK_MIC;
+	if (far_count / TICK > ticks) ticks = far_count / TICK;
+	int count = ticks * TICK;
+
+	int16_t *near8 = calloc(count, sizeof(int16_t));
+	int16_t *far8 = calloc(count, sizeof(int16_t));
+	int16_t *uplink = calloc(count, sizeof(int16_t));
+	int16_t *speaker = calloc(count, sizeof(int16_t));
+	uint8_t *payload = calloc(count, 1);
+	for (int i = 0; i < count && i * DECIMATOR_FACTOR < mic_count; i++) near8[i] = near[i * DECIMATOR_FACTOR];
+	memcpy(far8, far, (far_count < count ? far_count : count) * sizeof(int16_t));
+
+	static decimator_t dec;
+	static echo_canceller_t ec;
+	static jitter_buffer_t jb;
+	static vad_t vad;
+	static packet_t pending[PENDING_MAX];
+	int npending = 0;
+	decimator_init(&dec);
+	echo_canceller_init(&ec, AEC_TAPS, ECHO_DELAY);
+	echo_canceller_start(&ec);
+	jitter_buffer_init(&jb, JB_MIN_MS, JB_MAX_MS);
+	vad_init(&vad, 200);
+
+	bench_stage_t st[ST_COUNT] = {
+		[ST_DECIM] = { .name = "decimador 48 a 8 kHz" },
+		[ST_AEC] = { .name = "cancelador de eco" },
+		[ST_VAD] = { .name = "detector de voz" },
+		[ST_ENCODE] = { .name = "G.711 codificar" },
+		[ST_DECODE] = { .name = "G.711 decodificar" },
+		[ST_JITTER] = { .name = "buffer de jitter" },
+	};
+
+	int16_t mic[TICK_MIC], up[TICK_MIC], frame[TICK], pcm[PACKET], pkt[PACKET];
+	uint8_t code[PACKET];
+	int up_fill = 0, up_pos = 0, packets = 0, silent = 0, sent = 0;
+	bool pkt_speech = false;
+
+	for (int t = 0; t < ticks; t++) {
+		int64_t now_us = (int64_t)t * 10000;
+
+		/* Far end, a packet every 20 ms once its audio is complete */
+		if (t % 2 == 1) {
+			g711_encode(law, far8 + (t - 1) * TICK, code, PACKET);
+			bool lost = (int)(net_random() % 100) < cfg->loss_pct;
+			int jitter_us = cfg->jitter_ms ? net_random() % (cfg->jitter_ms * 1000) : 0;
+			if (!lost && npending < PENDING_MAX) {
+				pending[npending].arrival_us = now_us + 10000 + NET_BASE_MS * 1000 + jitter_us;
+				memcpy(pending[npending].code, code, PACKET);
+				npending++;
+				sent++;
+			}
+		}
+
+		/* Deliver what arrived by now, in arrival order */
+		for (;;) {
+			int first = -1;
+			for (int i = 0; i < npending; i++) {
+				if (pending[i].arrival_us <= now_us &&
+					(first < 0 || pending[i].arrival_us < pending[first].arrival_us)) first = i;
+			}
+			if (first < 0) break;
+			bench_begin(&st[ST_DECODE]);
+			g711_decode(law, pending[first].code, pcm, PACKET);
+			bench_end(&st[ST_DECODE]);
+			bench_begin(&st[ST_JITTER]);
+			jitter_buffer_put(&jb, pcm, PACKET, pending[first].arrival_us);
+			bench_end(&st[ST_JITTER]);
+			pending[first] = pending[--npending];
+		}
+
+		bench_begin(&st[ST_JITTER]);
+		jitter_buffer_get(&jb, frame);
+		bench_end(&st[ST_JITTER]);
+		memcpy(speaker + t * TICK, frame, sizeof(frame));
+		bench_begin(&st[ST_AEC]);
+		echo_canceller_reference(&ec, frame, TICK);
+		bench_end(&st[ST_AEC]);
+
+		/* Microphone, the near end plus room noise plus the echo held over
+		* the six input samples of each speaker sample */
+		for (int i = 0; i < TICK_MIC; i++) {
+			int n = t * TICK_MIC + i;
+			int s8 = n / DECIMATOR_FACTOR - ECHO_DELAY;
+			int32_t s = (n < mic_count ? near[n] : 0) + noise(ROOM_NOISE);
+			if (s8 >= 0) s += speaker[s8] >> ECHO_SHIFT;
+			mic[i] = sat(s);
+		}
+
+		bench_begin(&st[ST_DECIM]);
+		int n = decimator_process(&dec, mic, TICK_MIC, up);
+		bench_end(&st[ST_DECIM]);
+		bench_begin(&st[ST_AEC]);
+		echo_canceller_process(&ec, up, n);
+		bench_end(&st[ST_AEC]);
+		bench_begin(&st[ST_VAD]);
+		vad_hold(&vad, echo_canceller_suppression_db(&ec) <= VAD_HOLD_DB);
+		pkt_speech |= vad_process(&vad, up, n);
+		bench_end(&st[ST_VAD]);
+
+		for (int i = 0; i < n; i++) {
+			pkt[up_fill++] = up[i];
+			if (up_fill < PACKET) continue;
+			bench_begin(&st[ST_ENCODE]);
+			g711_encode(law, pkt, code, PACKET);
+			bench_end(&st[ST_ENCODE]);
+			if (up_pos + PACKET <= count) {
+				memcpy(payload + up_pos, code, PACKET);
+				g711_decode(law, code, uplink + up_pos, PACKET);
+				up_pos += PACKET;
+			}
+			packets++;
+			if (!pkt_speech) silent++;
+			pkt_speech = false;
+			up_fill = 0;
+		}
+	}
+
+	/* The speaker and the payload are aligned with the input sample clock,
+	* so the lags are the delays of the chains themselves */
+	int up_lag = best_lag(near8, uplink, up_pos, MAX_LAG_MS * RATE / 1000);
+	int down_lag = best_lag(far8, speaker, count, MAX_LAG_MS * RATE / 1000);
+
+	echo_canceller_stats_t aec;
+	echo_canceller_stats(&ec, &aec);
+	jitter_buffer_stats_t jbs;
+	jitter_buffer_stats(&jb, &jbs);
+	vad_stats_t vs;
+	vad_stats(&vad, &vs);
+
+	printf("Cadenas de audio, %s, %d s, jitter %d ms, pérdida %d%%\n", g711_law_name(law),
+		count / RATE, cfg->jitter_ms, cfg->loss_pct);
+	for (int i = 0; i < ST_COUNT; i++) {
+		printf("  %-24s %8.2f us %9.0f ciclos cada 10 ms\n", st[i].name,
+			st[i].ns / 1000 / ticks, (double)st[i].cycles / ticks);
+	}
+	if (up_lag >= 0) {
+		printf("  boca a paquete            %5.1f ms más 20 ms de paquetización\n", up_lag * 1000.0 / RATE);
+	}
+	if (down_lag >= 0) {
+		printf("  paquete a oído            %5.1f ms con %d ms de red (objetivo del buffer %d ms)\n",
+			down_lag * 1000.0 / RATE, NET_BASE_MS, jbs.target_ms);
+	}
+	printf("  eco eliminado %d dB, doble habla %d%%\n", aec.erle_db, aec.double_talk_pct);
+	printf("  voz %u%% de los bloques, %d de %d paquetes en silencio\n",
+		vs.frames ? vs.speech * 100 / vs.frames : 0, silent, packets);
+	printf("  %d paquetes recibidos de %d enviados; bloques de 10 ms: %u reconstruidos, %u perdidos, %u tarde\n",
+		sent, ticks / 2, jbs.concealed, jbs.lost, jbs.late);
+
+	/* The drops must follow the requested rate, within 3 standard deviations */
+	double expected = ticks / 2 * cfg->loss_pct / 100.0;
+	double spread = 3 * sqrt(expected * (100 - cfg->loss_pct) / 100.0) + 1;
+	bench_check(fabs(ticks / 2 - sent - expected) <= spread, "pérdida de la red según -l");
+	if (cfg->jitter_ms == 0) {
+		/* Nothing arrives out of time, each drop is two lost frames */
+		bench_check(jbs.lost == 2u * (ticks / 2 - sent) && jbs.late == 0, "sin jitter, 2 bloques perdidos por paquete");
+	}
+
+	results_t r = { 0 };
+	result(&r, "uplink", "%08x", fnv1a(2166136261u, payload, up_pos));
+	result(&r, "downlink", "%08x", hash_pcm(speaker, count));
+	result(&r, "uplink_lag", "%d", up_lag);
+	result(&r, "downlink_lag", "%d", down_lag);
+	result(&r, "erle_db", "%d", aec.erle_db);
+	result(&r, "silent_packets", "%d", silent);
+	result(&r, "dropped_packets", "%d", ticks / 2 - sent);
+	result(&r, "concealed", "%u", jbs.concealed);
+	result(&r, "lost", "%u", jbs.lost);
+	result(&r, "late", "%u", jbs.late);
+	decimator_vectors(&r);
+	if (cfg->golden) golden_compare(&r, cfg->golden);
+	if (cfg->update) golden_update(&r, cfg->update);
+
+	if (cfg->out_dir) {
+		char path[512];
+		snprintf(path, sizeof(path), "%s/uplink.wav", cfg->out_dir);
+		wav_write(path, uplink, up_pos, RATE);
+		snprintf(path, sizeof(path), "%s/downlink.wav", cfg->out_dir);
+		wav_write(path, speaker, count, RATE);
+	}
+
+	free(near);
+	free(far);
+	free(near8);
+	free(far8);
+	free(uplink);
+	free(speaker);
+	free(payload);
+}
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wav.h"
+
+static uint32_t le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t le16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+int16_t *wav_read(const char *path, int *count, int *rate)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		perror(path);
+		return NULL;
+	}
+
+	uint8_t head[12], chunk[8], fmt[16];
+	int16_t *pcm = NULL;
+	int have_fmt = 0;
+	if (fread(head, 1, 12, f) != 12 || memcmp(head, "RIFF", 4) != 0 || memcmp(head + 8, "WAVE", 4) != 0) {
+		fprintf(stderr, "%s: no es un WAV\n", path);
+		goto done;
+	}
+
+	while (fread(chunk, 1, 8, f) == 8) {
+		uint32_t len = le32(chunk + 4);
+		if (memcmp(chunk, "fmt ", 4) == 0 && len >= 16) {
+			if (fread(fmt, 1, 16, f) != 16) break;
+			fseek(f, len - 16 + (len & 1), SEEK_CUR);
+			if (le16(fmt) != 1 || le16(fmt + 2) != 1 || le16(fmt + 14) != 16) {
+				fprintf(stderr, "%s: se espera PCM de 16 bits mono\n", path);
+				goto done;
+			}
+			*rate = le32(fmt + 4);
+			have_fmt = 1;
+		} else if (memcmp(chunk, "data", 4) == 0 && have_fmt) {
+			pcm = malloc(len + 2);
+			if (pcm == NULL || fread(pcm, 1, len, f) != len) {
+				fprintf(stderr, "%s: datos incompletos\n", path);
+				free(pcm);
+				pcm = NULL;
+				goto done;
+			}
+			*count = len / 2;
+			for (int i = 0; i < *count; i++) pcm[i] = le16((uint8_t *)&pcm[i]);
+			goto done;
+		} else {
+			fseek(f, len + (len & 1), SEEK_CUR);
+		}
+	}
+	fprintf(stderr, "%s: sin datos de audio\n", path);
+
+done:
+	fclose(f);
+	return pcm;
+}
+
+int wav_write(const char *path, const int16_t *pcm, int count, int rate)
+{
+	FILE *f = fopen(path, "wb");
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	uint8_t h[44];
+	uint32_t bytes = count * 2;
+	memcpy(h, "RIFF", 4);
+	put32(h + 4, 36 + bytes);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	put32(h + 16, 16);
+	put16(h + 20, 1);
+	put16(h + 22, 1);
+	put32(h + 24, rate);
+	put32(h + 28, rate * 2);
+	put16(h + 32, 2);
+	put16(h + 34, 16);
+	memcpy(h + 36, "data", 4);
+	put32(h + 40, bytes);
+
+	int ok = fwrite(h, 1, 44, f) == 44;
+	for (int i = 0; ok && i < count; i++) {
+		uint8_t s[2];
+		put16(s, pcm[i]);
+		ok = fwrite(s, 1, 2, f) == 2;
+	}
+	if (fclose(f) != 0) ok = 0;
+	if (!ok) fprintf(stderr, "%s: no se pudo escribir\n", path);
+	return ok ? 0 : -1;
+}
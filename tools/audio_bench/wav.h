@@ -0,0 +1,19 @@
+#ifndef WAV_H
+#define WAV_H
+
+#include <stdint.h>
+
+/**
+ * @brief Read a 16 bit PCM mono WAV file
+ *
+ * @return samples, malloc'd, NULL with a message on stderr if the file
+ *         can not be read or is not in that format
+ */
+int16_t *wav_read(const char *path, int *count, int *rate);
+
+/**
+ * @return 0 on success, -1 with a message on stderr
+ */
+int wav_write(const char *path, const int16_t *pcm, int count, int rate);
+
+#endif
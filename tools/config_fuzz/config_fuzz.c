@@ -0,0 +1,115 @@
+/* libFuzzer target over json_config_parse() with the llamador and megafono
+* config tables. An accepted config must hold values within each field's
+* limits and survive json_config_write() and a second parse unchanged. A
+* rejected one may be partly written, but never past a member. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_config.h"
+#include "tables.h"
+
+#define FAIL(t, f, what) do { \
+	fprintf(stderr, "%s: %s %s\n", (t)->name, (f)->key, (what)); \
+	abort(); \
+} while (0)
+
+/* Every written member within its limits */
+static void check_fields(const config_table_t *t, const unsigned char *cfg)
+{
+	for (size_t i = 0; i < t->count; i++) {
+		const json_config_field_t *f = &t->fields[i];
+		const unsigned char *p = cfg + f->offset;
+
+		switch (f->type) {
+		case JSON_CONFIG_BOOL:
+			if (*p > 1)
+				FAIL(t, f, "not a bool");
+			break;
+		case JSON_CONFIG_INT: {
+			int v;
+
+			memcpy(&v, p, sizeof(v));
+			if (v < f->min || v > f->max)
+				FAIL(t, f, "out of range");
+			break;
+		}
+		case JSON_CONFIG_STR:
+		case JSON_CONFIG_IP:
+			if (memchr(p, '\0', f->size) == NULL)
+				FAIL(t, f, "not terminated");
+			break;
+		}
+	}
+}
+
+/* Compared by value, the bytes after a string terminator may differ */
+static bool same_fields(const config_table_t *t, const unsigned char *a, const unsigned char *b)
+{
+	for (size_t i = 0; i < t->count; i++) {
+		const json_config_field_t *f = &t->fields[i];
+
+		switch (f->type) {
+		case JSON_CONFIG_BOOL:
+			if (a[f->offset] != b[f->offset])
+				return false;
+			break;
+		case JSON_CONFIG_INT:
+			if (memcmp(a + f->offset, b + f->offset, sizeof(int)))
+				return false;
+			break;
+		case JSON_CONFIG_STR:
+		case JSON_CONFIG_IP:
+			if (strcmp((const char *)a + f->offset, (const char *)b + f->offset))
+				return false;
+			break;
+		}
+	}
+	return true;
+}
+
+static void fuzz_table(const config_table_t *t, const char *json, size_t len)
+{
+	unsigned char *cfg = malloc(t->size), *again = malloc(t->size);
+	char out[CONFIG_WRITE_MAX];
+	size_t out_len;
+
+	if (cfg == NULL || again == NULL)
+		abort();
+	memset(cfg, 0, t->size);
+	json_config_defaults(t->fields, t->count, cfg);
+	if (json_config_parse(t->fields, t->count, json, len, cfg) == NULL) {
+		check_fields(t, cfg);
+
+		out_len = json_config_write(t->fields, t->count, cfg, out, sizeof(out));
+		if (out_len == 0) {
+			fprintf(stderr, "%s: config does not fit in %d bytes\n", t->name, CONFIG_WRITE_MAX);
+			abort();
+		}
+		memset(again, 0, t->size);
+		json_config_defaults(t->fields, t->count, again);
+		if (json_config_parse(t->fields, t->count, out, out_len, again) != NULL) {
+			fprintf(stderr, "%s: own output rejected: %.*s\n", t->name, (int)out_len, out);
+			abort();
+		}
+		if (!same_fields(t, cfg, again)) {
+			fprintf(stderr, "%s: changed on the round trip: %.*s\n", t->name, (int)out_len, out);
+			abort();
+		}
+	} else {
+		check_fields(t, cfg);
+	}
+	free(again);
+	free(cfg);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	/* libFuzzer hands an exact size buffer, so reading past len trips ASan */
+	fuzz_table(&llamador_table, (const char *)data, size);
+	fuzz_table(&megafono_table, (const char *)data, size);
+	return 0;
+}
@@ -0,0 +1,124 @@
+/* Stand-in for the libFuzzer driver where clang is not available: runs
+* every seed file given, then a fixed series of mutations of each, so a
+* run always covers the same inputs. Build it with ASan and UBSan. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define INPUT_MAX   4096
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static const char *const tokens[] = {
+	"{", "}", "[", "]", ",", ":", "\"", "\\", "\\u", "\\ud83d", "\\u0000",
+	"true", "false", "null", "-", "0", "2147483648", "1e3", "0.5",
+	"\"ip\"", "\"codec\"", "\"tone\"", "\"dhcp\"", "\"sip1\"", "\"sip\"",
+	"\"999.1.1.1\"", "\"1.2.3\"", "\xc3\xb1", "\xff", " ",
+};
+
+static uint32_t rng = 1;
+
+static uint32_t next(void)
+{
+	rng = rng * 1103515245u + 12345u;
+	return rng >> 8;
+}
+
+/* An exact size copy, reading past it trips ASan */
+static void run(const uint8_t *data, size_t len)
+{
+	uint8_t *copy = malloc(len ? len : 1);
+
+	if (copy == NULL)
+		abort();
+	memcpy(copy, data, len);
+	LLVMFuzzerTestOneInput(copy, len);
+	free(copy);
+}
+
+static size_t mutate(uint8_t *buf, size_t len)
+{
+	size_t at = len ? next() % len : 0;
+	const char *tok;
+	size_t n;
+
+	switch (next() % 5) {
+	case 0:         // Flip a bit
+		if (len)
+			buf[at] ^= 1 << (next() % 8);
+		break;
+	case 1:         // Random byte
+		if (len)
+			buf[at] = next();
+		break;
+	case 2:         // Delete a run
+		n = next() % 4 + 1;
+		if (n > len - at)
+			n = len - at;
+		memmove(buf + at, buf + at + n, len - at - n);
+		len -= n;
+		break;
+	case 3:         // Insert a JSON token
+		tok = tokens[next() % (sizeof(tokens) / sizeof(tokens[0]))];
+		n = strlen(tok);
+		if (len + n <= INPUT_MAX) {
+			memmove(buf + at + n, buf + at, len - at);
+			memcpy(buf + at, tok, n);
+			len += n;
+		}
+		break;
+	default:        // Truncate
+		len = at;
+		break;
+	}
+	return len;
+}
+
+int main(int argc, char **argv)
+{
+	static uint8_t seed[INPUT_MAX], buf[INPUT_MAX];
+	int rounds = 2000;
+	unsigned long inputs = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			rounds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Uso: %s [-n mutaciones] semilla...\n", argv[0]);
+			return 2;
+		}
+	}
+	for (int i = optind; i < argc; i++) {
+		FILE *f = fopen(argv[i], "rb");
+		size_t seed_len, len = 0;
+
+		if (f == NULL) {
+			perror(argv[i]);
+			return 2;
+		}
+		seed_len = fread(seed, 1, sizeof(seed), f);
+		fclose(f);
+
+		run(seed, seed_len);
+		inputs++;
+		rng = i;
+		for (int r = 0; r < rounds; r++) {
+			/* Stack a few mutations, starting again from the seed now and then */
+			if (r % 8 == 0) {
+				memcpy(buf, seed, seed_len);
+				len = seed_len;
+			}
+			len = mutate(buf, len);
+			run(buf, len);
+			inputs++;
+		}
+	}
+	printf("config_fuzz: %lu entradas sin fallos\n", inputs);
+	return 0;
+}
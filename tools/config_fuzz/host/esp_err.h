@@ -0,0 +1,7 @@
+/* Host stand-in for the ESP-IDF header, config.h only needs the type */
+#ifndef ESP_ERR_H
+#define ESP_ERR_H
+
+typedef int esp_err_t;
+
+#endif
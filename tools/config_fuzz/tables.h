@@ -0,0 +1,20 @@
+#ifndef TABLES_H
+#define TABLES_H
+
+#include <stddef.h>
+
+#include "json_config.h"
+
+/* The config keys of one app, the same table its config.c uses */
+typedef struct {
+	const char *name;
+	const json_config_field_t *fields;
+	size_t count;
+	size_t size;                // Of the config struct
+} config_table_t;
+
+extern const config_table_t llamador_table, megafono_table;
+
+#define CONFIG_WRITE_MAX    2048    // Longest serialized config, with escapes
+
+#endif
@@ -0,0 +1,297 @@
+#!/usr/bin/env python3
+"""Administración masiva de llamadores y megáfonos.
+
+  fleet.py discover                       lista los equipos de la VLAN
+  fleet.py push-config cambios.json       aplica cambios de configuración
+  fleet.py update voip_app.bin            instala un firmware
+
+Los equipos se descubren con una sonda UDP a la dirección de broadcast
+(puerto 47474, CONFIG_DISCOVERY_PORT); con --host la sonda va a cada
+equipo indicado. Con --reboot sólo se reinician los que respondieron que
+están libres, el resto queda con el reinicio pendiente.
+Las operaciones corren en paralelo con a lo sumo --jobs equipos a la vez y
+terminan con un informe por equipo. El código de salida es 1 si algún
+equipo falló.
+
+Sólo usa la biblioteca estándar de Python 3.
+"""
+
+import argparse
+import concurrent.futures
+import hashlib
+import json
+import socket
+import sys
+import time
+import urllib.error
+import urllib.request
+
+DISCOVERY_PORT = 47474
+DISCOVERY_PROBE = b"DISCOVER"
+
+OTA_CHUNK = 256 * 1024
+OTA_RETRIES = 5
+HTTP_TIMEOUT = 30
+
+# Keys that identify a single device, pushing them to several would clash
+NETWORK_KEYS = ("dhcp", "ip", "gw", "mask")
+
+
+def discover(broadcasts, port, timeout, probes):
+    """Broadcast probes and collect the replies, one per chip id."""
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_BROADCAST, 1)
+    sock.bind(("", 0))
+
+    devices = {}
+    deadline = time.monotonic() + timeout
+    next_probe = 0.0
+    sent = 0
+    while True:
+        now = time.monotonic()
+        if now >= deadline:
+            break
+        # Repeat the probe, UDP may be lost on a busy network
+        if sent < probes and now >= next_probe:
+            for addr in broadcasts:
+                sock.sendto(DISCOVERY_PROBE, (addr, port))
+            sent += 1
+            next_probe = now + timeout / (probes + 1)
+        wake = min(deadline, next_probe) if sent < probes else deadline
+        sock.settimeout(max(0.01, wake - now))
+        try:
+            data, addr = sock.recvfrom(1024)
+        except socket.timeout:
+            continue
+        try:
+            dev = json.loads(data.decode())
+        except ValueError:
+            continue
+        dev.setdefault("ip", addr[0])
+        devices[dev.get("chip_id", addr[0])] = dev
+    sock.close()
+    return sorted(devices.values(), key=lambda d: socket.inet_aton(d["ip"]))
+
+
+def http(ip, method, path, body=None, headers=None, timeout=HTTP_TIMEOUT):
+    """Return (status, text), status 0 when the device could not be reached."""
+    req = urllib.request.Request("http://%s%s" % (ip, path), data=body, method=method, headers=headers or {})
+    try:
+        with urllib.request.urlopen(req, timeout=timeout) as resp:
+            return resp.status, resp.read().decode(errors="replace")
+    except urllib.error.HTTPError as e:
+        return e.code, e.read().decode(errors="replace")
+    except (urllib.error.URLError, OSError) as e:
+        return 0, str(getattr(e, "reason", e))
+
+
+def reboot(dev):
+    """Reboot only a device that reported no call or ticket in progress."""
+    if dev.get("idle") is False:
+        return "reinicio pendiente (ocupado)"
+    if dev.get("idle") is not True:
+        return "reinicio pendiente (estado desconocido)"
+    status, text = http(dev["ip"], "POST", "/reboot", b"", timeout=5)
+    # The device closes the connection while restarting
+    return "reiniciado" if status in (0, 200) else "no se pudo reiniciar (%d)" % status
+
+
+def push_config(dev, changes, do_reboot):
+    status, text = http(dev["ip"], "GET", "/conf")
+    if status != 200:
+        return False, "no se pudo leer /conf (%d %s)" % (status, text.strip())
+    try:
+        conf = json.loads(text)
+    except ValueError:
+        return False, "/conf inválido"
+
+    merged = dict(conf)
+    merged.update(changes)
+    if merged == conf:
+        return True, "sin cambios"
+
+    status, text = http(dev["ip"], "POST", "/save", json.dumps(merged, separators=(",", ":")).encode(),
+                        {"Content-Type": "application/json"})
+    if status != 200:
+        return False, "rechazada (%d %s)" % (status, text.strip())
+
+    try:
+        restart = json.loads(text).get("restart", False)
+    except ValueError:
+        # Older firmware answers plain text and applies the config on restart
+        restart = True
+    if not restart:
+        return True, "aplicada"
+    if do_reboot:
+        return True, "guardada, " + reboot(dev)
+    return True, "guardada, requiere reinicio"
+
+
+def ota_status(ip):
+    status, text = http(ip, "GET", "/update")
+    try:
+        return json.loads(text) if status == 200 else None
+    except ValueError:
+        return None
+
+
+def update(dev, image, sha256, version, do_reboot):
+    if version is not None and dev.get("version") == version:
+        return True, "ya tiene v%d" % version
+
+    size = len(image)
+    start = time.monotonic()
+
+    # Resume an interrupted upload of this same image
+    offset = 0
+    st = ota_status(dev["ip"])
+    if st and st.get("state") == "partial" and st.get("size") == size and st.get("sha256") == sha256:
+        offset = st.get("offset", 0)
+
+    retries = 0
+    while True:
+        chunk = image[offset:offset + OTA_CHUNK]
+        status, text = http(dev["ip"], "POST", "/update", chunk, {
+            "Content-Type": "application/octet-stream",
+            "X-OTA-Size": str(size),
+            "X-OTA-Offset": str(offset),
+            "X-OTA-SHA256": sha256,
+        }, timeout=120)
+        try:
+            st = json.loads(text)
+        except ValueError:
+            st = None
+
+        if status == 200 and st and st.get("state") == "done":
+            break
+        if status in (200, 409) and st and st.get("state") == "partial":
+            if status == 200:
+                retries = 0
+            offset = st.get("offset", 0)
+            continue
+        if status in (0, 408, 500, 503) and retries < OTA_RETRIES:
+            # Network trouble or a background download, ask where to resume
+            retries += 1
+            time.sleep(2 * retries)
+            st = ota_status(dev["ip"])
+            offset = st.get("offset", 0) if st and st.get("state") == "partial" and st.get("size") == size else 0
+            continue
+        return False, "falló (%d %s)" % (status, text.strip()[:60])
+
+    secs = time.monotonic() - start
+    result = "instalado en %.0f s (%s KB/s)" % (secs, st.get("kbps", "?"))
+    if do_reboot:
+        result += ", " + reboot(dev)
+    return True, result
+
+
+def targets(args):
+    if args.host:
+        # The same probe, sent to each host, so they carry idle and version too
+        found = {d["ip"]: d for d in discover(args.host, args.port, args.timeout, args.probes)}
+        return [found.get(ip, {"ip": ip}) for ip in args.host]
+    devices = discover(args.broadcast or ["255.255.255.255"], args.port, args.timeout, args.probes)
+    if args.model:
+        devices = [d for d in devices if d.get("model") == args.model]
+    return devices
+
+
+def run_all(devices, jobs, fn):
+    """Run fn on every device with bounded concurrency, print the report."""
+    results = {}
+    with concurrent.futures.ThreadPoolExecutor(max_workers=jobs) as pool:
+        futures = {pool.submit(fn, dev): dev for dev in devices}
+        for fut in concurrent.futures.as_completed(futures):
+            dev = futures[fut]
+            try:
+                ok, msg = fut.result()
+            except Exception as e:
+                ok, msg = False, "error: %s" % e
+            results[dev["ip"]] = (dev, ok, msg)
+            print("%-15s %s %s" % (dev["ip"], "OK   " if ok else "ERROR", msg), file=sys.stderr, flush=True)
+
+    failed = 0
+    print()
+    for ip in sorted(results, key=socket.inet_aton):
+        dev, ok, msg = results[ip]
+        failed += not ok
+        print("%-15s %-12s %-5s %s" % (ip, dev.get("chip_id", ""), "OK" if ok else "ERROR", msg))
+    print("\n%d equipos, %d correctos, %d con error" % (len(results), len(results) - failed, failed))
+    return 1 if failed else 0
+
+
+def cmd_discover(args):
+    devices = targets(args)
+    if args.json:
+        print(json.dumps(devices, indent=2))
+        return 0
+    for d in devices:
+        extra = " ".join("%s=%s" % (k, v) for k, v in d.items() if k not in ("ip", "chip_id", "model", "version"))
+        print("%-15s %-12s %-9s v%-4s %s" % (d["ip"], d.get("chip_id", ""), d.get("model", ""), d.get("version", "?"), extra))
+    print("\n%d equipos" % len(devices), file=sys.stderr)
+    return 0
+
+
+def cmd_push_config(args):
+    with open(args.config) as f:
+        changes = json.load(f)
+    if not isinstance(changes, dict):
+        sys.exit("%s debe ser un objeto JSON" % args.config)
+
+    devices = targets(args)
+    clash = [k for k in NETWORK_KEYS if k in changes]
+    if clash and len(devices) > 1:
+        sys.exit("%s identifican a un único equipo, use --host" % ", ".join(clash))
+    if not devices:
+        sys.exit("No se encontraron equipos")
+    return run_all(devices, args.jobs, lambda dev: push_config(dev, changes, args.reboot))
+
+
+def cmd_update(args):
+    with open(args.image, "rb") as f:
+        image = f.read()
+    sha256 = hashlib.sha256(image).hexdigest()
+
+    devices = targets(args)
+    if not devices:
+        sys.exit("No se encontraron equipos")
+    print("%s, %d KB, sha256 %s" % (args.image, len(image) // 1024, sha256), file=sys.stderr)
+    return run_all(devices, args.jobs, lambda dev: update(dev, image, sha256, args.version, args.reboot))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Administración masiva de llamadores y megáfonos")
+    common = argparse.ArgumentParser(add_help=False)
+    common.add_argument("--host", action="append", help="IP de un equipo, en lugar de descubrirlos (repetible)")
+    common.add_argument("--broadcast", action="append", help="dirección de broadcast (repetible, por defecto 255.255.255.255)")
+    common.add_argument("--port", type=int, default=DISCOVERY_PORT, help="puerto UDP de descubrimiento")
+    common.add_argument("--timeout", type=float, default=2.0, help="segundos de espera de respuestas")
+    common.add_argument("--probes", type=int, default=3, help="sondas enviadas")
+    common.add_argument("--model", choices=("llamador", "megafono"), help="sólo equipos de este tipo")
+
+    sub = parser.add_subparsers(dest="cmd")
+    sub.required = True
+
+    p = sub.add_parser("discover", parents=[common], help="listar los equipos")
+    p.add_argument("--json", action="store_true", help="salida JSON")
+    p.set_defaults(fn=cmd_discover)
+
+    p = sub.add_parser("push-config", parents=[common], help="aplicar cambios de configuración")
+    p.add_argument("config", help="objeto JSON con las claves a cambiar, el resto se conserva")
+    p.add_argument("--jobs", type=int, default=32, help="equipos en paralelo")
+    p.add_argument("--reboot", action="store_true", help="reiniciar los equipos libres si el cambio lo requiere")
+    p.set_defaults(fn=cmd_push_config)
+
+    p = sub.add_parser("update", parents=[common], help="instalar un firmware")
+    p.add_argument("image", help="archivo .bin")
+    p.add_argument("--jobs", type=int, default=8, help="equipos en paralelo")
+    p.add_argument("--version", type=int, help="omitir los equipos que ya tienen esta versión")
+    p.add_argument("--reboot", action="store_true", help="reiniciar los equipos libres al terminar")
+    p.set_defaults(fn=cmd_update)
+
+    args = parser.parse_args()
+    sys.exit(args.fn(args))
+
+
+if __name__ == "__main__":
+    main()